@@ -0,0 +1,708 @@
+//=============================================================================
+// bench.cpp - Micro- and macro-benchmarks for the raw UDP/RDMX hot paths
+//
+// Author: D. Wolf
+//
+// Usage: linux_raw_udp_bench [-nic <tx_nic>] [-rx <rx_nic>] [-seconds <n>]
+//                            [-loss <fraction>] [-json <file>] [-micro]
+//
+// The microbenchmarks time the header builders, the checksum routines and 
+// the payload generator.  The end-to-end benchmarks transmit UDP frames on 
+// <tx_nic> and receive them on <rx_nic> (by default, both are "lo"), sweeping
+// the payload size from 64 bytes up to the largest the MTU allows.  Either
+// half of a veth pair makes a good <tx_nic>/<rx_nic>.
+//
+// After the sweep, a buffer is sent from <tx_nic> to <rx_nic> with
+// CRdmxReliableSender, which is told to drop <fraction> of its frames
+// (5% by default).  The run fails (exits with status 1) unless the receiver
+// reports the transfer complete, nothing was unrecoverable, and the buffer
+// that landed matches the one that was sent.
+//
+// The results are written as JSON to stdout, or to <file> if "-json" is 
+// given.  "-micro" skips the end-to-end benchmarks, which need CAP_NET_RAW.
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include "../raw_nic.h"
+#include "../raw_udp.h"
+#include "../raw_rdmx.h"
+#include "../flow_table.h"
+#include "../checksum.h"
+#include "../payload.h"
+#include "../rdmx_receiver.h"
+#include "../rdmx_reliable.h"
+
+using std::string;
+using std::vector;
+
+//=============================================================================
+// Constants
+//=============================================================================
+#define UDP_HEADER_SIZE  42
+#define RDMX_HEADER_SIZE 64
+#define BENCH_UDP_PORT   47001
+#define BATCH_SIZE       32
+#define RELIABLE_SIZE    (16 << 20)
+#define RELIABLE_WINDOW  256
+//=============================================================================
+
+
+//=============================================================================
+// Command line options
+//=============================================================================
+struct options_t
+{
+    string  tx_nic     = "lo";
+    string  rx_nic     = "";
+    double  seconds    = 1.0;
+    double  loss       = 0.05;
+    string  json_file  = "";
+    bool    micro_only = false;
+} opt;
+//=============================================================================
+
+
+//=============================================================================
+// One microbenchmark result and one end-to-end result
+//=============================================================================
+struct micro_result_t
+{
+    string  name;
+    double  ns_per_op;
+};
+
+struct e2e_result_t
+{
+    int      payload;
+    uint64_t tx_frames;
+    uint64_t rx_frames;
+    double   tx_fps;
+    double   rx_fps;
+    double   rx_gbps;
+    double   lat_p50, lat_p90, lat_p99, lat_p999, lat_max;
+};
+
+struct reliable_result_t
+{
+    uint64_t bytes;
+    uint64_t frames_sent;
+    uint64_t dropped;
+    uint64_t retransmits;
+    uint64_t unrecoverable;
+    double   seconds;
+    bool     complete;
+    bool     match;
+    bool     passed;
+};
+//=============================================================================
+
+
+//=============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//=============================================================================
+static inline uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// Keeps the compiler from discarding a result we don't otherwise use
+//=============================================================================
+static volatile uint64_t sink;
+//=============================================================================
+
+
+//=============================================================================
+// time_op() - Runs "op" in a tight loop and returns the best-of-five time per
+//             call, in nanoseconds
+//=============================================================================
+template <class F> static double time_op(F&& op, uint64_t iterations = 1000000)
+{
+    double best = 1e30;
+
+    for (int pass=0; pass<5; ++pass)
+    {
+        uint64_t start = now_ns();
+        for (uint64_t i=0; i<iterations; ++i) op(i);
+        double ns = double(now_ns() - start) / iterations;
+        if (ns < best) best = ns;
+    }
+
+    return best;
+}
+//=============================================================================
+
+
+//=============================================================================
+// run_micro() - Runs every microbenchmark
+//=============================================================================
+static vector<micro_result_t> run_micro()
+{
+    vector<micro_result_t> results;
+    static uint8_t frame[64][10000];
+    uint8_t src_mac[] = {0xC4, 0x00, 0xAD, 0x3A, 0xD3, 0x6B};
+    uint8_t src_ip[]  = {10, 11, 12, 1};
+    uint8_t dst_ip[]  = {10, 11, 12, 255};
+
+    CRawUDP  udp;
+    CRawRDMX rdmx;
+    udp.set_mac_addrs(src_mac);
+    udp.set_ip_addrs(src_ip, dst_ip);
+    udp.set_udp_ports(1234, 5678);
+    rdmx.set_mac_addrs(src_mac);
+    rdmx.set_ip_addrs(src_ip, dst_ip);
+    rdmx.set_udp_ports(1234);
+
+    // Stamping single headers
+    results.push_back({"udp.write_header", time_op([&](uint64_t i)
+    {
+        udp.write_header(frame[i & 63], 256);
+    })});
+
+    results.push_back({"rdmx.write_header", time_op([&](uint64_t i)
+    {
+        rdmx.write_header(frame[i & 63], 256, i << 8);
+    })});
+
+    // Stamping a header built from a stack of layers that includes a VLAN tag
+    CFrameBuilder<eth_layer_t, vlan_layer_t, ipv4_layer_t, udp_layer_t, rdmx_layer_t> vlan_rdmx;
+    results.push_back({"vlan_rdmx.stamp", time_op([&](uint64_t i)
+    {
+        vlan_rdmx.stamp(frame[i & 63], 256, nullptr, [i](uint8_t* f)
+        {
+            decltype(vlan_rdmx)::hdr<rdmx_layer_t>(f).target_addr = htonll(i << 8);
+        });
+    })});
+
+    // Stamping headers in bulk, reported per frame
+    void*    where[64];
+    uint16_t length[64];
+    uint64_t target[64];
+    for (int i=0; i<64; ++i) 
+    {
+        where[i]  = frame[i];
+        length[i] = 256;
+        target[i] = i << 8;
+    }
+
+    results.push_back({"udp.write_headers/frame", time_op([&](uint64_t)
+    {
+        udp.write_headers(where, length, 64);
+    }, 100000) / 64});
+
+    results.push_back({"rdmx.write_headers/frame", time_op([&](uint64_t)
+    {
+        rdmx.write_headers(where, length, target, 64);
+    }, 100000) / 64});
+
+    // The same, with sequence numbers turned on
+    rdmx.set_sequencing(true);
+    results.push_back({"rdmx.write_header+seq", time_op([&](uint64_t i)
+    {
+        rdmx.write_header(frame[i & 63], 256, i << 8);
+    })});
+
+    results.push_back({"rdmx.write_headers+seq/frame", time_op([&](uint64_t)
+    {
+        rdmx.write_headers(where, length, target, 64);
+    }, 100000) / 64});
+
+    // And with transmit timestamps as well
+    rdmx.set_sequencing(true, true);
+    results.push_back({"rdmx.write_header+seq+ts", time_op([&](uint64_t i)
+    {
+        rdmx.write_header(frame[i & 63], 256, i << 8);
+    })});
+
+    results.push_back({"rdmx.write_headers+seq+ts/frame", time_op([&](uint64_t)
+    {
+        rdmx.write_headers(where, length, target, 64);
+    }, 100000) / 64});
+    rdmx.set_sequencing(false);
+
+    // Stamping headers from a table of 16 flows, hashed by target address
+    CRawNIC unused_nic;
+    CFlowTable<CRawRDMX> flows(unused_nic);
+    flows.make_port_flows(rdmx, 16, 1234);
+    flows.set_assignment(CFlowTable<CRawRDMX>::HASH);
+    results.push_back({"flow_table.write_header/16", time_op([&](uint64_t i)
+    {
+        flows.write_header(frame[i & 63], 256, i << 8);
+    })});
+
+    // Stamping headers with UDP checksums turned on
+    udp.set_udp_checksum(true);
+    rdmx.set_udp_checksum(true);
+    for (int size : {256, 8192})
+    {
+        results.push_back({"udp.write_header+csum/" + std::to_string(size), 
+        time_op([&](uint64_t i)
+        {
+            udp.write_header(frame[i & 63], size);
+        }, 200000)});
+
+        results.push_back({"rdmx.write_header+csum/" + std::to_string(size), 
+        time_op([&](uint64_t i)
+        {
+            rdmx.write_header(frame[i & 63], size, i << 13);
+        }, 200000)});
+    }
+    udp.set_udp_checksum(false);
+    rdmx.set_udp_checksum(false);
+
+    // The one's-complement summing kernel
+    for (int size : {20, 64, 1472, 8192})
+    {
+        results.push_back({string("ones_sum/") + ones_sum_impl() + "/" + std::to_string(size), 
+        time_op([&](uint64_t i)
+        {
+            sink += ones_sum(frame[i & 63], size);
+        }, 200000)});
+    }
+
+    // The mock payload generator
+    for (int size : {256, 8192})
+    {
+        results.push_back({"make_payload/" + std::to_string(size), 
+        time_op([&](uint64_t i)
+        {
+            make_payload(frame[i & 63], size);
+        }, 100000)});
+    }
+
+    // The test-pattern generator and checker
+    for (int size : {256, 8192})
+    {
+        results.push_back({string("fill_payload/prbs31/") + pattern_impl() + "/" + std::to_string(size), 
+        time_op([&](uint64_t i)
+        {
+            fill_payload(frame[i & 63], size, PATTERN_PRBS31, i);
+        }, 100000)});
+
+        // Time the usual case, a payload that's entirely correct
+        vector<uint8_t> good(size);
+        fill_payload(good.data(), size, PATTERN_PRBS31, 0);
+
+        results.push_back({string("check_payload/prbs31/") + pattern_impl() + "/" + std::to_string(size), 
+        time_op([&](uint64_t)
+        {
+            sink += check_payload(good.data(), size, PATTERN_PRBS31, 0).bit_errors;
+        }, 100000)});
+    }
+
+    return results;
+}
+//=============================================================================
+
+
+//=============================================================================
+// get_mtu() - Returns the MTU of a network interface, or 0 if unknown
+//=============================================================================
+static int get_mtu(const string& nic)
+{
+    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sd < 0) return 0;
+
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, nic.c_str(), IFNAMSIZ-1);
+    int rc = ioctl(sd, SIOCGIFMTU, &ifr);
+    close(sd);
+
+    return (rc < 0) ? 0 : ifr.ifr_mtu;
+}
+//=============================================================================
+
+
+//=============================================================================
+// percentile() - Returns the specified percentile of a sorted set of samples
+//=============================================================================
+static double percentile(const vector<uint64_t>& sorted, double pct)
+{
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(pct / 100.0 * (sorted.size() - 1));
+    return sorted[index];
+}
+//=============================================================================
+
+
+//=============================================================================
+// run_e2e() - Transmits UDP frames with a given payload size for the 
+//             configured number of seconds, and measures what arrives
+//
+// Each payload carries the time it was sent and a sequence number, so the
+// receiver can compute per-frame latency.  The latency includes the time
+// the RX ring takes to retire a block.
+//=============================================================================
+static e2e_result_t run_e2e(int payload)
+{
+    e2e_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.payload = payload;
+
+    const int frame_length = UDP_HEADER_SIZE + payload;
+
+    // Set up the receive side.  A short block timeout keeps latency low
+    CRawNIC rx;
+    rx.connect_nic(opt.rx_nic.c_str());
+    rx.enable_rx_ring(1 << 20, 64, 1);
+
+    std::atomic<bool>     tx_done(false);
+    std::atomic<uint64_t> tx_frames(0);
+    uint64_t              tx_ns = 0;
+
+    // The transmit side runs in its own thread
+    std::thread tx_thread([&]()
+    {
+        CRawNIC  tx;
+        CRawUDP  udp;
+        uint8_t  src_ip[] = {10, 99, 0, 1};
+        uint8_t  dst_ip[] = {10, 99, 0, 2};
+        static uint8_t frame[BATCH_SIZE][10000];
+        CRawNIC::frame_t batch[BATCH_SIZE];
+
+        tx.connect_nic(opt.tx_nic.c_str());
+        udp.set_ip_addrs(src_ip, dst_ip);
+        udp.set_udp_ports(BENCH_UDP_PORT, BENCH_UDP_PORT);
+
+        // Build a batch of frames
+        for (int i=0; i<BATCH_SIZE; ++i)
+        {
+            udp.write_header(frame[i], payload);
+            make_payload(frame[i] + UDP_HEADER_SIZE, payload);
+            batch[i] = {frame[i], (uint16_t)frame_length};
+        }
+
+        uint64_t seq = 0, start = now_ns(), end = start + opt.seconds * 1e9;
+
+        // Send batches until time runs out, stamping each frame with the
+        // time it was sent and its sequence number
+        while (now_ns() < end)
+        {
+            uint64_t t = now_ns();
+            for (int i=0; i<BATCH_SIZE; ++i)
+            {
+                uint64_t s = seq + i;
+                memcpy(frame[i] + UDP_HEADER_SIZE,     &t, 8);
+                memcpy(frame[i] + UDP_HEADER_SIZE + 8, &s, 8);
+            }
+
+            int sent = tx.send_batch(batch, BATCH_SIZE);
+            seq += sent;
+            tx_frames.store(seq, std::memory_order_relaxed);
+        }
+
+        tx_ns = now_ns() - start;
+        tx_done = true;
+    });
+
+    vector<uint64_t> latency;
+    latency.reserve(4000000);
+    uint64_t rx_frames = 0, rx_start = now_ns(), idle_since = 0;
+    CRawNIC::rx_frame_t frame[64];
+    const uint16_t port = htons(BENCH_UDP_PORT);
+
+    // Receive until the sender is done and the frames stop arriving
+    while (true)
+    {
+        int count = rx.receive_block(frame, 64, 10);
+        uint64_t now = now_ns();
+
+        for (int i=0; i<count; ++i)
+        {
+            const uint8_t* p = frame[i].data;
+
+            // Ignore anything that isn't one of our frames
+            if (frame[i].length < (uint32_t)frame_length) continue;
+            if (memcmp(p + 36, &port, 2) != 0) continue;
+
+            uint64_t sent_at;
+            memcpy(&sent_at, p + UDP_HEADER_SIZE, 8);
+            if (latency.size() < latency.capacity()) latency.push_back(now - sent_at);
+            ++rx_frames;
+        }
+
+        rx.release_block();
+
+        // Once the sender is finished, wait a short while for stragglers
+        if (count) idle_since = 0;
+        else if (tx_done)
+        {
+            if (idle_since == 0) idle_since = now;
+            else if (now - idle_since > 100000000) break;
+        }
+    }
+
+    tx_thread.join();
+    double rx_seconds = double(now_ns() - rx_start - 100000000) / 1e9;
+
+    // Compute the throughput
+    result.tx_frames = tx_frames;
+    result.rx_frames = rx_frames;
+    result.tx_fps    = tx_frames / (tx_ns / 1e9);
+    result.rx_fps    = rx_frames / rx_seconds;
+    result.rx_gbps   = result.rx_fps * frame_length * 8 / 1e9;
+
+    // Compute the latency percentiles
+    std::sort(latency.begin(), latency.end());
+    result.lat_p50  = percentile(latency, 50);
+    result.lat_p90  = percentile(latency, 90);
+    result.lat_p99  = percentile(latency, 99);
+    result.lat_p999 = percentile(latency, 99.9);
+    result.lat_max  = latency.empty() ? 0 : latency.back();
+
+    return result;
+}
+//=============================================================================
+
+
+//=============================================================================
+// run_reliable() - Sends a buffer with CRdmxReliableSender while dropping a
+//                  fraction of its frames, and checks that every byte of it
+//                  arrives anyway
+//=============================================================================
+static reliable_result_t run_reliable(int mtu)
+{
+    reliable_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.bytes = RELIABLE_SIZE;
+
+    // The largest payload that fits in an RDMX frame on this MTU
+    int max_payload = std::min(8192, mtu - (RDMX_HEADER_SIZE - 14));
+
+    // Fill the buffer we're going to send with something recognizable
+    vector<uint8_t> buffer(RELIABLE_SIZE);
+    fill_payload(buffer.data(), RELIABLE_SIZE, PATTERN_PRBS31, 1);
+
+    // Set up the receive side
+    CRawNIC rx;
+    rx.connect_nic(opt.rx_nic.c_str());
+    rx.enable_rx_ring(1 << 22, 32, 1);
+    CRdmxReceiver store;
+    store.map_region(RELIABLE_SIZE, false);
+    CRdmxReliableReceiver receiver(rx, store, RELIABLE_WINDOW);
+
+    // The sender needs an RX ring of its own, for the status frames
+    CRawNIC tx;
+    tx.connect_nic(opt.tx_nic.c_str());
+    tx.enable_rx_ring(1 << 20, 8, 1);
+
+    uint8_t  src_ip[] = {10, 99, 0, 1};
+    uint8_t  dst_ip[] = {10, 99, 0, 2};
+    CRawRDMX header;
+    header.set_ip_addrs(src_ip, dst_ip);
+    header.set_udp_ports(BENCH_UDP_PORT);
+    header.set_sequencing(true);
+
+    // The receiver runs in its own thread, and gives up if the transfer
+    // hasn't completed in a reasonable time
+    uint64_t start = now_ns(), deadline = start + 30000000000ULL;
+    std::thread rx_thread([&]()
+    {
+        while (!receiver.complete() && now_ns() < deadline) receiver.poll(1);
+
+        // Keep answering for a moment, in case our last status was lost
+        for (int i=0; i<20; ++i) receiver.poll(1);
+    });
+
+    CRdmxReliableSender sender(tx, header, RELIABLE_WINDOW);
+    sender.set_loss(opt.loss, 42);
+    sender.send(buffer.data(), RELIABLE_SIZE, 0, max_payload);
+    sender.finish(3000);
+    rx_thread.join();
+
+    result.seconds       = double(now_ns() - start) / 1e9;
+    result.frames_sent   = sender.frames_sent();
+    result.dropped       = sender.dropped();
+    result.retransmits   = sender.retransmits();
+    result.unrecoverable = sender.unrecoverable();
+    result.complete      = receiver.complete();
+    result.match         = memcmp(buffer.data(), store.base(), RELIABLE_SIZE) == 0;
+    result.passed        = result.complete && result.unrecoverable == 0 && result.match;
+    return result;
+}
+//=============================================================================
+
+
+//=============================================================================
+// write_json() - Writes the results as JSON
+//=============================================================================
+static void write_json(FILE* ofile, const vector<micro_result_t>& micro,
+                       const vector<e2e_result_t>& e2e, const string& e2e_skipped,
+                       const reliable_result_t* reliable)
+{
+    fprintf(ofile, "{\n");
+    fprintf(ofile, "  \"timestamp\": %lu,\n", (unsigned long)time(nullptr));
+    fprintf(ofile, "  \"micro\": [\n");
+    for (size_t i=0; i<micro.size(); ++i)
+    {
+        fprintf(ofile, "    {\"name\": \"%s\", \"ns_per_op\": %.3f}%s\n",
+                micro[i].name.c_str(), micro[i].ns_per_op,
+                (i + 1 < micro.size()) ? "," : "");
+    }
+    fprintf(ofile, "  ],\n");
+
+    fprintf(ofile, "  \"e2e\": {\n");
+    fprintf(ofile, "    \"tx_nic\": \"%s\",\n", opt.tx_nic.c_str());
+    fprintf(ofile, "    \"rx_nic\": \"%s\",\n", opt.rx_nic.c_str());
+    fprintf(ofile, "    \"seconds\": %.3f,\n", opt.seconds);
+    if (!e2e_skipped.empty())
+    {
+        fprintf(ofile, "    \"skipped\": \"%s\",\n", e2e_skipped.c_str());
+    }
+    fprintf(ofile, "    \"results\": [\n");
+    for (size_t i=0; i<e2e.size(); ++i)
+    {
+        const e2e_result_t& r = e2e[i];
+        fprintf(ofile, "      {\"payload\": %d, \"tx_frames\": %lu, \"rx_frames\": %lu, "
+                       "\"tx_fps\": %.0f, \"rx_fps\": %.0f, \"rx_gbps\": %.3f, "
+                       "\"latency_ns\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+                       "\"p99.9\": %.0f, \"max\": %.0f}}%s\n",
+                r.payload, (unsigned long)r.tx_frames, (unsigned long)r.rx_frames,
+                r.tx_fps, r.rx_fps, r.rx_gbps, r.lat_p50, r.lat_p90, r.lat_p99, 
+                r.lat_p999, r.lat_max, (i + 1 < e2e.size()) ? "," : "");
+    }
+    fprintf(ofile, "    ]\n");
+    fprintf(ofile, "  },\n");
+
+    fprintf(ofile, "  \"reliable\": {\n");
+    fprintf(ofile, "    \"loss\": %.3f", opt.loss);
+    if (reliable == nullptr)
+    {
+        fprintf(ofile, ",\n    \"skipped\": \"%s\"\n",
+                e2e_skipped.empty() ? "not run" : e2e_skipped.c_str());
+    }
+    else
+    {
+        const reliable_result_t& r = *reliable;
+        fprintf(ofile, ",\n    \"bytes\": %lu, \"seconds\": %.3f, \"frames_sent\": %lu, "
+                       "\"dropped\": %lu, \"retransmits\": %lu, \"unrecoverable\": %lu, "
+                       "\"complete\": %s, \"match\": %s, \"passed\": %s\n",
+                (unsigned long)r.bytes, r.seconds, (unsigned long)r.frames_sent,
+                (unsigned long)r.dropped, (unsigned long)r.retransmits,
+                (unsigned long)r.unrecoverable, r.complete ? "true" : "false",
+                r.match ? "true" : "false", r.passed ? "true" : "false");
+    }
+    fprintf(ofile, "  }\n");
+    fprintf(ofile, "}\n");
+}
+//=============================================================================
+
+
+//=============================================================================
+// parse_command_line() - Fills in "opt" from the command line
+//=============================================================================
+static void parse_command_line(int argc, char** argv)
+{
+    for (int i=1; i<argc; ++i)
+    {
+        string arg = argv[i];
+        bool   has_value = (i + 1 < argc);
+
+        if      (arg == "-nic"     && has_value) opt.tx_nic    = argv[++i];
+        else if (arg == "-rx"      && has_value) opt.rx_nic    = argv[++i];
+        else if (arg == "-seconds" && has_value) opt.seconds   = atof(argv[++i]);
+        else if (arg == "-loss"    && has_value) opt.loss      = atof(argv[++i]);
+        else if (arg == "-json"    && has_value) opt.json_file = argv[++i];
+        else if (arg == "-micro") opt.micro_only = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-nic <tx_nic>] [-rx <rx_nic>] [-seconds <n>] "
+                            "[-loss <fraction>] [-json <file>] [-micro]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // Unless told otherwise, we receive on the same NIC we transmit on
+    if (opt.rx_nic.empty()) opt.rx_nic = opt.tx_nic;
+
+    if (opt.loss < 0 || opt.loss >= 1)
+    {
+        fprintf(stderr, "-loss must be at least 0 and less than 1\n");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// main() - Execution begins here
+//=============================================================================
+int main(int argc, char** argv)
+{
+    vector<micro_result_t> micro;
+    vector<e2e_result_t>   e2e;
+    string                 e2e_skipped;
+    reliable_result_t      reliable;
+
+    parse_command_line(argc, argv);
+
+    // Run the microbenchmarks
+    micro = run_micro();
+
+    // Figure out whether we can run the end-to-end benchmarks
+    int mtu = std::min(get_mtu(opt.tx_nic), get_mtu(opt.rx_nic));
+    if (opt.micro_only)
+        e2e_skipped = "disabled on the command line";
+    else if (mtu == 0)
+        e2e_skipped = "unknown network interface";
+    else if (geteuid() != 0)
+    {
+        // Without CAP_NET_RAW, we can't open a packet socket
+        int sd = socket(AF_PACKET, SOCK_RAW, 0);
+        if (sd < 0) e2e_skipped = "no permission to open a packet socket";
+        else close(sd);
+    }
+
+    // Run the end-to-end benchmarks, sweeping the payload size
+    if (e2e_skipped.empty())
+    {
+        for (int payload : {64, 128, 256, 512, 1024, 1472, 4096, 8192, 8972})
+        {
+            if (payload + 28 > mtu) continue;
+            fprintf(stderr, "e2e: payload %d\n", payload);
+            e2e.push_back(run_e2e(payload));
+        }
+
+        // Then make sure a lossy reliable transfer still gets through intact
+        fprintf(stderr, "e2e: reliable transfer, %.1f%% loss\n", opt.loss * 100);
+        reliable = run_reliable(mtu);
+        if (!reliable.passed)
+        {
+            fprintf(stderr, "e2e: reliable transfer FAILED (complete=%d, unrecoverable=%lu, "
+                            "match=%d)\n", reliable.complete,
+                            (unsigned long)reliable.unrecoverable, reliable.match);
+        }
+    }
+
+    // Write out the results
+    FILE* ofile = stdout;
+    if (!opt.json_file.empty()) ofile = fopen(opt.json_file.c_str(), "w");
+    if (ofile == nullptr)
+    {
+        perror(opt.json_file.c_str());
+        exit(1);
+    }
+    write_json(ofile, micro, e2e, e2e_skipped, e2e_skipped.empty() ? &reliable : nullptr);
+    if (ofile != stdout) fclose(ofile);
+
+    // A reliable transfer that didn't get through is a failure
+    return (e2e_skipped.empty() && !reliable.passed) ? 1 : 0;
+}
+//=============================================================================
@@ -0,0 +1,197 @@
+//=============================================================================
+// checksum.cpp - Fast one's-complement summing for Internet checksums
+//
+// Author: D. Wolf
+//
+// The one's-complement sum has two handy properties that we lean on here:
+//
+// (1) It doesn't care about byte order.  If we sum 16-bit words in the CPU's
+//     native byte order, the result is the byte-swapped version of the sum
+//     of big-endian words, which means it can be stored straight back into
+//     the packet.
+//
+// (2) Summing 32-bit words into a wide accumulator and folding at the end
+//     gives the same answer as summing 16-bit words one at a time.
+//=============================================================================
+#include <cstring>
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+//=============================================================================
+// sum_tail() - Sums the final 0 to 3 bytes of a buffer, padding with zeros
+//=============================================================================
+static inline uint64_t sum_tail(const uint8_t* p, size_t length)
+{
+    uint32_t word = 0;
+    memcpy(&word, p, length);
+    return word;
+}
+//=============================================================================
+
+
+//=============================================================================
+// sum_scalar() - Plain C++ version: adds 32-bit words into a 64-bit total
+//=============================================================================
+static uint64_t sum_scalar(const uint8_t* p, size_t length)
+{
+    uint64_t sum = 0;
+    uint32_t word;
+
+    // Four 32-bit words at a time, so the loop overhead stays low
+    while (length >= 16)
+    {
+        uint32_t w[4];
+        memcpy(w, p, 16);
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        length -= 16;
+    }
+
+    // Then one 32-bit word at a time
+    while (length >= 4)
+    {
+        memcpy(&word, p, 4);
+        sum += word;
+        p += 4;
+        length -= 4;
+    }
+
+    // And then whatever is left over
+    return sum + sum_tail(p, length);
+}
+//=============================================================================
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+//=============================================================================
+// sum_sse2() - SSE2 version: widens 32-bit words into 64-bit lanes
+//=============================================================================
+__attribute__((target("sse2")))
+static uint64_t sum_sse2(const uint8_t* p, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    // 16 bytes at a time, each 32-bit word zero-extended to 64 bits
+    while (length >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        p += 16;
+        length -= 16;
+    }
+
+    // Add the lanes together
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i*)lane, _mm_add_epi64(acc0, acc1));
+    uint64_t sum = ones_fold(lane[0]) + (uint64_t)ones_fold(lane[1]);
+
+    // And sum whatever is left over
+    return sum + sum_scalar(p, length);
+}
+//=============================================================================
+
+
+//=============================================================================
+// sum_avx2() - AVX2 version: widens 32-bit words into 64-bit lanes, 64 bytes
+//              per loop iteration
+//=============================================================================
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(const uint8_t* p, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+
+    // 64 bytes at a time, each 32-bit word zero-extended to 64 bits
+    while (length >= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(p +  0));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_unpacklo_epi32(v1, zero));
+        acc3 = _mm256_add_epi64(acc3, _mm256_unpackhi_epi32(v1, zero));
+        p += 64;
+        length -= 64;
+    }
+
+    // Add the lanes together
+    __m256i acc = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1),
+                                   _mm256_add_epi64(acc2, acc3));
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*)lane, acc);
+
+    // Leaving the upper halves of the YMM registers dirty would make every
+    // later SSE instruction (including those in memcpy) pay a penalty
+    _mm256_zeroupper();
+    uint64_t sum = (uint64_t)ones_fold(lane[0]) + ones_fold(lane[1])
+                 + ones_fold(lane[2]) + ones_fold(lane[3]);
+
+    // And sum whatever is left over
+    return sum + sum_sse2(p, length);
+}
+//=============================================================================
+
+#endif
+
+
+//=============================================================================
+// The implementation that ones_sum() uses, chosen the first time it's needed
+//=============================================================================
+typedef uint64_t (*sum_fn_t)(const uint8_t*, size_t);
+
+struct sum_impl_t
+{
+    sum_fn_t    fn;
+    const char* name;
+};
+
+static sum_impl_t choose_impl()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {sum_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {sum_sse2, "sse2"};
+#endif
+    return {sum_scalar, "scalar"};
+}
+
+static const sum_impl_t& impl()
+{
+    static const sum_impl_t chosen = choose_impl();
+    return chosen;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ones_sum() - Computes the one's-complement sum of a buffer
+//=============================================================================
+uint16_t ones_sum(const void* data, size_t length, uint32_t initial)
+{
+    // Short buffers (such as packet headers) aren't worth vectorizing
+    sum_fn_t fn = (length < 64) ? sum_scalar : impl().fn;
+    
+    return ones_fold(fn((const uint8_t*)data, length) + initial);
+}
+//=============================================================================
+
+
+//=============================================================================
+// ones_sum_impl() - Returns the name of the implementation in use
+//=============================================================================
+const char* ones_sum_impl()
+{
+    return impl().name;
+}
+//=============================================================================
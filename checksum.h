@@ -0,0 +1,31 @@
+//=============================================================================
+// checksum.h - Fast one's-complement summing for Internet checksums
+//
+// Author: D. Wolf
+//
+// The sums computed here are in "memory order": the 16-bit result can be
+// stored directly into a packet header without byte-swapping it.  The best
+// implementation for this CPU (AVX2, SSE2, or plain C++) is chosen at run
+// time.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Returns the 16-bit one's-complement sum of "length" bytes at "data", with
+// "initial" (a previous sum, also in memory order) folded in.  "data" must
+// begin at an even offset from the start of the checksummed region
+uint16_t    ones_sum(const void* data, size_t length, uint32_t initial = 0);
+
+// Folds a 64-bit accumulation of one's-complement sums into 16 bits
+inline uint16_t ones_fold(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+// Returns the name of the ones_sum() implementation in use
+const char* ones_sum_impl();
@@ -0,0 +1,306 @@
+//=============================================================================
+// flow_table.h - Spreads transmitted frames across several flows
+//
+// Author: D. Wolf
+//
+// A single CRawUDP or CRawRDMX template has one source IP and one source
+// port, so every frame we send belongs to the same flow.  A receiving NIC's
+// RSS hashes each frame's addresses and ports to pick a receive queue, so
+// all of that traffic lands on one queue and is handled by one core.
+//
+// CFlowTable keeps a table of N header templates that differ only in their
+// source port (or source IP), each with its checksum partials already worked
+// out, and assigns every frame it sends to one of them:
+//
+//   ROUND_ROBIN  - each frame goes to the next flow in turn
+//
+//   HASH         - a hash of a key picks the flow, so frames with the same
+//                  key always take the same flow.  The key is the RDMX
+//                  target address, or whatever the caller passes
+//
+//   TARGET_RANGE - each "range_size" bytes of target address space goes to
+//                  the next flow, so that each receive queue (and core) ends
+//                  up writing its own part of the target region
+//
+// Per-flow counters show how evenly the frames were spread.
+//
+// "RAW" is the header class to use: CRawUDP or CRawRDMX.  Every flow is a
+// copy of the template it was made from, so with RDMX sequencing turned on,
+// each flow numbers its own frames and the receiver needs one CSeqTracker
+// per flow.
+//
+// To use this class:
+//
+// (1) set up a CRawUDP (or CRawRDMX) header template as usual
+//
+// (2) declare an instance of "CFlowTable<CRawUDP>" (or <CRawRDMX>) that
+//     refers to a connected CRawNIC
+//
+// (3) call "make_port_flows()" or "make_ip_flows()" to build the flows from
+//     your template, and "set_assignment()" to choose how frames are spread
+//
+// (4) call "send()" for each buffer, or "write_header()" to build frames
+//     yourself
+//
+// (5) call "report()", or look at the per-flow counters
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include "raw_nic.h"
+#include "raw_udp.h"
+#include "raw_rdmx.h"
+
+template <class RAW> class CFlowTable
+{
+public:
+
+    // The frame builder of the header class
+    typedef typename RAW::builder_t builder_t;
+
+    // True if the frames carry an RDMX header
+    static constexpr bool is_rdmx = builder_t::template has<rdmx_layer_t>;
+
+    // The ways frames can be assigned to flows
+    enum assign_t
+    {
+        ROUND_ROBIN,
+        HASH,
+        TARGET_RANGE
+    };
+
+    // Frames are sent through "nic", "batch_size" at a time
+    CFlowTable(CRawNIC& nic, int batch_size = 64)
+        : nic_(nic), batch_size_(batch_size), assign_(ROUND_ROBIN), range_size_(1 << 20),
+          next_flow_(0), header_(batch_size), iov_(2 * batch_size) {}
+
+    // Adds a flow, and returns its index
+    int     add_flow(const RAW& flow)
+    {
+        flow_.push_back(flow);
+        frames_.push_back(0);
+        bytes_.push_back(0);
+        return (int)flow_.size() - 1;
+    }
+
+    // Replaces the flows with "count" copies of "base", the Nth of which has
+    // UDP source port "first_port" + N
+    void    make_port_flows(const RAW& base, int count, uint16_t first_port)
+    {
+        clear();
+        for (int i=0; i<count; ++i)
+        {
+            RAW& flow = flow_[add_flow(base)];
+            flow.builder().template hdr<udp_layer_t>().src_port = htons(first_port + i);
+        }
+    }
+
+    // Replaces the flows with "count" copies of "base", the Nth of which has
+    // source IP address "first_ip" + N
+    void    make_ip_flows(const RAW& base, int count, const void* first_ip)
+    {
+        clear();
+        for (int i=0; i<count; ++i)
+        {
+            RAW& flow = flow_[add_flow(base)];
+            ipv4_hdr_t& ipv4 = flow.builder().template hdr<ipv4_layer_t>();
+            uint32_t ip;
+            memcpy(&ip, first_ip, 4);
+            ip = htonl(ntohl(ip) + i);
+            memcpy(ipv4.src_ip, &ip, 4);
+
+            // The source IP is part of the IPv4 and UDP checksums
+            flow.builder().refresh();
+        }
+    }
+
+    // Removes every flow
+    void    clear() {flow_.clear(); frames_.clear(); bytes_.clear(); next_flow_ = 0;}
+
+    // Returns the number of flows
+    int     flows() const {return (int)flow_.size();}
+
+    // Gives access to the template of a single flow
+    RAW&    flow(int index) {return flow_[index];}
+
+    // Chooses how frames are assigned to flows.  "range_size" is the number
+    // of bytes of target address space per flow in TARGET_RANGE mode
+    void    set_assignment(assign_t assign, uint64_t range_size = 1 << 20)
+    {
+        assign_     = assign;
+        range_size_ = range_size ? range_size : 1;
+    }
+
+    // Turns UDP checksums on or off for every flow
+    void    set_udp_checksum(bool enable)
+    {
+        for (RAW& flow : flow_) flow.set_udp_checksum(enable);
+    }
+
+    // Returns the flow that the next frame with this key (or target address)
+    // is assigned to
+    int     assign(uint64_t key)
+    {
+        const uint32_t count = flow_.size();
+
+        switch (assign_)
+        {
+            case HASH:
+                // Fibonacci hashing spreads even sequential keys evenly
+                return ((key * 0x9E3779B97F4A7C15ULL) >> 32) % count;
+
+            case TARGET_RANGE:
+                return (key / range_size_) % count;
+
+            default:
+                if (next_flow_ >= count) next_flow_ = 0;
+                return next_flow_++;
+        }
+    }
+
+    // Writes the header of a frame into "where", using the template of the
+    // flow the frame is assigned to, and returns that flow.  For UDP frames,
+    // "target_addr" isn't sent anywhere; it's just the key used to assign
+    // the frame.  If UDP checksums are on, the payload must already be at
+    // "payload" (or directly after the header if that is nullptr)
+    int     write_header(void* where, uint16_t payload_length, uint64_t target_addr = 0,
+                         const void* payload = nullptr)
+    {
+        int index = assign(target_addr);
+        RAW& flow = flow_[index];
+
+        if constexpr (is_rdmx)
+            flow.write_header(where, payload_length, target_addr, payload);
+        else
+            flow.write_header(where, payload_length, payload);
+
+        ++frames_[index];
+        bytes_[index] += payload_length;
+        return index;
+    }
+
+    // Splits "length" bytes from "buffer" into frames of at most
+    // "max_payload" bytes, and sends each one on the flow it's assigned to.
+    // The target address (the key, for UDP) steps along with the buffer.
+    // Payloads are sent straight from "buffer", and a full transmit queue is
+    // waited out.  Returns the number of payload bytes handed to the kernel,
+    // which is less than "length" only on a hard error, if the queue stays
+    // full for a second, or if "max_payload" is 0
+    uint64_t send(const void* buffer, uint64_t length, uint64_t target_addr = 0,
+                  uint16_t max_payload = 1472)
+    {
+        const uint8_t* payload = (const uint8_t*)buffer;
+        uint64_t       bytes_sent = 0;
+
+        // With no room for a payload, we'd never get anywhere
+        if (max_payload == 0) return 0;
+
+        while (bytes_sent < length)
+        {
+            uint64_t batch_bytes = 0;
+            int      count = 0;
+
+            // Build a batch of frames, each with its own flow's header
+            while (count < batch_size_ && bytes_sent + batch_bytes < length)
+            {
+                uint64_t offset = bytes_sent + batch_bytes;
+
+                uint16_t payload_length = max_payload;
+                if (length - offset < max_payload) payload_length = length - offset;
+
+                uint8_t* header = header_[count].bytes;
+                write_header(header, payload_length, target_addr + offset, payload + offset);
+
+                iov_[2*count    ].iov_base = header;
+                iov_[2*count    ].iov_len  = RAW::HEADER_SIZE;
+                iov_[2*count + 1].iov_base = (void*)(payload + offset);
+                iov_[2*count + 1].iov_len  = payload_length;
+
+                batch_bytes += payload_length;
+                ++count;
+            }
+
+            // Hand the batch to the kernel, waiting out a full queue.  If it
+            // still won't take all of it, tell the caller how far we got
+            int sent = nic_.send_all(iov_.data(), 2, count);
+            if (sent < count)
+            {
+                for (int i=0; i<sent; ++i) bytes_sent += iov_[2*i + 1].iov_len;
+                return bytes_sent;
+            }
+
+            bytes_sent += batch_bytes;
+        }
+
+        return bytes_sent;
+    }
+
+    // The number of frames, and of payload bytes, assigned to a flow
+    uint64_t frames(int index) const {return frames_[index];}
+    uint64_t bytes(int index)  const {return bytes_[index];}
+
+    // Resets the per-flow counters
+    void    reset_counters()
+    {
+        for (uint64_t& n : frames_) n = 0;
+        for (uint64_t& n : bytes_)  n = 0;
+    }
+
+    // Prints each flow's source address and counters, and how far the
+    // busiest flow is above the average
+    void    report(FILE* ofile = stdout)
+    {
+        uint64_t total = 0, busiest = 0;
+        for (uint64_t n : frames_)
+        {
+            total += n;
+            if (n > busiest) busiest = n;
+        }
+
+        for (int i=0; i<flows(); ++i)
+        {
+            const uint8_t* ip   = flow_[i].builder().template hdr<ipv4_layer_t>().src_ip;
+            uint16_t       port = ntohs(flow_[i].builder().template hdr<udp_layer_t>().src_port);
+            fprintf(ofile, "flow %3d  %u.%u.%u.%u:%-5u  frames %12lu  bytes %14lu  %5.1f%%\n",
+                    i, ip[0], ip[1], ip[2], ip[3], port, frames_[i], bytes_[i],
+                    total ? 100.0 * frames_[i] / total : 0.0);
+        }
+
+        if (total)
+        {
+            double mean = (double)total / flows();
+            fprintf(ofile, "busiest flow is %.2fx the average\n", busiest / mean);
+        }
+    }
+
+protected:
+
+    // A header that's been stamped for one frame of a batch
+    struct alignas(64) header_t
+    {
+        uint8_t bytes[RAW::HEADER_SIZE];
+    };
+
+    // The NIC we send through, and the number of frames per batch
+    CRawNIC&                nic_;
+    int                     batch_size_;
+
+    // How frames are assigned to flows, the range size for TARGET_RANGE, and
+    // the next flow for ROUND_ROBIN
+    assign_t                assign_;
+    uint64_t                range_size_;
+    uint32_t                next_flow_;
+
+    // The per-flow templates and counters
+    std::vector<RAW>        flow_;
+    std::vector<uint64_t>   frames_;
+    std::vector<uint64_t>   bytes_;
+
+    // The headers of a batch, and the scatter-gather list for it
+    std::vector<header_t>   header_;
+    std::vector<iovec>      iov_;
+};
@@ -0,0 +1,509 @@
+//=============================================================================
+// frame_builder.h - Compile-time builder for raw Ethernet frame headers
+//
+// Author: D. Wolf
+//
+// A frame header is described as a stack of layers, outermost first:
+//
+//     CFrameBuilder<eth_layer_t, ipv4_layer_t, udp_layer_t>
+//     CFrameBuilder<eth_layer_t, vlan_layer_t, ipv4_layer_t, udp_layer_t, rdmx_layer_t>
+//
+// The size and offset of every layer is worked out at compile time, and
+// "stamp()" is inline, so stamping a header into a frame compiles down to a
+// fixed-size copy of the template plus a handful of stores.
+//
+// To add a new kind of layer, declare a struct that derives from layer_t<>
+// with the layer's packed header struct, and give it whichever of these it
+// needs (the defaults in layer_t<> do nothing):
+//
+//   ethertype   - the EtherType to use when this layer follows Ethernet/VLAN
+//   ip_protocol - the IP protocol number to use when this layer follows IPv4
+//   init<Next>  - fills in the constant fields of the template
+//   stamp       - fills in the per-frame fields (lengths, checksums)
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <arpa/inet.h>
+#include "checksum.h"
+
+#pragma pack(push, 1)
+
+struct eth_hdr_t
+{
+    uint8_t     dst_mac[6];
+    uint8_t     src_mac[6];
+    uint16_t    frame_type;
+};
+
+struct vlan_hdr_t
+{
+    uint16_t    tci;
+    uint16_t    frame_type;
+};
+
+struct ipv4_hdr_t
+{
+    uint8_t     version;
+    uint8_t     dsf;
+    uint16_t    length;
+    uint16_t    id;
+    uint16_t    flags;
+    uint8_t     time_to_live;
+    uint8_t     protocol;
+    uint16_t    checksum;
+    uint8_t     src_ip[4];
+    uint8_t     dst_ip[4];
+};
+
+struct udp_hdr_t
+{
+    uint16_t    src_port;
+    uint16_t    dst_port;
+    uint16_t    length;
+    uint16_t    checksum;
+};
+
+struct rdmx_hdr_t
+{
+    uint16_t    magic;
+    uint64_t    target_addr;
+
+    // These 12 bytes were reserved, and stay zero unless the sender turns
+    // on sequencing (see CRawRDMX::set_sequencing()).  "tx_ns" is the
+    // CLOCK_REALTIME transmit time, or zero if it wasn't stamped
+    uint32_t    seq;
+    uint64_t    tx_ns;
+};
+
+// The virtio_net_hdr that precedes every frame sent on a socket that has
+// PACKET_VNET_HDR turned on.  <linux/virtio_net.h> can't be included from
+// C++ (it has a field named "class"), so we declare our own
+struct vnet_hdr_t
+{
+    uint8_t     flags;
+    uint8_t     gso_type;
+    uint16_t    hdr_len;
+    uint16_t    gso_size;
+    uint16_t    csum_start;
+    uint16_t    csum_offset;
+};
+
+#pragma pack(pop)
+
+// Values for vnet_hdr_t "flags" and "gso_type"
+enum
+{
+    VNET_F_NEEDS_CSUM = 1,
+    VNET_GSO_NONE     = 0,
+    VNET_GSO_UDP_L4   = 5
+};
+
+static_assert(sizeof(eth_hdr_t ) == 14, "eth_hdr_t must be 14 bytes" );
+static_assert(sizeof(vlan_hdr_t) ==  4, "vlan_hdr_t must be 4 bytes" );
+static_assert(sizeof(ipv4_hdr_t) == 20, "ipv4_hdr_t must be 20 bytes");
+static_assert(sizeof(udp_hdr_t ) ==  8, "udp_hdr_t must be 8 bytes"  );
+static_assert(sizeof(rdmx_hdr_t) == 22, "rdmx_hdr_t must be 22 bytes");
+static_assert(sizeof(vnet_hdr_t) == 10, "vnet_hdr_t must be 10 bytes");
+
+
+//=============================================================================
+// This is a 64-bit version of htonl
+//=============================================================================
+#ifndef htonll
+#define htonll(x) ((1==htonl(1)) ? (x) : ((uint64_t)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
+#endif
+//=============================================================================
+
+
+//=============================================================================
+// The per-template state that layers may need when a frame is stamped.  The
+// partial sums are refreshed whenever the template changes
+//=============================================================================
+struct frame_state_t
+{
+    // One's-complement sum of the IPv4 header minus its length and checksum,
+    // in host byte order
+    uint32_t    ip_partial;
+
+    // One's-complement sum of the UDP pseudo-header's addresses and protocol,
+    // in memory byte order
+    uint32_t    pseudo_partial;
+
+    // True if UDP checksums should be computed
+    bool        udp_checksum;
+};
+//=============================================================================
+
+
+//=============================================================================
+// ipv4_partial_sum() - Computes the one's-complement sum of every 16-bit word
+//                      of an IPv4 header except the length and the checksum
+//
+// Those are the only two fields that change from one frame to the next, so
+// this sum only needs to be computed when the header template changes
+//=============================================================================
+inline uint32_t ipv4_partial_sum(const ipv4_hdr_t& header)
+{
+    uint32_t sum = 0;
+
+    // We're going to treat the IPv4 header as a sequence of ten
+    // 16-bit big-endian integers
+    const uint16_t* entry = (const uint16_t*)&header;
+
+    // A standard IPv4 header is ten 16-bit integers
+    for (int i=0; i<10; ++i)
+    {
+        // Skip the length field (word 1) and the checksum field (word 5)
+        if (i != 1 && i != 5) sum += ntohs(entry[i]);
+    }
+
+    // Fold the carries back into the lower 16-bits
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ipv4_checksum() - Computes the IPv4 checksum of a header whose partial sum
+//                   is already known, by folding in the packet length
+//=============================================================================
+inline uint16_t ipv4_checksum(uint32_t partial_sum, uint16_t ip4_length)
+{
+    uint32_t checksum = partial_sum + ip4_length;
+
+    // Add the upper 16-bits and the lower 16-bits together (twice, since
+    // the first addition can itself produce a carry)
+    checksum = (checksum & 0xFFFF) + (checksum >> 16);
+    checksum = (checksum & 0xFFFF) + (checksum >> 16);
+
+    // An IPv4 checksum is the 1's complement of the above calculation
+    return ~checksum;
+}
+//=============================================================================
+
+
+//=============================================================================
+// pseudo_partial_sum() - Computes the one's-complement sum of the parts of
+//                        the UDP pseudo-header that don't change from one
+//                        frame to the next: the IP addresses and protocol
+//
+// Unlike ipv4_partial_sum(), this sum is in memory byte order
+//=============================================================================
+inline uint32_t pseudo_partial_sum(const ipv4_hdr_t& header)
+{
+    uint32_t sum = ones_sum(header.src_ip, 8);
+    return ones_fold(sum + htons(header.protocol));
+}
+//=============================================================================
+
+
+//=============================================================================
+// layer_t - The base of every layer.  It supplies do-nothing defaults
+//=============================================================================
+template <class HDR> struct layer_t
+{
+    typedef HDR hdr_t;
+    static constexpr size_t size = sizeof(HDR);
+
+    template <class Next> static void init(hdr_t&) {}
+    static void stamp(hdr_t&, uint16_t, const frame_state_t&) {}
+};
+//=============================================================================
+
+
+//=============================================================================
+// eth_layer_t - An Ethernet II header
+//=============================================================================
+struct eth_layer_t : layer_t<eth_hdr_t>
+{
+    template <class Next> static void init(hdr_t& hdr)
+    {
+        // Use some reasonable default MAC addresses
+        memset(hdr.src_mac, 0x00, 6);
+        memset(hdr.dst_mac, 0xFF, 6);
+
+        // The frame type is determined by the layer that follows
+        hdr.frame_type = htons(Next::ethertype);
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// vlan_layer_t - An 802.1Q VLAN tag.  Set "tci" in the template to choose the
+//                VLAN ID and priority
+//=============================================================================
+struct vlan_layer_t : layer_t<vlan_hdr_t>
+{
+    static constexpr uint16_t ethertype = 0x8100;
+
+    template <class Next> static void init(hdr_t& hdr)
+    {
+        hdr.tci        = 0;
+        hdr.frame_type = htons(Next::ethertype);
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// ipv4_layer_t - A standard 20-byte IPv4 header
+//=============================================================================
+struct ipv4_layer_t : layer_t<ipv4_hdr_t>
+{
+    static constexpr uint16_t ethertype = 0x0800;
+
+    template <class Next> static void init(hdr_t& hdr)
+    {
+        hdr.version      = 0x45;            // 0x45 = Standard IPv4
+        hdr.dsf          = 0;               // Unused
+        hdr.id           = htons(0xDEAD);   // Unused
+        hdr.flags        = htons(0x4000);   // Flags = "Don't fragment this packet"
+        hdr.time_to_live = 0x40;            // This packet should live for 64 hops
+        hdr.protocol     = Next::ip_protocol;
+    }
+
+    // Stores the length of the IPv4 packet and its checksum
+    static void stamp(hdr_t& hdr, uint16_t length, const frame_state_t& state)
+    {
+        hdr.length   = htons(length);
+        hdr.checksum = htons(ipv4_checksum(state.ip_partial, length));
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// udp_layer_t - A UDP header
+//=============================================================================
+struct udp_layer_t : layer_t<udp_hdr_t>
+{
+    static constexpr uint8_t ip_protocol = 0x11;
+
+    // Stores the length of the UDP datagram.  The checksum (if any) can only
+    // be computed once every layer has been stamped, so the builder does it
+    static void stamp(hdr_t& hdr, uint16_t length, const frame_state_t&)
+    {
+        hdr.length = htons(length);
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// rdmx_layer_t - An RDMX header.  The target address is stored per-frame by
+//                the caller
+//=============================================================================
+struct rdmx_layer_t : layer_t<rdmx_hdr_t>
+{
+    template <class Next> static void init(hdr_t& hdr)
+    {
+        // Magic number that identifies an RDMX packet
+        hdr.magic = htons(0x0122);
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// Compile-time helpers for walking a list of layers
+//=============================================================================
+namespace frame_detail
+{
+    // The offset of layer T within the list L, Ls...
+    template <class T, class L, class... Ls> constexpr size_t offset_of()
+    {
+        if constexpr (std::is_same<T, L>::value) return 0;
+        else return L::size + offset_of<T, Ls...>();
+    }
+
+    // True if T is one of Ls...
+    template <class T, class... Ls> constexpr bool contains()
+    {
+        return (std::is_same<T, Ls>::value || ...);
+    }
+
+    // Calls init<Next>() for every layer, where Next is the layer after it
+    template <class L, class... Ls> inline void init_layers(uint8_t* hdr)
+    {
+        if constexpr (sizeof...(Ls) == 0)
+            L::template init<void>(*(typename L::hdr_t*)hdr);
+        else
+        {
+            typedef typename std::tuple_element<0, std::tuple<Ls...>>::type next_t;
+            L::template init<next_t>(*(typename L::hdr_t*)hdr);
+            init_layers<Ls...>(hdr + L::size);
+        }
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// CFrameBuilder - Builds frame headers made of the specified layers
+//=============================================================================
+template <class... Layers> class CFrameBuilder
+{
+public:
+
+    // The total size of the frame header
+    static constexpr size_t header_size = (Layers::size + ...);
+
+    // The offset of layer L within the frame header
+    template <class L> static constexpr size_t offset = frame_detail::offset_of<L, Layers...>();
+
+    // True if L is one of our layers
+    template <class L> static constexpr bool has = frame_detail::contains<L, Layers...>();
+
+    // The constructor fills in the template's constant fields
+    CFrameBuilder()
+    {
+        memset(template_, 0, sizeof(template_));
+        frame_detail::init_layers<Layers...>(template_);
+        state_.udp_checksum = false;
+        refresh();
+    }
+
+    // Returns the header of layer L within the template.  Call "refresh()"
+    // after changing any IPv4 field
+    template <class L> typename L::hdr_t& hdr()
+    {
+        static_assert(has<L>, "This layer is not part of the frame");
+        return *(typename L::hdr_t*)(template_ + offset<L>);
+    }
+
+    // Returns the header of layer L within a frame we've stamped
+    template <class L> static typename L::hdr_t& hdr(void* frame)
+    {
+        static_assert(has<L>, "This layer is not part of the frame");
+        return *(typename L::hdr_t*)((uint8_t*)frame + offset<L>);
+    }
+
+    // Recomputes the cached partial checksums of the template
+    void refresh()
+    {
+        if constexpr (has<ipv4_layer_t>)
+        {
+            state_.ip_partial     = ipv4_partial_sum(hdr<ipv4_layer_t>());
+            state_.pseudo_partial = pseudo_partial_sum(hdr<ipv4_layer_t>());
+        }
+    }
+
+    // Turns UDP checksum generation on or off
+    void set_udp_checksum(bool enable) {state_.udp_checksum = enable;}
+
+    // Writes a complete frame header for a payload of "payload_length" bytes
+    // into "where".  "before_checksum" is called with the header before the
+    // UDP checksum is computed, so that per-frame fields (such as the RDMX
+    // target address) can be filled in.  If UDP checksums are on, the payload
+    // must already be at "payload" (or directly after the header if nullptr)
+    template <class F> void stamp(void* where, uint16_t payload_length,
+                                  const void* payload, F&& before_checksum) const
+    {
+        uint8_t* frame = (uint8_t*)where;
+
+        // Copy the template and let every layer fill in its fields
+        stamp_layers(frame, payload_length);
+
+        // Fill in whatever else the caller needs to
+        before_checksum(frame);
+
+        // If UDP checksums are turned on, compute one over the pseudo-header,
+        // every header from UDP onward, and the payload
+        if constexpr (has<udp_layer_t>)
+        {
+            if (state_.udp_checksum) udp_checksum(frame, payload_length, payload);
+        }
+    }
+
+    // The same as above, for frames that have no extra per-frame fields
+    void stamp(void* where, uint16_t payload_length, const void* payload = nullptr) const
+    {
+        stamp(where, payload_length, payload, [](uint8_t*){});
+    }
+
+    // The same as stamp(), for a payload whose one's-complement sum has
+    // already been computed with ones_sum().  A payload that's sent to many
+    // destinations then only needs to be summed once
+    template <class F> void stamp_summed(void* where, uint16_t payload_length,
+                                         uint16_t payload_sum, F&& before_checksum) const
+    {
+        uint8_t* frame = (uint8_t*)where;
+        stamp_layers(frame, payload_length);
+        before_checksum(frame);
+
+        if constexpr (has<udp_layer_t>)
+        {
+            if (state_.udp_checksum) finish_udp_checksum(frame, payload_sum);
+        }
+    }
+
+    // Writes a frame header whose UDP checksum is left for the NIC (or the
+    // kernel) to finish.  The checksum field is seeded with the sum of the
+    // pseudo-header, which is what checksum offload expects to find there
+    template <class F> void stamp_partial(void* where, uint16_t payload_length,
+                                          F&& before_checksum) const
+    {
+        static_assert(has<udp_layer_t>, "Checksum offload requires a UDP layer");
+
+        uint8_t* frame = (uint8_t*)where;
+        stamp_layers(frame, payload_length);
+        before_checksum(frame);
+
+        udp_hdr_t& udp = hdr<udp_layer_t>(frame);
+        udp.checksum = ones_fold(state_.pseudo_partial + udp.length);
+    }
+
+    // The same as above, for frames that have no extra per-frame fields
+    void stamp_partial(void* where, uint16_t payload_length) const
+    {
+        stamp_partial(where, payload_length, [](uint8_t*){});
+    }
+
+protected:
+
+    // Copies the template into "frame", then lets every layer fill in its
+    // lengths and checksums
+    void stamp_layers(uint8_t* frame, uint16_t payload_length) const
+    {
+        memcpy(frame, template_, header_size);
+        (Layers::stamp(*(typename Layers::hdr_t*)(frame + offset<Layers>),
+                       header_size - offset<Layers> + payload_length, state_), ...);
+    }
+
+    // Computes the UDP checksum of a stamped frame
+    void udp_checksum(uint8_t* frame, uint16_t payload_length, const void* payload) const
+    {
+        if (payload == nullptr) payload = frame + header_size;
+        finish_udp_checksum(frame, ones_sum(payload, payload_length));
+    }
+
+    // Computes the UDP checksum of a stamped frame from the sum of its payload.
+    // Every header from UDP onward is an even number of bytes long, so the
+    // payload's sum can simply be added in
+    void finish_udp_checksum(uint8_t* frame, uint16_t payload_sum) const
+    {
+        const size_t udp_offset = offset<udp_layer_t>;
+        udp_hdr_t&   udp = hdr<udp_layer_t>(frame);
+
+        static_assert((header_size - udp_offset) % 2 == 0, "Odd-length UDP headers");
+        uint16_t checksum = ~ones_sum(&udp, header_size - udp_offset,
+                                      state_.pseudo_partial + udp.length + payload_sum);
+
+        // A computed checksum of zero is transmitted as all ones
+        udp.checksum = checksum ? checksum : 0xFFFF;
+    }
+
+    // The frame header template
+    alignas(64) uint8_t template_[header_size];
+
+    // Partial checksums of the template, and other per-template state
+    frame_state_t state_;
+};
+//=============================================================================
@@ -0,0 +1,75 @@
+//=============================================================================
+// frame_parser.h - Finds the headers of a received Ethernet/IPv4/UDP frame
+//
+// Author: D. Wolf
+//
+// Everything that receives frames (CRdmxReceiver, CPayloadChecker,
+// CSeqTracker and the reliable RDMX classes) first has to find the UDP
+// datagram inside an Ethernet frame, and every one of them has to make the
+// same checks before trusting what it finds there.  "parse_udp_frame()"
+// makes those checks in one place.
+//
+// A frame is accepted only if:
+//
+//   - it's an untagged IPv4 frame carrying UDP
+//   - the IPv4 header length is at least the minimum of 20 bytes
+//   - it isn't an IP fragment (no "more fragments" flag, fragment offset 0)
+//   - the whole UDP datagram, as described by the UDP length, is present
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <arpa/inet.h>
+#include "frame_builder.h"
+
+// The parts of a received UDP frame
+struct udp_frame_t
+{
+    const eth_hdr_t*    eth;
+    const ipv4_hdr_t*   ipv4;
+    const udp_hdr_t*    udp;
+    const uint8_t*      payload;
+    uint32_t            payload_length;
+};
+
+
+//=============================================================================
+// parse_udp_frame() - Fills in "out" with the headers and payload of a frame
+//
+// Returns false if the frame isn't a complete, unfragmented IPv4/UDP datagram
+//=============================================================================
+inline bool parse_udp_frame(const void* frame, uint32_t length, udp_frame_t& out)
+{
+    const uint8_t* p = (const uint8_t*)frame;
+
+    // Make sure there's room for the Ethernet header and minimal IPv4 header
+    if (length < sizeof(eth_hdr_t) + sizeof(ipv4_hdr_t)) return false;
+
+    // It has to be an IPv4 frame
+    const eth_hdr_t* eth = (const eth_hdr_t*)p;
+    if (eth->frame_type != htons(0x0800)) return false;
+
+    // It has to be an IPv4 packet carrying UDP, with a sane header length
+    const ipv4_hdr_t* ipv4 = (const ipv4_hdr_t*)(p + sizeof(eth_hdr_t));
+    uint32_t ihl = ipv4->version & 0xF;
+    if ((ipv4->version >> 4) != 4 || ihl < 5 || ipv4->protocol != 0x11) return false;
+
+    // Fragments don't carry a UDP header we can trust
+    if ((ntohs(ipv4->flags) & 0x3FFF) != 0) return false;
+
+    // Find the UDP header, making sure it fits in the frame
+    uint32_t udp_offset = sizeof(eth_hdr_t) + ihl * 4;
+    if (udp_offset + sizeof(udp_hdr_t) > length) return false;
+    const udp_hdr_t* udp = (const udp_hdr_t*)(p + udp_offset);
+
+    // Make sure the whole datagram is here
+    uint32_t udp_length = ntohs(udp->length);
+    if (udp_length < sizeof(udp_hdr_t) || udp_offset + udp_length > length) return false;
+
+    out.eth            = eth;
+    out.ipv4           = ipv4;
+    out.udp            = udp;
+    out.payload        = (const uint8_t*)udp + sizeof(udp_hdr_t);
+    out.payload_length = udp_length - sizeof(udp_hdr_t);
+    return true;
+}
+//=============================================================================
@@ -0,0 +1,216 @@
+//=============================================================================
+// frame_pool.cpp - A pool of fixed-size frame buffers
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include "frame_pool.h"
+#include "thread_slot.h"
+
+// Handy shortcuts for the memory orders we use
+static const std::memory_order relaxed = std::memory_order_relaxed;
+static const std::memory_order acquire = std::memory_order_acquire;
+static const std::memory_order release = std::memory_order_release;
+
+
+//=============================================================================
+// CFramePool() - Default constructor
+//=============================================================================
+CFramePool::CFramePool()
+{
+    m_arena        = nullptr;
+    m_arena_end    = nullptr;
+    m_arena_size   = 0;
+    m_headroom     = 0;
+    m_payload_size = 0;
+    m_slot_size    = 0;
+    m_slot_count   = 0;
+    m_next         = nullptr;
+    m_head.store(NONE, relaxed);
+    for (cache_t& cache : m_cache) cache.count = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CFramePool() - Destructor.  Frees the arena
+//=============================================================================
+CFramePool::~CFramePool()
+{
+    if (m_arena) munmap(m_arena, m_arena_size);
+    delete[] m_next;
+}
+//=============================================================================
+
+
+//=============================================================================
+// create() - Allocates the arena and places every slot on the global stack
+//=============================================================================
+void CFramePool::create(uint32_t slot_count, uint32_t payload_size,
+                        uint32_t headroom, bool hugepages)
+{
+    // A pool needs at least one slot, and a slot index can't be NONE
+    if (slot_count == 0 || slot_count == NONE)
+    {
+        fprintf(stderr, "CFramePool::create(): slot_count must be between 1 and %u\n",
+                NONE - 1);
+        exit(1);
+    }
+
+    // Each slot is a whole number of cache-lines
+    m_headroom     = headroom;
+    m_payload_size = payload_size;
+    m_slot_size    = (headroom + payload_size + 63) & ~63;
+    m_slot_count   = slot_count;
+
+    size_t size = (size_t)m_slot_size * slot_count;
+    void*  arena = MAP_FAILED;
+
+    // If we've been asked to, try to back the arena with 2MB huge pages
+    if (hugepages)
+    {
+        size_t huge_size = (size + 0x1FFFFF) & ~(size_t)0x1FFFFF;
+        arena = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (arena != MAP_FAILED) size = huge_size;
+    }
+
+    // If we don't have an arena yet, use ordinary pages
+    if (arena == MAP_FAILED)
+    {
+        arena = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+
+    // If we couldn't allocate the arena, barf
+    if (arena == MAP_FAILED)
+    {
+        perror("mmap frame pool");
+        exit(1);
+    }
+
+    m_arena      = (uint8_t*)arena;
+    m_arena_size = size;
+    m_arena_end  = m_arena + (size_t)m_slot_size * slot_count;
+
+    // Chain every slot together and make that chain the global stack
+    m_next = new std::atomic<uint32_t>[slot_count];
+    for (uint32_t i=0; i<slot_count; ++i) m_next[i].store(i + 1, relaxed);
+    m_next[slot_count - 1].store(NONE, relaxed);
+    m_head.store(0, release);
+}
+//=============================================================================
+
+
+//=============================================================================
+// push_global() - Pushes a chain of slots (first through last, linked via
+//                 m_next) onto the global stack
+//=============================================================================
+void CFramePool::push_global(uint32_t first, uint32_t last)
+{
+    uint64_t head = m_head.load(relaxed);
+    uint64_t new_head;
+    do
+    {
+        m_next[last].store((uint32_t)head, relaxed);
+        new_head = ((head >> 32) + 1) << 32 | first;
+    } while (!m_head.compare_exchange_weak(head, new_head, release, relaxed));
+}
+//=============================================================================
+
+
+//=============================================================================
+// pop_global() - Pops a slot from the global stack, or returns NONE
+//=============================================================================
+uint32_t CFramePool::pop_global()
+{
+    uint64_t head = m_head.load(acquire);
+    uint64_t new_head;
+    uint32_t index;
+    do
+    {
+        index = (uint32_t)head;
+        if (index == NONE) return NONE;
+        new_head = ((head >> 32) + 1) << 32 | m_next[index].load(relaxed);
+    } while (!m_head.compare_exchange_weak(head, new_head, acquire, acquire));
+
+    return index;
+}
+//=============================================================================
+
+
+//=============================================================================
+// alloc() - Returns a pointer to the payload area of a free slot
+//=============================================================================
+uint8_t* CFramePool::alloc()
+{
+    uint32_t index;
+    int      slot = thread_slot();
+
+    if (slot < MAX_THREADS)
+    {
+        cache_t& cache = m_cache[slot];
+
+        // If our cache is empty, refill half of it from the global stack
+        if (cache.count == 0)
+        {
+            while (cache.count < CACHE_SIZE / 2)
+            {
+                index = pop_global();
+                if (index == NONE) break;
+                cache.index[cache.count++] = index;
+            }
+
+            // If there was nothing on the global stack, the pool is empty
+            if (cache.count == 0) return nullptr;
+        }
+
+        index = cache.index[--cache.count];
+    }
+
+    // Threads without a cache go straight to the global stack
+    else
+    {
+        index = pop_global();
+        if (index == NONE) return nullptr;
+    }
+
+    return m_arena + (size_t)index * m_slot_size + m_headroom;
+}
+//=============================================================================
+
+
+//=============================================================================
+// free() - Returns a slot to the pool
+//=============================================================================
+void CFramePool::free(const void* p)
+{
+    uint32_t index = ((const uint8_t*)p - m_arena) / m_slot_size;
+    int      slot  = thread_slot();
+
+    // Threads without a cache go straight to the global stack
+    if (slot >= MAX_THREADS)
+    {
+        push_global(index, index);
+        return;
+    }
+
+    cache_t& cache = m_cache[slot];
+
+    // If our cache is full, spill half of it to the global stack as a chain
+    if (cache.count == CACHE_SIZE)
+    {
+        uint32_t first = cache.index[CACHE_SIZE / 2];
+        for (uint32_t i=CACHE_SIZE/2; i<CACHE_SIZE - 1; ++i)
+        {
+            m_next[cache.index[i]].store(cache.index[i + 1], relaxed);
+        }
+        push_global(first, cache.index[CACHE_SIZE - 1]);
+        cache.count = CACHE_SIZE / 2;
+    }
+
+    cache.index[cache.count++] = index;
+}
+//=============================================================================
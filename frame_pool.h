@@ -0,0 +1,107 @@
+//=============================================================================
+// frame_pool.h - A pool of fixed-size frame buffers
+//
+// Author: D. Wolf
+//
+// The slots are carved from a single arena that's backed by huge pages (or
+// at least pre-faulted) when the pool is created, so allocating a frame
+// never calls malloc and never takes a page fault.
+//
+// Each slot is cache-line aligned, and alloc() returns a pointer that's
+// "headroom" bytes into the slot.  Build the payload there, then write the
+// frame header into the headroom just in front of it:
+//
+//     uint8_t* payload = pool.alloc();
+//     uint8_t* frame   = payload - CRawUDP::HEADER_SIZE;
+//     udp.write_header(frame, payload_length);
+//
+// Every thread keeps a small cache of free slots of its own, so alloc() and
+// free() normally touch no shared state.  The caches are refilled from, and
+// spilled to, a lock-free global stack.  A slot may be freed by a different
+// thread than the one that allocated it.  Note that up to CACHE_SIZE free
+// slots sit in the cache of a thread that exits until another thread takes
+// over its thread slot (see thread_slot.h), so size the pool with that in
+// mind.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+class CFramePool
+{
+public:
+
+    // The maximum number of threads that get a cache of their own.  Any
+    // threads beyond this go straight to the global stack
+    static const int MAX_THREADS = 64;
+
+    // The number of free slots each thread can cache
+    static const uint32_t CACHE_SIZE = 64;
+
+    // Constructor and destructor
+    CFramePool();
+    ~CFramePool();
+
+    // Creates "slot_count" slots (at least one), each with "headroom" bytes
+    // reserved for a frame header followed by "payload_size" bytes of payload
+    void    create(uint32_t slot_count, uint32_t payload_size = 2048,
+                   uint32_t headroom = 64, bool hugepages = true);
+
+    // Returns a pointer to the payload area of a free slot, or nullptr if
+    // every slot is in use
+    uint8_t* alloc();
+
+    // Returns a slot to the pool.  "p" may point anywhere within the slot
+    void    free(const void* p);
+
+    // Returns true if "p" points into one of our slots
+    bool    contains(const void* p) const
+    {
+        return (const uint8_t*)p >= m_arena && (const uint8_t*)p < m_arena_end;
+    }
+
+    // Geometry of the pool
+    uint32_t headroom()     const {return m_headroom;}
+    uint32_t payload_size() const {return m_payload_size;}
+    uint32_t slot_size()    const {return m_slot_size;}
+    uint32_t slot_count()   const {return m_slot_count;}
+
+protected:
+
+    // Pushes a chain of slots, linked through m_next from "first" to
+    // "last", onto the global stack
+    void    push_global(uint32_t first, uint32_t last);
+
+    // Pops a single slot from the global stack, or returns NONE
+    uint32_t pop_global();
+
+    // Marks the end of a chain, or an empty stack
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    // One thread's cache of free slots, on cache-lines of its own
+    struct alignas(64) cache_t
+    {
+        uint32_t    count;
+        uint32_t    index[CACHE_SIZE];
+    };
+
+    // The arena that the slots are carved from
+    uint8_t*    m_arena;
+    uint8_t*    m_arena_end;
+    size_t      m_arena_size;
+
+    // Geometry of the slots
+    uint32_t    m_headroom;
+    uint32_t    m_payload_size;
+    uint32_t    m_slot_size;
+    uint32_t    m_slot_count;
+
+    // The global stack.  The top 32 bits of the head are a tag that changes
+    // on every update, which protects us from the ABA problem
+    alignas(64) std::atomic<uint64_t> m_head;
+    std::atomic<uint32_t>* m_next;
+
+    // The per-thread caches
+    cache_t     m_cache[MAX_THREADS];
+};
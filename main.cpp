@@ -5,6 +5,8 @@
 #include "raw_nic.h"
 #include "raw_udp.h"
 #include "raw_rdmx.h"
+#include "payload.h"
+#include "frame_pool.h"
 
 
 //=============================================================================
@@ -24,13 +26,13 @@ CRawUDP  udp_frame_header;
 // Creates headers for Ethernet/IPv4/UDP/RDMX frames
 CRawRDMX rdmx_frame_header;
 
-// Just a big buffer to create frames in for our demonstration
-uint8_t ethernet_frame[10000];
+// The buffers we build frames in.  Each has room for a frame header in
+// front of the payload
+CFramePool frame_pool;
 
 //=============================================================================
 // Function prototypes
 //=============================================================================
-void make_payload(uint8_t* where, uint16_t length);
 void demonstrate_udp_frame();
 void demonstrate_rdmx_frame();
 //=============================================================================
@@ -44,6 +46,10 @@ int main()
     // Create a raw connection to our network interface
     NIC.connect_nic("enp3s0");
 
+    // Create a small pool of frame buffers, leaving room for the largest
+    // frame header in front of each payload
+    frame_pool.create(64, PAYLOAD_LEN, RDMX_HEADER_SIZE);
+
     // Send a UDP packet 
     demonstrate_udp_frame();
 
@@ -53,16 +59,6 @@ int main()
 //=============================================================================
 
 
-//=============================================================================
-// make_payload() - This writes a very simple mock "payload" into a buffer
-//=============================================================================
-void make_payload(uint8_t* where, uint16_t length)
-{
-    for (int i=0; i<length; ++i) *where++ = i;
-}
-//=============================================================================
-
-
 //=============================================================================
 // This demonstrates how to create a UDP frame-header template, and how to 
 // use it to write a complete Ethernet/IPv4/UDP frame-header to a buffer
@@ -84,14 +80,24 @@ void demonstrate_udp_frame()
     udp_frame_header.set_ip_addrs(src_ip, dst_ip);
     udp_frame_header.set_udp_ports(src_port, dst_port);
 
+    // Fetch a buffer from the pool.  The frame header goes right in
+    // front of the payload
+    uint8_t* payload = frame_pool.alloc();
+    uint8_t* ethernet_frame = payload - UDP_HEADER_SIZE;
+
     // Stamp an Ethernet/IPv4/UDP header into 'ethernet_frame'
     udp_frame_header.write_header(ethernet_frame, PAYLOAD_LEN);
 
-    // For demo purposes, stuff a simple payload into 'ethernet_frame'
-    make_payload(ethernet_frame + UDP_HEADER_SIZE, PAYLOAD_LEN);
+    // For demo purposes, fill the frame with a test pattern.  A receiver's
+    // CPayloadChecker checks UDP payloads against the seed it was configured
+    // with, which is 0 by default
+    fill_payload(payload, PAYLOAD_LEN, PATTERN_PRBS31, 0);
 
     // Transmit the Ethernet frame that we built from scratch
     NIC.send(ethernet_frame, UDP_HEADER_SIZE + PAYLOAD_LEN);
+
+    // send() has finished with the frame once it returns
+    frame_pool.free(payload);
 }
 //=============================================================================
 
@@ -122,14 +128,23 @@ void demonstrate_rdmx_frame()
     // This is the RDMX target address where the receiver will store the packet
     const uint64_t TARGET_ADDRESS = 0x123456789abcdef0LL;
  
+    // Fetch a buffer from the pool.  The frame header goes right in
+    // front of the payload
+    uint8_t* payload = frame_pool.alloc();
+    uint8_t* ethernet_frame = payload - RDMX_HEADER_SIZE;
+
     // Stamp an Ethernet/IPv4/UDP/RDMX header into 'ethernet_frame'
     rdmx_frame_header.write_header(ethernet_frame, PAYLOAD_LEN, TARGET_ADDRESS);
 
-    // For demo purposes, stuff a simple payload into 'ethernet_frame'
-    make_payload(ethernet_frame + RDMX_HEADER_SIZE, PAYLOAD_LEN);
+    // For demo purposes, fill the frame with a test pattern.  RDMX payloads
+    // are seeded with their target address
+    fill_payload(payload, PAYLOAD_LEN, PATTERN_PRBS31, TARGET_ADDRESS);
 
     // Transmit the Ethernet frame that we built from scratch
     NIC.send(ethernet_frame, RDMX_HEADER_SIZE + PAYLOAD_LEN);
+
+    // send() has finished with the frame once it returns
+    frame_pool.free(payload);
 }
 //=============================================================================
 
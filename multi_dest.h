@@ -0,0 +1,136 @@
+//=============================================================================
+// multi_dest.h - Sends one payload to many destinations
+//
+// Author: D. Wolf
+//
+// We often send the same payload to dozens of boards.  CMultiDest keeps a
+// table of header templates, one per destination, each with its checksum
+// partials already worked out.  "send()" stamps a header for every
+// destination into a pool of its own and hands the kernel a single batch in
+// which every frame is gathered from its own header plus the one shared
+// payload buffer.  The payload is never copied in user space, and if UDP
+// checksums are on, it is summed just once for all of the destinations.
+//
+// "RAW" is the header class to use: CRawUDP or CRawRDMX.
+//
+// To use this class:
+//
+// (1) declare an instance of "CMultiDest<CRawUDP>" (or <CRawRDMX>) that
+//     refers to a connected CRawNIC
+//
+// (2) call "add_destination()" once per destination
+//
+// (3) call "send()" for each payload
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+#include "raw_nic.h"
+#include "raw_udp.h"
+#include "raw_rdmx.h"
+#include "checksum.h"
+
+template <class RAW> class CMultiDest
+{
+public:
+
+    // The frame builder of the header class
+    typedef typename RAW::builder_t builder_t;
+
+    // True if the frames carry an RDMX header
+    static constexpr bool is_rdmx = builder_t::template has<rdmx_layer_t>;
+
+    // Frames are sent through "nic"
+    CMultiDest(CRawNIC& nic) : nic_(nic), udp_checksum_(false) {}
+
+    // Adds a destination, and returns its index.  If dst_mac is nullptr,
+    // frames to this destination are broadcast
+    int     add_destination(const void* src_mac, const void* dst_mac,
+                            const void* src_ip,  const void* dst_ip,
+                            uint16_t src_port,   uint16_t dst_port)
+    {
+        dest_.emplace_back();
+        RAW& dest = dest_.back();
+        dest.set_mac_addrs(src_mac, dst_mac);
+        dest.set_ip_addrs(src_ip, dst_ip);
+        dest.set_udp_ports(src_port, dst_port);
+        dest.set_udp_checksum(udp_checksum_);
+
+        // Make room for this destination's frame
+        header_.emplace_back();
+        iov_.resize(2 * dest_.size());
+        return (int)dest_.size() - 1;
+    }
+
+    // Removes every destination
+    void    clear() {dest_.clear(); header_.clear(); iov_.clear();}
+
+    // Returns the number of destinations
+    int     destinations() const {return (int)dest_.size();}
+
+    // Gives access to the template of a single destination
+    RAW&    destination(int index) {return dest_[index];}
+
+    // Turns UDP checksums on or off for every destination
+    void    set_udp_checksum(bool enable)
+    {
+        udp_checksum_ = enable;
+        for (RAW& dest : dest_) dest.set_udp_checksum(enable);
+    }
+
+    // Sends "payload_length" bytes from "payload" to every destination (for
+    // RDMX, to "target_addr" at each of them).  Returns the number of
+    // destinations the frame was handed to the kernel for, which is less
+    // than destinations() only on a hard error or if the transmit queue
+    // stays full for a second
+    int     send(const void* payload, uint16_t payload_length, uint64_t target_addr = 0)
+    {
+        const int count = destinations();
+
+        // Sum the payload just once, for every destination's UDP checksum
+        uint16_t payload_sum = udp_checksum_ ? ones_sum(payload, payload_length) : 0;
+
+        // Stamp a header for every destination, and pair it with the payload
+        for (int i=0; i<count; ++i)
+        {
+            uint8_t* header = header_[i].bytes;
+            dest_[i].builder().stamp_summed(header, payload_length, payload_sum,
+                                            [target_addr](uint8_t* frame)
+            {
+                if constexpr (is_rdmx)
+                {
+                    builder_t::template hdr<rdmx_layer_t>(frame).target_addr = htonll(target_addr);
+                }
+            });
+
+            iov_[2*i    ].iov_base = header;
+            iov_[2*i    ].iov_len  = RAW::HEADER_SIZE;
+            iov_[2*i + 1].iov_base = (void*)payload;
+            iov_[2*i + 1].iov_len  = payload_length;
+        }
+
+        // Hand the whole batch to the kernel, waiting out a full queue
+        return nic_.send_all(iov_.data(), 2, count);
+    }
+
+protected:
+
+    // A header that's been stamped for one destination
+    struct alignas(64) header_t
+    {
+        uint8_t bytes[RAW::HEADER_SIZE];
+    };
+
+    // The NIC we send through
+    CRawNIC&                nic_;
+
+    // True if the frames carry UDP checksums
+    bool                    udp_checksum_;
+
+    // The per-destination header templates, the headers we stamp from them,
+    // and the scatter-gather list for the batch
+    std::vector<RAW>        dest_;
+    std::vector<header_t>   header_;
+    std::vector<iovec>      iov_;
+};
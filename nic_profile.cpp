@@ -0,0 +1,117 @@
+//=============================================================================
+// nic_profile.cpp - A tuning profile for CRawNIC sockets
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "nic_profile.h"
+
+//=============================================================================
+// There are no C library wrappers for the memory-policy system calls, and we
+// don't want to depend on libnuma just for these
+//=============================================================================
+static long set_mempolicy(int mode, const unsigned long* mask, unsigned long maxnode)
+{
+    return syscall(__NR_set_mempolicy, mode, mask, maxnode);
+}
+
+static long get_mempolicy(int* mode, unsigned long* mask, unsigned long maxnode)
+{
+    return syscall(__NR_get_mempolicy, mode, mask, maxnode, nullptr, 0);
+}
+//=============================================================================
+
+
+//=============================================================================
+// nic_numa_node() - Reads the NUMA node of a NIC from sysfs.  Virtual NICs
+//                   (and machines with a single node) don't have one
+//=============================================================================
+int nic_numa_node(const char* nic_name)
+{
+    char filename[256];
+    snprintf(filename, sizeof(filename), "/sys/class/net/%s/device/numa_node", nic_name);
+
+    FILE* ifile = fopen(filename, "r");
+    if (ifile == nullptr) return -1;
+
+    int node = -1;
+    if (fscanf(ifile, "%d", &node) != 1) node = -1;
+    fclose(ifile);
+    return node;
+}
+//=============================================================================
+
+
+//=============================================================================
+// pin_thread() - Pins the calling thread to a CPU
+//=============================================================================
+void pin_thread(int cpu)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np: CPU %d: error %d\n", cpu, rc);
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// CNumaScope() - Saves the calling thread's memory policy, then makes it
+//                prefer the specified node
+//=============================================================================
+CNumaScope::CNumaScope(int node)
+{
+    const unsigned long BITS = 8 * sizeof(m_old_mask);
+
+    m_active = false;
+    if (node < 0 || node >= (int)BITS) return;
+
+    // Save the existing policy so we can put it back
+    memset(m_old_mask, 0, sizeof(m_old_mask));
+    if (get_mempolicy(&m_old_mode, m_old_mask, BITS) < 0)
+    {
+        perror("get_mempolicy");
+        return;
+    }
+
+    // Prefer our node, but fall back to the others if it's out of memory
+    unsigned long mask[16];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+    if (set_mempolicy(MPOL_PREFERRED, mask, BITS) < 0)
+    {
+        perror("set_mempolicy");
+        return;
+    }
+
+    m_active = true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CNumaScope() - Restores the calling thread's previous memory policy
+//=============================================================================
+CNumaScope::~CNumaScope()
+{
+    if (!m_active) return;
+
+    // The default policy takes no node mask
+    if (m_old_mode == MPOL_DEFAULT)
+        set_mempolicy(MPOL_DEFAULT, nullptr, 0);
+    else
+        set_mempolicy(m_old_mode, m_old_mask, 8 * sizeof(m_old_mask));
+}
+//=============================================================================
@@ -0,0 +1,95 @@
+//=============================================================================
+// nic_profile.h - A tuning profile for CRawNIC sockets
+//
+// Author: D. Wolf
+//
+// Getting consistent tail latency means putting the rings and buffers on
+// the NIC's own NUMA node, keeping the thread on one CPU, skipping the
+// qdisc layer, sizing the socket buffers and busy polling.  A profile
+// gathers all of those settings so that they can be applied to every host
+// the same way.  Pass one to CRawNIC::connect_nic().
+//
+// A field that is zero (or -1, or false) leaves the corresponding setting
+// alone, so a default-constructed profile changes nothing.
+//=============================================================================
+#pragma once
+#include <cstdint>
+
+struct nic_profile_t
+{
+    // Allocate rings on the NIC's NUMA node
+    bool        numa_local;
+
+    // The CPU to pin the calling thread to, or -1 for "don't pin"
+    int         cpu;
+
+    // Send frames straight to the NIC's driver, bypassing the qdisc layer
+    bool        qdisc_bypass;
+
+    // Socket buffer sizes in bytes
+    int         sndbuf;
+    int         rcvbuf;
+
+    // How long (in microseconds) a receive may busy poll the NIC, and how
+    // many frames it may process per poll
+    int         busy_poll_usecs;
+    int         busy_poll_budget;
+
+    // Prefer busy polling over interrupt-driven processing
+    bool        prefer_busy_poll;
+
+    // A profile that changes nothing
+    nic_profile_t()
+    {
+        numa_local       = false;
+        cpu              = -1;
+        qdisc_bypass     = false;
+        sndbuf           = 0;
+        rcvbuf           = 0;
+        busy_poll_usecs  = 0;
+        busy_poll_budget = 0;
+        prefer_busy_poll = false;
+    }
+
+    // A reasonable starting point for low-latency deployments
+    static nic_profile_t low_latency(int cpu)
+    {
+        nic_profile_t profile;
+        profile.numa_local       = true;
+        profile.cpu              = cpu;
+        profile.qdisc_bypass     = true;
+        profile.sndbuf           = 4 << 20;
+        profile.rcvbuf           = 4 << 20;
+        profile.busy_poll_usecs  = 50;
+        profile.busy_poll_budget = 64;
+        profile.prefer_busy_poll = true;
+        return profile;
+    }
+};
+
+
+//=============================================================================
+// CNumaScope - While one of these exists, memory that the calling thread
+//              allocates comes from the specified NUMA node (if it has any
+//              free).  The thread's previous policy is restored afterwards.
+//              A node of -1 does nothing
+//=============================================================================
+class CNumaScope
+{
+public:
+    CNumaScope(int node);
+    ~CNumaScope();
+
+protected:
+    bool            m_active;
+    int             m_old_mode;
+    unsigned long   m_old_mask[16];
+};
+//=============================================================================
+
+
+// Returns the NUMA node a NIC is attached to, or -1 if it isn't known
+int     nic_numa_node(const char* nic_name);
+
+// Pins the calling thread to a CPU
+void    pin_thread(int cpu);
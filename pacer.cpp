@@ -0,0 +1,234 @@
+//=============================================================================
+// pacer.cpp - Token-bucket rate pacing for transmitted frames
+//
+// Author: D. Wolf
+//
+// The bucket is kept as a single "virtual time": the earliest moment at which
+// the next frame may leave.  Each frame pushes that time forward by its cost.
+// Letting the virtual time lag behind the real clock by up to one bucket's
+// worth is what allows a burst after an idle period.
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "pacer.h"
+
+// How far ahead of the clock we'll compute SO_TXTIME launch times
+static const uint64_t TXTIME_HORIZON_NS = 10000000;     // 10 ms
+
+//=============================================================================
+// clock_ns() - Returns the specified clock, in nanoseconds
+//=============================================================================
+static uint64_t clock_ns(clockid_t clock_id)
+{
+    timespec ts;
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// read_tsc() - Returns the CPU's time-stamp counter
+//=============================================================================
+static inline uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return clock_ns(CLOCK_MONOTONIC);
+#endif
+}
+//=============================================================================
+
+
+//=============================================================================
+// CPacer() - Default constructor
+//=============================================================================
+CPacer::CPacer()
+{
+    m_tsc_per_ns = 0;
+    m_tsc_base   = 0;
+    configure(1e9, BITS_PER_SEC);
+}
+//=============================================================================
+
+
+//=============================================================================
+// configure() - Defines the target rate, the bucket depth, and the method
+//               we'll use to pace
+//=============================================================================
+void CPacer::configure(double rate, unit_t unit, uint32_t burst, method_t method)
+{
+    // A rate of zero (or less) would make every frame cost forever
+    if (!(rate > 0))
+    {
+        fprintf(stderr, "CPacer: rate must be greater than zero\n");
+        exit(1);
+    }
+
+    m_rate   = rate;
+    m_unit   = unit;
+    m_method = method;
+
+    // How long does it take to send one unit at the target rate?
+    if (unit == BITS_PER_SEC)
+        m_ps_per_unit = 8e12 / rate;
+    else
+        m_ps_per_unit = 1e12 / rate;
+
+    // The depth of the bucket, expressed as time
+    m_burst_ns = burst * m_ps_per_unit / 1000;
+
+    // If we're spinning on the TSC, find out how fast it runs by watching
+    // it against the monotonic clock for a few milliseconds
+    if (method == TSC && m_tsc_per_ns == 0)
+    {
+        uint64_t ns0  = clock_ns(CLOCK_MONOTONIC);
+        uint64_t tsc0 = read_tsc();
+        usleep(20000);
+        uint64_t ns1  = clock_ns(CLOCK_MONOTONIC);
+        uint64_t tsc1 = read_tsc();
+        m_tsc_per_ns  = double(tsc1 - tsc0) / double(ns1 - ns0);
+        m_tsc_base    = tsc1 - (uint64_t)(ns1 * m_tsc_per_ns);
+    }
+
+    // If we're computing launch times, we need the offset to CLOCK_TAI
+    m_tai_offset_ns = clock_ns(CLOCK_TAI) - clock_ns(CLOCK_MONOTONIC);
+
+    // Start with a full bucket
+    reset();
+}
+//=============================================================================
+
+
+//=============================================================================
+// now_ns() - Returns the current time in nanoseconds
+//=============================================================================
+uint64_t CPacer::now_ns()
+{
+    if (m_method == TSC) return (read_tsc() - m_tsc_base) / m_tsc_per_ns;
+    return clock_ns(CLOCK_MONOTONIC);
+}
+//=============================================================================
+
+
+//=============================================================================
+// cost_ps() - Returns the number of picoseconds a frame uses up
+//=============================================================================
+uint64_t CPacer::cost_ps(uint32_t frame_length)
+{
+    if (m_unit == BITS_PER_SEC) return frame_length * m_ps_per_unit;
+    return m_ps_per_unit;
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset() - Restarts the rate measurement, and fills the bucket.  The next
+//           charge() trims the credit to suit the size of its frame
+//=============================================================================
+void CPacer::reset()
+{
+    m_start_ns     = now_ns();
+    m_next_ns      = m_start_ns - m_burst_ns;
+    m_next_frac_ps = 0;
+    m_frames   = 0;
+    m_bytes    = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// charge() - Removes the cost of a frame from the bucket, and returns the 
+//            time at which the frame may be sent
+//=============================================================================
+uint64_t CPacer::charge(uint32_t frame_length)
+{
+    uint64_t now  = now_ns();
+    uint64_t cost = cost_ps(frame_length);
+
+    // An idle period can't save up more than one bucket's worth of credit.
+    // A frame leaves as soon as its start is due, so a full bucket lags the
+    // clock by the bucket depth less the cost of this frame: that way a 
+    // burst is "burst" units long in all, rather than "burst" units
+    // followed by one more frame
+    uint64_t lag_ns = (m_burst_ns > cost / 1000) ? m_burst_ns - cost / 1000 : 0;
+    if (m_next_ns + lag_ns < now)
+    {
+        m_next_ns      = now - lag_ns;
+        m_next_frac_ps = 0;
+    }
+
+    // This frame may go at "m_next_ns"; the one after it has to wait longer.
+    // The fraction of a nanosecond carries over, so that small costs don't
+    // get rounded away
+    uint64_t when = m_next_ns;
+    m_next_frac_ps += cost;
+    m_next_ns      += m_next_frac_ps / 1000;
+    m_next_frac_ps %= 1000;
+
+    // Keep track of what we've sent
+    ++m_frames;
+    m_bytes += frame_length;
+
+    return when;
+}
+//=============================================================================
+
+
+//=============================================================================
+// wait() - Spins until a frame of the specified length may be sent
+//=============================================================================
+void CPacer::wait(uint32_t frame_length)
+{
+    uint64_t when = charge(frame_length);
+    while (now_ns() < when);
+}
+//=============================================================================
+
+
+//=============================================================================
+// launch_time() - Returns a CLOCK_TAI launch time in nanoseconds, suitable for
+//                 passing to CRawNIC::send_at()
+//=============================================================================
+uint64_t CPacer::launch_time(uint32_t frame_length)
+{
+    uint64_t when = charge(frame_length);
+
+    // Don't let the launch times run too far ahead of the clock, or the 
+    // qdisc will have to hold on to an unreasonable number of frames
+    while (now_ns() + TXTIME_HORIZON_NS < when);
+
+    return when + m_tai_offset_ns;
+}
+//=============================================================================
+
+
+//=============================================================================
+// actual_rate() - Returns the rate we've achieved since the last reset()
+//=============================================================================
+double CPacer::actual_rate()
+{
+    double seconds = (now_ns() - m_start_ns) / 1e9;
+    if (seconds <= 0) return 0;
+
+    if (m_unit == BITS_PER_SEC) return m_bytes * 8 / seconds;
+    return m_frames / seconds;
+}
+//=============================================================================
+
+
+//=============================================================================
+// drift() - Returns the fractional difference between the achieved rate and
+//           the target rate
+//=============================================================================
+double CPacer::drift()
+{
+    return actual_rate() / m_rate - 1;
+}
+//=============================================================================
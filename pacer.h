@@ -0,0 +1,119 @@
+//=============================================================================
+// pacer.h - Token-bucket rate pacing for transmitted frames
+//
+// Author: D. Wolf
+//
+// To use this class:
+//
+// (1) declare an instance of "CPacer"
+//
+// (2) call "configure()" with the target rate, the units it's expressed in,
+//     the size of the largest burst you'll allow, and the pacing method
+//
+// (3) in BUSY_POLL or TSC mode, call "wait()" before sending each frame.  In
+//     TXTIME mode, call "launch_time()" and pass the result to 
+//     CRawNIC::send_at()
+//
+// (4) call "drift()" to see how far the achieved rate is from the target
+//
+// TXTIME mode requires CRawNIC::enable_txtime() and an "etf" qdisc on the
+// interface, for instance:
+//
+//    tc qdisc replace dev <nic> root etf clockid CLOCK_TAI delta 200000
+//=============================================================================
+#pragma once
+#include <cstdint>
+
+class CPacer
+{
+public:
+
+    // The units that a rate can be expressed in
+    enum unit_t 
+    {
+        BITS_PER_SEC,
+        FRAMES_PER_SEC
+    };
+
+    // The ways we can pace frames
+    enum method_t
+    {
+        BUSY_POLL,      // Spin on clock_gettime(CLOCK_MONOTONIC)
+        TSC,            // Spin on the CPU's time-stamp counter
+        TXTIME          // Compute launch times for SO_TXTIME
+    };
+
+    // Constructor
+    CPacer();
+
+    // Defines the target rate, which must be above zero.  "burst" is the
+    // depth of the token bucket: the number of bytes (for BITS_PER_SEC) or
+    // frames (for FRAMES_PER_SEC) that may be sent back-to-back after an idle
+    // period
+    void        configure(double rate, unit_t unit, uint32_t burst = 1, 
+                          method_t method = BUSY_POLL);
+
+    // Busy-waits until a frame of "frame_length" bytes may be sent
+    void        wait(uint32_t frame_length);
+
+    // Returns the CLOCK_TAI launch time, in nanoseconds, for the next frame.
+    // This only waits if we'd otherwise run too far ahead of the clock
+    uint64_t    launch_time(uint32_t frame_length);
+
+    // Restarts the rate measurement and fills the token bucket
+    void        reset();
+
+    // Returns the achieved rate, in the units passed to configure()
+    double      actual_rate();
+
+    // Returns (actual rate / target rate) - 1.  For example, 0.01 means we're
+    // running 1% fast
+    double      drift();
+
+    // How many frames and bytes have been paced since the last reset()
+    uint64_t    frames() const {return m_frames;}
+    uint64_t    bytes()  const {return m_bytes;}
+
+protected:
+
+    // Returns the current time in nanoseconds, using our pacing clock
+    uint64_t    now_ns();
+
+    // Returns the cost of a frame, in picoseconds
+    uint64_t    cost_ps(uint32_t frame_length);
+
+    // Charges the bucket for a frame and returns the time (in nanoseconds)
+    // it may be sent
+    uint64_t    charge(uint32_t frame_length);
+
+    // The target rate, its units, and how we're pacing
+    double      m_rate;
+    unit_t      m_unit;
+    method_t    m_method;
+
+    // The number of picoseconds it takes to send one byte or one frame
+    double      m_ps_per_unit;
+
+    // The depth of the token bucket, in nanoseconds
+    uint64_t    m_burst_ns;
+
+    // The earliest time at which the next frame may be sent: whole
+    // nanoseconds, plus the picoseconds left over.  Absolute times in
+    // picoseconds would overflow 64 bits
+    uint64_t    m_next_ns;
+    uint64_t    m_next_frac_ps;
+
+    // For TSC mode, the TSC frequency in ticks per nanosecond and the value
+    // of the TSC when we started
+    double      m_tsc_per_ns;
+    uint64_t    m_tsc_base;
+
+    // For TXTIME mode, the difference between CLOCK_TAI and our clock, in
+    // nanoseconds
+    int64_t     m_tai_offset_ns;
+
+    // Rate measurement
+    uint64_t    m_start_ns;
+    uint64_t    m_frames;
+    uint64_t    m_bytes;
+};
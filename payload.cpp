@@ -0,0 +1,408 @@
+//=============================================================================
+// payload.cpp - Routines for building mock payloads
+//
+// Author: D. Wolf
+//
+// PRBS-31 is usually generated a bit at a time with a shift register: bit n
+// of the stream is bit (n - 31) XOR bit (n - 28).  Since that recurrence is
+// linear, it also holds between whole bytes 31 and 28 bytes apart (squaring
+// x^31 + x^28 + 1 three times gives x^248 + x^224 + 1, and 248 and 224 bits
+// are 31 and 28 bytes).  Squaring three more times relates bytes 248 and 224
+// apart.  So we:
+//
+// (1) run the shift register for the first 31 bytes,
+//
+// (2) build bytes 31 to 247 eight at a time from the bytes 31 and 28 back,
+//
+// (3) build everything else 32 bytes (AVX2) or 8 bytes (plain C++) at a time
+//     from the bytes 248 and 224 back.  Those are far enough back that we're
+//     never reading something we stored a moment ago.
+//=============================================================================
+#include <cstring>
+#include <vector>
+#include <endian.h>
+#include "payload.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// The distances (in bytes) of the two recurrences described above
+static const uint32_t NEAR_TAP = 28, NEAR_LAG = 31;
+static const uint32_t FAR_TAP  = 224, FAR_LAG = 248;
+
+
+//=============================================================================
+// make_payload() - This writes a very simple mock "payload" into a buffer
+//=============================================================================
+void make_payload(uint8_t* where, uint16_t length)
+{
+    for (int i=0; i<length; ++i) *where++ = i;
+}
+//=============================================================================
+
+
+//=============================================================================
+// load64()/store64() - Unaligned 64-bit access
+//=============================================================================
+static inline uint64_t load64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline void store64(uint8_t* p, uint64_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+//=============================================================================
+
+
+//=============================================================================
+// prbs_state() - Turns a seed into a (non-zero) 31-bit PRBS register, mixing
+//                the bits so that neighboring seeds give unrelated streams
+//=============================================================================
+static uint32_t prbs_state(uint64_t seed)
+{
+    seed ^= seed >> 33;
+    seed *= 0xFF51AFD7ED558CCDULL;
+    seed ^= seed >> 33;
+    seed *= 0xC4CEB9FE1A85EC53ULL;
+    seed ^= seed >> 33;
+
+    uint32_t state = seed & 0x7FFFFFFF;
+    return state ? state : 1;
+}
+//=============================================================================
+
+
+//=============================================================================
+// prbs_head() - Builds the first 248 bytes (or fewer) of a PRBS-31 stream:
+//               steps (1) and (2) above
+//=============================================================================
+static void prbs_head(uint8_t* p, uint32_t length, uint64_t seed)
+{
+    // The register holds the most recent bits, the newest in bit 0
+    uint64_t reg = prbs_state(seed);
+
+    // Step (1): eight bits at a time from the shift register
+    uint32_t i = 0;
+    for (; i < length && i < NEAR_LAG; ++i)
+    {
+        uint8_t byte = ((reg >> 23) ^ (reg >> 20)) & 0xFF;
+        p[i] = byte;
+        reg  = (reg << 8) | byte;
+    }
+
+    // Step (2): eight bytes at a time from the bytes 31 and 28 back
+    uint32_t end = (length < FAR_LAG) ? length : FAR_LAG;
+    for (; i + 8 <= end; i += 8)
+    {
+        store64(p + i, load64(p + i - NEAR_LAG) ^ load64(p + i - NEAR_TAP));
+    }
+    for (; i < end; ++i) p[i] = p[i - NEAR_LAG] ^ p[i - NEAR_TAP];
+}
+//=============================================================================
+
+
+//=============================================================================
+// prbs_tail_scalar() - Step (3), from byte "i" onwards, 32 bytes per loop
+//                      iteration
+//=============================================================================
+static void prbs_tail_scalar(uint8_t* p, uint32_t i, uint32_t length)
+{
+    for (; i + 32 <= length; i += 32)
+    {
+        store64(p + i +  0, load64(p + i +  0 - FAR_LAG) ^ load64(p + i +  0 - FAR_TAP));
+        store64(p + i +  8, load64(p + i +  8 - FAR_LAG) ^ load64(p + i +  8 - FAR_TAP));
+        store64(p + i + 16, load64(p + i + 16 - FAR_LAG) ^ load64(p + i + 16 - FAR_TAP));
+        store64(p + i + 24, load64(p + i + 24 - FAR_LAG) ^ load64(p + i + 24 - FAR_TAP));
+    }
+
+    for (; i < length; ++i) p[i] = p[i - FAR_LAG] ^ p[i - FAR_TAP];
+}
+//=============================================================================
+
+
+//=============================================================================
+// counter_scalar()/fixed_scalar() - Fill with counting words, or with one
+//                                   word over and over
+//=============================================================================
+static void counter_scalar(uint8_t* p, uint32_t i, uint32_t length, uint32_t first)
+{
+    for (; i + 4 <= length; i += 4)
+    {
+        uint32_t word = htole32(first++);
+        memcpy(p + i, &word, 4);
+    }
+
+    // The last word may be partial
+    uint32_t word = htole32(first);
+    memcpy(p + i, &word, length - i);
+}
+
+static void fixed_scalar(uint8_t* p, uint32_t i, uint32_t length, uint32_t value)
+{
+    uint64_t word = htole32(value) * 0x0000000100000001ULL;
+    for (; i + 8 <= length; i += 8) store64(p + i, word);
+    memcpy(p + i, &word, length - i);
+}
+//=============================================================================
+
+
+//=============================================================================
+// compare_scalar() - XORs the payload with the expected pattern from byte "i"
+//                    onwards, 8 bytes at a time, counting the bits that differ
+//=============================================================================
+static void compare_scalar(const uint8_t* p, const uint8_t* expected, uint32_t i,
+                           uint32_t length, payload_check_t& result)
+{
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t diff = load64(p + i) ^ load64(expected + i);
+        if (diff == 0) continue;
+        if (result.first_bad < 0) result.first_bad = i + __builtin_ctzll(htole64(diff)) / 8;
+        result.bit_errors += __builtin_popcountll(diff);
+    }
+
+    for (; i < length; ++i)
+    {
+        uint8_t diff = p[i] ^ expected[i];
+        if (diff == 0) continue;
+        if (result.first_bad < 0) result.first_bad = i;
+        result.bit_errors += __builtin_popcount(diff);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// The plain C++ implementations, with the signatures the dispatcher uses
+//=============================================================================
+static void prbs_scalar(uint8_t* p, uint32_t length)
+{
+    prbs_tail_scalar(p, FAR_LAG, length);
+}
+
+static void counter_words_scalar(uint8_t* p, uint32_t length, uint32_t first)
+{
+    counter_scalar(p, 0, length, first);
+}
+
+static void fixed_words_scalar(uint8_t* p, uint32_t length, uint32_t value)
+{
+    fixed_scalar(p, 0, length, value);
+}
+
+static payload_check_t compare_words_scalar(const uint8_t* p, const uint8_t* expected,
+                                            uint32_t length)
+{
+    payload_check_t result = {-1, 0};
+    compare_scalar(p, expected, 0, length, result);
+    return result;
+}
+//=============================================================================
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+//=============================================================================
+// prbs_avx2() - Step (3), 128 bytes per loop iteration
+//=============================================================================
+__attribute__((target("avx2")))
+static void prbs_avx2(uint8_t* p, uint32_t length)
+{
+    uint32_t i = FAR_LAG;
+
+    for (; i + 128 <= length; i += 128)
+    {
+        for (uint32_t j=i; j<i+128; j+=32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(p + j - FAR_LAG));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(p + j - FAR_TAP));
+            _mm256_storeu_si256((__m256i*)(p + j), _mm256_xor_si256(a, b));
+        }
+    }
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + i - FAR_LAG));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + i - FAR_TAP));
+        _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(a, b));
+    }
+
+    _mm256_zeroupper();
+    prbs_tail_scalar(p, i, length);
+}
+//=============================================================================
+
+
+//=============================================================================
+// counter_avx2()/fixed_avx2() - Eight 32-bit words per store
+//=============================================================================
+__attribute__((target("avx2")))
+static void counter_avx2(uint8_t* p, uint32_t length, uint32_t first)
+{
+    const __m256i eight = _mm256_set1_epi32(8);
+    __m256i words = _mm256_add_epi32(_mm256_set1_epi32(first),
+                                     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    uint32_t i = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        _mm256_storeu_si256((__m256i*)(p + i), words);
+        words = _mm256_add_epi32(words, eight);
+    }
+
+    _mm256_zeroupper();
+    counter_scalar(p, i, length, first + i / 4);
+}
+
+__attribute__((target("avx2")))
+static void fixed_avx2(uint8_t* p, uint32_t length, uint32_t value)
+{
+    const __m256i words = _mm256_set1_epi32(value);
+    uint32_t i = 0;
+
+    for (; i + 32 <= length; i += 32) _mm256_storeu_si256((__m256i*)(p + i), words);
+
+    _mm256_zeroupper();
+    fixed_scalar(p, i, length, value);
+}
+//=============================================================================
+
+
+//=============================================================================
+// compare_avx2() - XORs 32 bytes at a time with the expected pattern.  Bits
+//                  are counted with the nibble lookup table trick: vpshufb
+//                  looks up the bit count of every nibble, and vpsadbw adds
+//                  the byte counts up into 64-bit lanes
+//=============================================================================
+__attribute__((target("avx2")))
+static payload_check_t compare_avx2(const uint8_t* p, const uint8_t* expected,
+                                    uint32_t length)
+{
+    const __m256i zero   = _mm256_setzero_si256();
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i bits   = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    __m256i count = zero;
+
+    payload_check_t result = {-1, 0};
+    uint32_t i = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p + i)),
+                                        _mm256_loadu_si256((const __m256i*)(expected + i)));
+
+        // The usual case: every byte is correct
+        if (_mm256_testz_si256(diff, diff)) continue;
+
+        if (result.first_bad < 0)
+        {
+            uint32_t good = _mm256_movemask_epi8(_mm256_cmpeq_epi8(diff, zero));
+            result.first_bad = i + __builtin_ctz(~good);
+        }
+
+        __m256i lo = _mm256_shuffle_epi8(bits, _mm256_and_si256(diff, nibble));
+        __m256i hi = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(diff, 4), nibble));
+        count = _mm256_add_epi64(count, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero));
+    }
+
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i*)lane, count);
+    _mm256_zeroupper();
+    result.bit_errors = lane[0] + lane[1] + lane[2] + lane[3];
+
+    compare_scalar(p, expected, i, length, result);
+    return result;
+}
+//=============================================================================
+
+#endif
+
+
+//=============================================================================
+// The implementations that the pattern routines use, chosen the first time
+// they're needed
+//=============================================================================
+struct pattern_fns_t
+{
+    void            (*prbs)(uint8_t*, uint32_t);
+    void            (*counter)(uint8_t*, uint32_t, uint32_t);
+    void            (*fixed)(uint8_t*, uint32_t, uint32_t);
+    payload_check_t (*compare)(const uint8_t*, const uint8_t*, uint32_t);
+    const char*     name;
+};
+
+static pattern_fns_t choose_impl()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {prbs_avx2, counter_avx2, fixed_avx2, compare_avx2, "avx2"};
+#endif
+    return {prbs_scalar, counter_words_scalar, fixed_words_scalar, compare_words_scalar, "scalar"};
+}
+
+static const pattern_fns_t& impl()
+{
+    static const pattern_fns_t chosen = choose_impl();
+    return chosen;
+}
+//=============================================================================
+
+
+//=============================================================================
+// fill_payload() - Fills a buffer with a test pattern
+//=============================================================================
+void fill_payload(void* where, uint32_t length, pattern_t pattern, uint64_t seed)
+{
+    uint8_t* p = (uint8_t*)where;
+
+    switch (pattern)
+    {
+        case PATTERN_PRBS31:
+            prbs_head(p, length, seed);
+            if (length > FAR_LAG) impl().prbs(p, length);
+            break;
+
+        case PATTERN_COUNTER:
+            impl().counter(p, length, (uint32_t)seed);
+            break;
+
+        case PATTERN_FIXED:
+            impl().fixed(p, length, (uint32_t)seed);
+            break;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// check_payload() - Compares a buffer with the test pattern it should hold.
+//                   The expected pattern is built in a per-thread scratch
+//                   buffer, which stays in cache from one payload to the next
+//=============================================================================
+payload_check_t check_payload(const void* where, uint32_t length, pattern_t pattern,
+                              uint64_t seed)
+{
+    static thread_local std::vector<uint8_t> expected;
+    if (expected.size() < length) expected.resize(length);
+
+    fill_payload(expected.data(), length, pattern, seed);
+    return impl().compare((const uint8_t*)where, expected.data(), length);
+}
+//=============================================================================
+
+
+//=============================================================================
+// pattern_impl() - Returns the name of the implementation in use
+//=============================================================================
+const char* pattern_impl()
+{
+    return impl().name;
+}
+//=============================================================================
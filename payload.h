@@ -0,0 +1,48 @@
+//=============================================================================
+// payload.h - Routines for building mock payloads
+//
+// Author: D. Wolf
+//
+// Besides the simple mock payload, there are test patterns that a receiver
+// can verify byte for byte: PRBS-31, counting words, and a fixed word.  Each
+// pattern is derived from a 64-bit seed.  RDMX payloads are seeded with their
+// target address, so a payload that lands in the wrong place is caught as an
+// error.  A plain UDP frame carries nothing a seed could come from, so every
+// UDP payload uses the same seed: its contents are verified, but reordered or
+// duplicated UDP frames aren't caught.  The best implementation for this CPU
+// (AVX2 or plain 64-bit C++) is chosen at run time.
+//=============================================================================
+#pragma once
+#include <cstdint>
+
+// This writes a very simple mock "payload" into a buffer
+void    make_payload(uint8_t* where, uint16_t length);
+
+// The test patterns that fill_payload() can write
+enum pattern_t
+{
+    PATTERN_PRBS31,     // PRBS-31 (x^31 + x^28 + 1), MSB first
+    PATTERN_COUNTER,    // Little-endian 32-bit words counting up from the seed
+    PATTERN_FIXED       // The low 32 bits of the seed, over and over
+};
+
+// The result of checking a payload against its pattern
+struct payload_check_t
+{
+    // Offset of the first byte that's wrong, or -1 if they're all correct
+    int64_t     first_bad;
+
+    // The number of bits that are wrong
+    uint64_t    bit_errors;
+};
+
+// Fills "length" bytes at "where" with a test pattern
+void    fill_payload(void* where, uint32_t length, pattern_t pattern, uint64_t seed);
+
+// Compares "length" bytes at "where" with the test pattern that fill_payload()
+// would have written for the same pattern and seed
+payload_check_t check_payload(const void* where, uint32_t length, pattern_t pattern,
+                              uint64_t seed);
+
+// Returns the name of the pattern implementation in use
+const char* pattern_impl();
@@ -0,0 +1,114 @@
+//=============================================================================
+// payload_checker.cpp - Verifies the test patterns in received frames
+//
+// Author: D. Wolf
+//=============================================================================
+#include <endian.h>
+#include <arpa/inet.h>
+#include "payload_checker.h"
+#include "frame_parser.h"
+
+
+//=============================================================================
+// CPayloadChecker() - Constructor
+//=============================================================================
+CPayloadChecker::CPayloadChecker()
+{
+    configure(PATTERN_PRBS31);
+}
+//=============================================================================
+
+
+//=============================================================================
+// configure() - Defines the pattern we check for
+//=============================================================================
+void CPayloadChecker::configure(pattern_t pattern, uint64_t udp_seed, uint16_t rdmx_port)
+{
+    m_pattern   = pattern;
+    m_udp_seed  = udp_seed;
+    m_rdmx_port = rdmx_port;
+    reset();
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset() - Resets the counters
+//=============================================================================
+void CPayloadChecker::reset()
+{
+    m_checked          = 0;
+    m_bad              = 0;
+    m_bit_errors       = 0;
+    m_first_bad_frame  = -1;
+    m_first_bad_offset = -1;
+}
+//=============================================================================
+
+
+//=============================================================================
+// check_frame() - Finds the payload of a UDP or RDMX frame and checks it
+//
+// Returns false if this isn't an Ethernet/IPv4/UDP frame
+//=============================================================================
+bool CPayloadChecker::check_frame(const void* frame, uint32_t length, payload_check_t* result)
+{
+    // Find the UDP datagram inside the frame
+    udp_frame_t udp;
+    if (!parse_udp_frame(frame, length, udp)) return false;
+
+    const uint8_t* payload        = udp.payload;
+    uint32_t       payload_length = udp.payload_length;
+    uint64_t       seed           = m_udp_seed;
+
+    // If it's an RDMX frame, the payload follows the RDMX header and is
+    // seeded with the target address
+    if (udp.udp->dst_port == htons(m_rdmx_port) && payload_length >= sizeof(rdmx_hdr_t))
+    {
+        const rdmx_hdr_t& rdmx = *(const rdmx_hdr_t*)payload;
+        if (rdmx.magic == htons(0x0122))
+        {
+            seed            = be64toh(rdmx.target_addr);
+            payload        += sizeof(rdmx_hdr_t);
+            payload_length -= sizeof(rdmx_hdr_t);
+        }
+    }
+
+    payload_check_t check = check_payload(payload, payload_length, m_pattern, seed);
+
+    // Keep track of how it went
+    if (check.bit_errors)
+    {
+        if (m_first_bad_frame < 0)
+        {
+            m_first_bad_frame  = m_checked;
+            m_first_bad_offset = check.first_bad;
+        }
+        m_bit_errors += check.bit_errors;
+        ++m_bad;
+    }
+    ++m_checked;
+
+    if (result) *result = check;
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// check() - Checks a batch of received frames.  Returns the number whose
+//           payload was wrong
+//=============================================================================
+int CPayloadChecker::check(const CRawNIC::rx_frame_t* frames, int count)
+{
+    int bad = 0;
+    payload_check_t result;
+
+    for (int i=0; i<count; ++i)
+    {
+        if (check_frame(frames[i].data, frames[i].length, &result) && result.bit_errors) ++bad;
+    }
+
+    return bad;
+}
+//=============================================================================
@@ -0,0 +1,78 @@
+//=============================================================================
+// payload_checker.h - Verifies the test patterns in received frames
+//
+// Author: D. Wolf
+//
+// This class finds the payload of each Ethernet/IPv4/UDP frame it's given
+// and checks it against the test pattern that fill_payload() would have put
+// there.  RDMX frames (those addressed to the RDMX port that carry the RDMX
+// magic number) are checked with their target address as the seed, since
+// that's what makes each RDMX payload unique.  Plain UDP frames are checked
+// with the seed passed to configure(), so the sender has to fill every UDP
+// payload with that same seed, and UDP frames that arrive out of order or
+// twice look just as correct as the rest.
+//
+// To use this class:
+//
+// (1) declare an instance of "CPayloadChecker"
+//
+// (2) call "configure()" with the pattern the sender is using
+//
+// (3) pass received frames to "check()" or "check_frame()"
+//
+// (4) look at the counters to see how it went
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include "raw_nic.h"
+#include "payload.h"
+
+class CPayloadChecker
+{
+public:
+
+    // Constructor
+    CPayloadChecker();
+
+    // Defines the pattern to check for, the seed of plain UDP payloads, and
+    // the UDP port that RDMX frames are addressed to
+    void        configure(pattern_t pattern, uint64_t udp_seed = 0, uint16_t rdmx_port = 11111);
+
+    // Checks the payload of a single frame.  Returns false if the frame
+    // isn't a UDP frame; otherwise fills in "result" (if it's not nullptr)
+    // and returns true
+    bool        check_frame(const void* frame, uint32_t length,
+                            payload_check_t* result = nullptr);
+
+    // Checks frames returned by CRawNIC::receive_block().  Returns the
+    // number of frames whose payload was wrong
+    int         check(const CRawNIC::rx_frame_t* frames, int count);
+
+    // How many payloads have been checked, how many were wrong, and how
+    // many bits were wrong in total
+    uint64_t    frames_checked() const {return m_checked;}
+    uint64_t    bad_frames()     const {return m_bad;}
+    uint64_t    bit_errors()     const {return m_bit_errors;}
+
+    // Of the first bad payload: its index among the payloads checked, and
+    // the offset within it of the first wrong byte.  Both -1 if none
+    int64_t     first_bad_frame()  const {return m_first_bad_frame;}
+    int64_t     first_bad_offset() const {return m_first_bad_offset;}
+
+    // Resets the counters
+    void        reset();
+
+protected:
+
+    // The pattern, the seed for UDP payloads, and the RDMX port
+    pattern_t   m_pattern;
+    uint64_t    m_udp_seed;
+    uint16_t    m_rdmx_port;
+
+    // Counters
+    uint64_t    m_checked;
+    uint64_t    m_bad;
+    uint64_t    m_bit_errors;
+    int64_t     m_first_bad_frame;
+    int64_t     m_first_bad_offset;
+};
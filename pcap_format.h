@@ -0,0 +1,97 @@
+//=============================================================================
+// pcap_format.h - The on-disk layout of pcap and pcapng capture files
+//
+// Author: D. Wolf
+//
+// Only the parts of the two formats that we write or replay are described
+// here: the classic pcap file and record headers, and the pcapng section
+// header, interface description, enhanced packet and simple packet blocks.
+// Every structure is stored in the byte order of the machine that wrote the
+// file, which the magic number identifies.
+//=============================================================================
+#pragma once
+#include <cstdint>
+
+//-----------------------------------------------------------------------------
+// Classic pcap
+//-----------------------------------------------------------------------------
+enum
+{
+    PCAP_MAGIC_USEC = 0xA1B2C3D4,   // Timestamps in microseconds
+    PCAP_MAGIC_NSEC = 0xA1B23C4D,   // Timestamps in nanoseconds
+    PCAP_LINKTYPE_ETHERNET = 1
+};
+
+struct pcap_file_hdr_t
+{
+    uint32_t    magic;
+    uint16_t    version_major;
+    uint16_t    version_minor;
+    int32_t     thiszone;
+    uint32_t    sigfigs;
+    uint32_t    snaplen;
+    uint32_t    linktype;
+};
+
+struct pcap_record_hdr_t
+{
+    uint32_t    ts_sec;
+    uint32_t    ts_frac;
+    uint32_t    caplen;
+    uint32_t    len;
+};
+
+
+//-----------------------------------------------------------------------------
+// pcapng.  Every block starts with a type and a total length, and ends with
+// the same total length again.  Block bodies are padded to 4 bytes
+//-----------------------------------------------------------------------------
+enum
+{
+    PCAPNG_BLOCK_SHB   = 0x0A0D0D0A,    // Section header
+    PCAPNG_BLOCK_IDB   = 0x00000001,    // Interface description
+    PCAPNG_BLOCK_SPB   = 0x00000003,    // Simple packet
+    PCAPNG_BLOCK_EPB   = 0x00000006,    // Enhanced packet
+    PCAPNG_BYTE_ORDER  = 0x1A2B3C4D,
+    PCAPNG_OPT_END     = 0,
+    PCAPNG_OPT_TSRESOL = 9
+};
+
+struct pcapng_block_hdr_t
+{
+    uint32_t    type;
+    uint32_t    length;
+};
+
+struct pcapng_shb_t
+{
+    pcapng_block_hdr_t hdr;
+    uint32_t    byte_order;
+    uint16_t    version_major;
+    uint16_t    version_minor;
+    int64_t     section_length;
+};
+
+struct pcapng_idb_t
+{
+    pcapng_block_hdr_t hdr;
+    uint16_t    linktype;
+    uint16_t    reserved;
+    uint32_t    snaplen;
+};
+
+struct pcapng_epb_t
+{
+    pcapng_block_hdr_t hdr;
+    uint32_t    interface_id;
+    uint32_t    ts_high;
+    uint32_t    ts_low;
+    uint32_t    caplen;
+    uint32_t    len;
+};
+
+struct pcapng_spb_t
+{
+    pcapng_block_hdr_t hdr;
+    uint32_t    len;
+};
@@ -0,0 +1,526 @@
+//=============================================================================
+// pcap_replay.cpp - Replays a pcap or pcapng capture through a CRawNIC
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pcap_replay.h"
+#include "pcap_format.h"
+
+// The most frames we hand to the kernel at once
+static const int BATCH_SIZE = 64;
+
+// How much of the file we let accumulate behind us before dropping it
+static const size_t RELEASE_CHUNK = 64 << 20;
+
+// If a frame isn't due for at least this long, we sleep instead of spinning
+static const uint64_t SLEEP_THRESHOLD_NS = 200000;
+
+// How early we wake from a sleep, to spin the rest of the way
+static const uint64_t WAKE_EARLY_NS = 100000;
+
+
+//=============================================================================
+// monotonic_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//=============================================================================
+static inline uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// min_block_length() - Returns the smallest a pcapng block of this type can
+//                      be and still hold its fixed fields and trailing length
+//=============================================================================
+static uint32_t min_block_length(uint32_t type)
+{
+    switch (type)
+    {
+        case PCAPNG_BLOCK_SHB: return sizeof(pcapng_shb_t) + 4;
+        case PCAPNG_BLOCK_IDB: return sizeof(pcapng_idb_t) + 4;
+        case PCAPNG_BLOCK_EPB: return sizeof(pcapng_epb_t) + 4;
+        case PCAPNG_BLOCK_SPB: return sizeof(pcapng_spb_t) + 4;
+        default:               return sizeof(pcapng_block_hdr_t) + 4;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// wait_until() - Waits until CLOCK_MONOTONIC reaches "when" and returns the
+//                time.  Long waits sleep; short ones spin
+//=============================================================================
+static uint64_t wait_until(uint64_t when)
+{
+    uint64_t now = monotonic_ns();
+
+    if (now + SLEEP_THRESHOLD_NS < when)
+    {
+        uint64_t wake = when - WAKE_EARLY_NS;
+        timespec ts;
+        ts.tv_sec  = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        now = monotonic_ns();
+    }
+
+    while (now < when) now = monotonic_ns();
+    return now;
+}
+//=============================================================================
+
+
+//=============================================================================
+// CPcapReplay() - Constructor
+//=============================================================================
+CPcapReplay::CPcapReplay()
+{
+    m_map          = nullptr;
+    m_size         = 0;
+    m_offset       = 0;
+    m_first_record = 0;
+    m_released     = 0;
+    m_pcapng       = false;
+    m_swapped      = false;
+    m_ts_scale     = 1000;
+    m_last_ts      = 0;
+    memset(&m_result, 0, sizeof(m_result));
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CPcapReplay() - Destructor
+//=============================================================================
+CPcapReplay::~CPcapReplay()
+{
+    close();
+}
+//=============================================================================
+
+
+//=============================================================================
+// rd16()/rd32() - Read a field of the file in the file's byte order
+//=============================================================================
+uint16_t CPcapReplay::rd16(const void* p) const
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return m_swapped ? __builtin_bswap16(value) : value;
+}
+
+uint32_t CPcapReplay::rd32(const void* p) const
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return m_swapped ? __builtin_bswap32(value) : value;
+}
+//=============================================================================
+
+
+//=============================================================================
+// open() - Maps a capture file into memory and checks its file header
+//=============================================================================
+void CPcapReplay::open(const char* filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(filename);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("fstat");
+        exit(1);
+    }
+    m_size = st.st_size;
+
+    if (m_size < sizeof(pcap_file_hdr_t))
+    {
+        fprintf(stderr, "%s: too short to be a capture file\n", filename);
+        exit(1);
+    }
+
+    // Map the file.  We read it front to back, exactly once
+    m_map = (uint8_t*)mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED)
+    {
+        m_map = nullptr;
+        perror("mmap");
+        exit(1);
+    }
+    madvise(m_map, m_size, MADV_SEQUENTIAL);
+
+    uint32_t magic;
+    memcpy(&magic, m_map, sizeof(magic));
+
+    // Is this a classic pcap file?
+    m_pcapng = false;
+    switch (magic)
+    {
+        case PCAP_MAGIC_USEC:                   m_swapped = false; m_ts_scale = 1000; break;
+        case PCAP_MAGIC_NSEC:                   m_swapped = false; m_ts_scale = 1;    break;
+        case __builtin_bswap32(PCAP_MAGIC_USEC): m_swapped = true;  m_ts_scale = 1000; break;
+        case __builtin_bswap32(PCAP_MAGIC_NSEC): m_swapped = true;  m_ts_scale = 1;    break;
+        case PCAPNG_BLOCK_SHB:                  m_pcapng  = true;                     break;
+        default:
+            fprintf(stderr, "%s: not a pcap or pcapng file\n", filename);
+            exit(1);
+    }
+
+    // A classic pcap file has one link type for every frame
+    if (!m_pcapng)
+    {
+        const pcap_file_hdr_t* hdr = (const pcap_file_hdr_t*)m_map;
+        if (rd32(&hdr->linktype) != PCAP_LINKTYPE_ETHERNET)
+        {
+            fprintf(stderr, "%s: not an Ethernet capture\n", filename);
+            exit(1);
+        }
+        m_first_record = sizeof(pcap_file_hdr_t);
+    }
+
+    // In pcapng, the section header is parsed like any other block
+    else m_first_record = 0;
+
+    rewind();
+}
+//=============================================================================
+
+
+//=============================================================================
+// close() - Unmaps the capture file
+//=============================================================================
+void CPcapReplay::close()
+{
+    if (m_map) munmap(m_map, m_size);
+    m_map  = nullptr;
+    m_size = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// rewind() - Moves the read position back to the first record
+//=============================================================================
+void CPcapReplay::rewind()
+{
+    m_offset   = m_first_record;
+    m_released = 0;
+    m_last_ts  = 0;
+    m_if_units.clear();
+}
+//=============================================================================
+
+
+//=============================================================================
+// next_record() - Finds the next frame in the file
+//
+// Returns false at the end of the file, or if the rest of the file is damaged
+//=============================================================================
+bool CPcapReplay::next_record(record_t& record)
+{
+    if (!m_pcapng)
+    {
+        if (m_offset + sizeof(pcap_record_hdr_t) > m_size) return false;
+
+        const pcap_record_hdr_t* hdr = (const pcap_record_hdr_t*)(m_map + m_offset);
+        record.data   = (const uint8_t*)(hdr + 1);
+        record.caplen = rd32(&hdr->caplen);
+        record.len    = rd32(&hdr->len);
+        record.ts_ns  = rd32(&hdr->ts_sec) * 1000000000ULL + rd32(&hdr->ts_frac) * m_ts_scale;
+
+        m_offset += sizeof(pcap_record_hdr_t) + record.caplen;
+        return m_offset <= m_size;
+    }
+
+    // In pcapng, skip over blocks until we come to a packet
+    while (m_offset + sizeof(pcapng_block_hdr_t) <= m_size)
+    {
+        const uint8_t* block = m_map + m_offset;
+
+        // A section header may change the byte order, so look at it first
+        uint32_t type = rd32(block);
+        if (type == PCAPNG_BLOCK_SHB)
+        {
+            if (m_offset + sizeof(pcapng_shb_t) > m_size) return false;
+            uint32_t byte_order;
+            memcpy(&byte_order, block + sizeof(pcapng_block_hdr_t), sizeof(byte_order));
+            m_swapped = (byte_order != PCAPNG_BYTE_ORDER);
+        }
+
+        // If we can't trust the length of a block, we can't find the next one
+        uint32_t length = rd32(block + 4);
+        if (length < sizeof(pcapng_block_hdr_t) + 4 || m_offset + length > m_size) return false;
+        m_offset += length;
+
+        // A block too short to hold its own fields is skipped
+        if (length < min_block_length(type)) continue;
+
+        if (type == PCAPNG_BLOCK_EPB)
+        {
+            const pcapng_epb_t* epb = (const pcapng_epb_t*)block;
+            uint32_t interface = rd32(&epb->interface_id);
+            uint64_t units = interface < m_if_units.size() ? m_if_units[interface] : 1000000;
+            uint64_t ts    = ((uint64_t)rd32(&epb->ts_high) << 32) | rd32(&epb->ts_low);
+
+            // Skip a packet that claims to be longer than its block
+            record.caplen = rd32(&epb->caplen);
+            if (record.caplen > length - sizeof(pcapng_epb_t) - 4) continue;
+
+            record.data   = (const uint8_t*)(epb + 1);
+            record.len    = rd32(&epb->len);
+            record.ts_ns  = ts / units * 1000000000ULL + ts % units * 1000000000ULL / units;
+            m_last_ts     = record.ts_ns;
+            return true;
+        }
+
+        if (type == PCAPNG_BLOCK_SPB)
+        {
+            const pcapng_spb_t* spb = (const pcapng_spb_t*)block;
+            record.data   = (const uint8_t*)(spb + 1);
+            record.len    = rd32(&spb->len);
+            record.caplen = length - sizeof(pcapng_spb_t) - 4;
+            if (record.caplen > record.len) record.caplen = record.len;
+            record.ts_ns  = m_last_ts;
+            return true;
+        }
+
+        handle_pcapng_block(type, block, length);
+    }
+
+    return false;
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_pcapng_block() - Keeps track of the sections and interfaces that the
+//                         packet blocks refer to
+//=============================================================================
+void CPcapReplay::handle_pcapng_block(uint32_t type, const uint8_t* block, uint32_t length)
+{
+    // A new section starts a new list of interfaces
+    if (type == PCAPNG_BLOCK_SHB)
+    {
+        m_if_units.clear();
+        return;
+    }
+
+    if (type != PCAPNG_BLOCK_IDB) return;
+
+    const pcapng_idb_t* idb = (const pcapng_idb_t*)block;
+    if (rd16(&idb->linktype) != PCAP_LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "pcapng: interface %lu is not Ethernet\n", m_if_units.size());
+        exit(1);
+    }
+
+    // Timestamps are in microseconds unless an option says otherwise
+    uint64_t units = 1000000;
+
+    // Walk the options, looking for the timestamp resolution
+    const uint8_t* option = (const uint8_t*)(idb + 1);
+    const uint8_t* end    = block + length - 4;
+    while (option + 4 <= end)
+    {
+        uint16_t code = rd16(option);
+        uint16_t size = rd16(option + 2);
+        if (code == PCAPNG_OPT_END) break;
+
+        // The resolution is a power of 10, or of 2 if the top bit is set
+        if (code == PCAPNG_OPT_TSRESOL && size >= 1)
+        {
+            uint8_t resol = option[4];
+            units = 1;
+            if (resol & 0x80)
+                units <<= (resol & 0x7F);
+            else
+                for (int i=0; i<resol; ++i) units *= 10;
+        }
+
+        option += 4 + ((size + 3) & ~3);
+    }
+
+    m_if_units.push_back(units);
+}
+//=============================================================================
+
+
+//=============================================================================
+// release_behind() - Drops the pages before "position" from our mapping, a
+//                    chunk at a time.  If they're needed again (on the next
+//                    loop, say) they're simply faulted back in
+//=============================================================================
+void CPcapReplay::release_behind(const uint8_t* position)
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    size_t done = (position - m_map) & ~(page_size - 1);
+    if (done < m_released + RELEASE_CHUNK) return;
+
+    madvise(m_map + m_released, done - m_released, MADV_DONTNEED);
+    m_released = done;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_all() - Hands a batch of frames to the kernel.  A frame the kernel
+//              refuses outright is counted and skipped.  If the kernel stops
+//              taking frames altogether, the rest of the batch is counted as
+//              rejected too
+//=============================================================================
+void CPcapReplay::send_all(CRawNIC& nic, const iovec* frames, int count)
+{
+    while (count)
+    {
+        // CRawNIC waits out a full queue for us, up to its timeout
+        int sent = nic.send_all(frames, 1, count);
+        frames += sent;
+        count  -= sent;
+        if (count == 0) break;
+
+        // If the queue stayed full for the whole timeout, give up on this
+        // batch.  Anything else means the frame at the head of the batch
+        // will never be accepted, so skip it and carry on
+        bool stalled = (errno == EAGAIN || errno == ENOBUFS || errno == EINTR);
+        int  skip    = stalled ? count : 1;
+
+        for (int i=0; i<skip; ++i)
+        {
+            m_result.bytes -= frames[i].iov_len;
+            ++m_result.rejected;
+            --m_result.frames;
+        }
+
+        frames += skip;
+        count  -= skip;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// replay() - Sends every frame in the capture, keeping (a scaled version of)
+//            the original timing between them
+//=============================================================================
+CPcapReplay::result_t CPcapReplay::replay(CRawNIC& nic, double speed, int loops)
+{
+    iovec    batch[BATCH_SIZE];
+    record_t record;
+
+    memset(&m_result, 0, sizeof(m_result));
+    if (m_map == nullptr) return m_result;
+
+    const bool timed = (speed > 0);
+    uint64_t start = monotonic_ns();
+
+    for (int loop=0; loop<loops; ++loop)
+    {
+        rewind();
+        bool have = next_record(record);
+        if (!have) break;
+
+        // Every loop is timed relative to its own first frame
+        uint64_t first_ts   = record.ts_ns;
+        uint64_t loop_start = monotonic_ns();
+        uint64_t last_ts    = first_ts;
+
+        // Returns the moment a frame is due to be sent
+        auto due = [&](const record_t& r)
+        {
+            if (r.ts_ns < first_ts) return loop_start;
+            return loop_start + (uint64_t)((r.ts_ns - first_ts) / speed);
+        };
+
+        while (have)
+        {
+            uint64_t now = 0;
+
+            // Wait until the first frame of this batch is due
+            if (timed)
+            {
+                uint64_t when = due(record);
+                now = wait_until(when);
+                if (now - when > m_result.max_lateness_ns) m_result.max_lateness_ns = now - when;
+            }
+
+            // Gather every frame that's due now, up to a full batch
+            int count = 0;
+            while (have && count < BATCH_SIZE)
+            {
+                if (timed && count && due(record) > now) break;
+
+                if (record.caplen < record.len) ++m_result.truncated;
+
+                if (record.caplen > 0xFFFF)
+                    ++m_result.rejected;
+                else
+                {
+                    batch[count].iov_base = (void*)record.data;
+                    batch[count].iov_len  = record.caplen;
+                    m_result.bytes       += record.caplen;
+                    ++m_result.frames;
+                    ++count;
+                }
+
+                if (record.ts_ns > last_ts) last_ts = record.ts_ns;
+                have = next_record(record);
+            }
+
+            send_all(nic, batch, count);
+
+            // The frames we just sent are done with
+            release_behind(have ? record.data : m_map + m_size);
+        }
+
+        m_result.capture_seconds += (last_ts - first_ts) / 1e9;
+    }
+
+    m_result.seconds = (monotonic_ns() - start) / 1e9;
+    if (m_result.seconds > 0)
+    {
+        m_result.frames_per_sec = m_result.frames / m_result.seconds;
+        m_result.bits_per_sec   = m_result.bytes * 8 / m_result.seconds;
+    }
+
+    return m_result;
+}
+//=============================================================================
+
+
+//=============================================================================
+// report() - Prints the results of the most recent replay
+//=============================================================================
+void CPcapReplay::report(FILE* ofile) const
+{
+    const result_t& r = m_result;
+
+    fprintf(ofile, "replayed %lu frames (%lu bytes) in %.3f s (captured over %.3f s)\n",
+            r.frames, r.bytes, r.seconds, r.capture_seconds);
+    fprintf(ofile, "achieved %.0f frames/s, %.3f Gbps\n",
+            r.frames_per_sec, r.bits_per_sec / 1e9);
+    if (r.max_lateness_ns)
+        fprintf(ofile, "worst lateness %.1f us\n", r.max_lateness_ns / 1e3);
+    if (r.rejected || r.truncated)
+        fprintf(ofile, "%lu frames rejected, %lu sent truncated\n", r.rejected, r.truncated);
+}
+//=============================================================================
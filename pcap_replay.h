@@ -0,0 +1,143 @@
+//=============================================================================
+// pcap_replay.h - Replays a pcap or pcapng capture through a CRawNIC
+//
+// Author: D. Wolf
+//
+// The capture file is memory-mapped, and frames are handed to the kernel in
+// batches straight from the mapped pages; nothing is copied in user space
+// and the file is never read into memory as a whole.  Pages that have been
+// sent are dropped from our mapping as we go, so multi-gigabyte captures
+// stream through a small, steady working set.
+//
+// Frames leave with the spacing they had in the capture, divided by the
+// "speed" passed to replay(): 1.0 reproduces the original timing, 2.0 plays
+// the capture twice as fast, and 0 sends every frame as fast as possible.
+// Frames that are due at the same moment (or that we've fallen behind on)
+// go out together in a single batch.
+//
+// Both classic pcap (micro- or nanosecond timestamps, either byte order) and
+// pcapng (enhanced and simple packet blocks) are understood.  Only Ethernet
+// captures can be replayed.
+//
+// To use this class:
+//
+// (1) declare an instance of "CPcapReplay"
+//
+// (2) call "open()" with the name of the capture file
+//
+// (3) call "replay()" with a connected CRawNIC and the speed
+//
+// (4) call "report()" to see the rate that was achieved
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "raw_nic.h"
+
+class CPcapReplay
+{
+public:
+
+    // The results of a replay
+    struct result_t
+    {
+        // The number of frames and bytes sent
+        uint64_t    frames;
+        uint64_t    bytes;
+
+        // Frames the kernel refused (too large for the MTU, say), and frames
+        // whose capture had been cut short by a snap length (these are sent
+        // as captured)
+        uint64_t    rejected;
+        uint64_t    truncated;
+
+        // How long the replay took, and how long the capture took originally
+        double      seconds;
+        double      capture_seconds;
+
+        // The achieved rates
+        double      frames_per_sec;
+        double      bits_per_sec;
+
+        // How far behind schedule the latest batch went out, in nanoseconds
+        uint64_t    max_lateness_ns;
+    };
+
+    // Constructor and destructor
+    CPcapReplay();
+    ~CPcapReplay();
+
+    // Maps a capture file and checks its file header
+    void        open(const char* filename);
+
+    // Unmaps the capture file
+    void        close();
+
+    // Sends every frame in the capture through "nic", "loops" times over.
+    // "speed" scales the original timing (0 = as fast as possible).  Returns
+    // the results, which are also kept for report()
+    result_t    replay(CRawNIC& nic, double speed = 1.0, int loops = 1);
+
+    // Returns the results of the most recent replay
+    const result_t& result() const {return m_result;}
+
+    // Prints the results of the most recent replay
+    void        report(FILE* ofile = stdout) const;
+
+protected:
+
+    // Describes the next frame in the file
+    struct record_t
+    {
+        const uint8_t* data;
+        uint32_t    caplen;
+        uint32_t    len;
+        uint64_t    ts_ns;
+    };
+
+    // Resets the read position to the first record
+    void        rewind();
+
+    // Fills in "record" with the next frame.  Returns false at end of file
+    bool        next_record(record_t& record);
+
+    // Parses a pcapng block that isn't a packet block
+    void        handle_pcapng_block(uint32_t type, const uint8_t* body, uint32_t length);
+
+    // Reads a 16 or 32-bit field of the file, in the file's byte order
+    uint16_t    rd16(const void* p) const;
+    uint32_t    rd32(const void* p) const;
+
+    // Hands a batch of frames to the kernel, retrying until every frame has
+    // either been accepted or refused, or the kernel has stopped taking them
+    void        send_all(CRawNIC& nic, const iovec* frames, int count);
+
+    // Drops the pages we've finished with from our mapping
+    void        release_behind(const uint8_t* position);
+
+    // The mapped file, its size, and our read position
+    uint8_t*    m_map;
+    size_t      m_size;
+    size_t      m_offset;
+
+    // Where the records start, and how much of the file we've released
+    size_t      m_first_record;
+    size_t      m_released;
+
+    // True if the file is pcapng, and true if it's in the other byte order
+    bool        m_pcapng;
+    bool        m_swapped;
+
+    // For pcap, the number of nanoseconds per timestamp unit.  For pcapng,
+    // the timestamp resolution of each interface, in units per second
+    uint64_t    m_ts_scale;
+    std::vector<uint64_t> m_if_units;
+
+    // In pcapng, simple packet blocks have no timestamp; we give them the
+    // timestamp of the frame before them
+    uint64_t    m_last_ts;
+
+    // The results of the most recent replay
+    result_t    m_result;
+};
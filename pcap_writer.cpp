@@ -0,0 +1,245 @@
+//=============================================================================
+// pcap_writer.cpp - Streams received frames to a pcap or pcapng file
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pcap_writer.h"
+#include "pcap_format.h"
+
+// pcapng block bodies are padded to a multiple of this many bytes
+static const uint32_t PCAPNG_ALIGN = 4;
+
+
+//=============================================================================
+// CPcapWriter() - Constructor
+//=============================================================================
+CPcapWriter::CPcapWriter()
+{
+    m_fd      = -1;
+    m_format  = PCAP;
+    m_snaplen = 65535;
+    m_used    = 0;
+    m_frames  = 0;
+    m_bytes   = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CPcapWriter() - Destructor
+//=============================================================================
+CPcapWriter::~CPcapWriter()
+{
+    close();
+}
+//=============================================================================
+
+
+//=============================================================================
+// open() - Creates the capture file and writes its file header
+//=============================================================================
+void CPcapWriter::open(const char* filename, format_t format, uint32_t snaplen,
+                       uint32_t buffer_size)
+{
+    // With no buffer, append() could never make room for a record
+    if (buffer_size == 0)
+    {
+        fprintf(stderr, "CPcapWriter::open(): buffer_size must be greater than zero\n");
+        exit(1);
+    }
+
+    // If we already have a file open, finish it off
+    close();
+
+    m_fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+    {
+        perror(filename);
+        exit(1);
+    }
+
+    m_format  = format;
+    m_snaplen = snaplen;
+    m_buffer.resize(buffer_size);
+    m_used    = 0;
+    m_frames  = 0;
+    m_bytes   = 0;
+
+    if (format == PCAP)
+    {
+        pcap_file_hdr_t hdr;
+        hdr.magic         = PCAP_MAGIC_NSEC;
+        hdr.version_major = 2;
+        hdr.version_minor = 4;
+        hdr.thiszone      = 0;
+        hdr.sigfigs       = 0;
+        hdr.snaplen       = snaplen;
+        hdr.linktype      = PCAP_LINKTYPE_ETHERNET;
+        append(&hdr, sizeof(hdr));
+        return;
+    }
+
+    // A pcapng file starts with a section header...
+    pcapng_shb_t shb;
+    uint32_t shb_length = sizeof(shb) + sizeof(uint32_t);
+    shb.hdr.type       = PCAPNG_BLOCK_SHB;
+    shb.hdr.length     = shb_length;
+    shb.byte_order     = PCAPNG_BYTE_ORDER;
+    shb.version_major  = 1;
+    shb.version_minor  = 0;
+    shb.section_length = -1;
+    append(&shb, sizeof(shb));
+    append(&shb_length, sizeof(shb_length));
+
+    // ...followed by a description of the (one) interface that the frames
+    // were captured on, whose timestamps are in nanoseconds
+    struct
+    {
+        uint16_t code;
+        uint16_t length;
+        uint8_t  value[4];
+        uint32_t end;
+    } options = {PCAPNG_OPT_TSRESOL, 1, {9, 0, 0, 0}, PCAPNG_OPT_END};
+
+    pcapng_idb_t idb;
+    uint32_t idb_length = sizeof(idb) + sizeof(options) + sizeof(uint32_t);
+    idb.hdr.type   = PCAPNG_BLOCK_IDB;
+    idb.hdr.length = idb_length;
+    idb.linktype   = PCAP_LINKTYPE_ETHERNET;
+    idb.reserved   = 0;
+    idb.snaplen    = snaplen;
+    append(&idb, sizeof(idb));
+    append(&options, sizeof(options));
+    append(&idb_length, sizeof(idb_length));
+}
+//=============================================================================
+
+
+//=============================================================================
+// write() - Writes a single frame to the capture file
+//=============================================================================
+void CPcapWriter::write(const void* frame, uint32_t length, uint32_t sec, uint32_t nsec,
+                        uint32_t wire_length)
+{
+    if (wire_length < length) wire_length = length;
+    if (length > m_snaplen) length = m_snaplen;
+
+    if (m_format == PCAP)
+    {
+        pcap_record_hdr_t hdr;
+        hdr.ts_sec  = sec;
+        hdr.ts_frac = nsec;
+        hdr.caplen  = length;
+        hdr.len     = wire_length;
+        append(&hdr, sizeof(hdr));
+        append(frame, length);
+    }
+
+    else
+    {
+        static const uint8_t zeros[PCAPNG_ALIGN] = {0};
+        uint32_t padding = (PCAPNG_ALIGN - length % PCAPNG_ALIGN) % PCAPNG_ALIGN;
+        uint64_t ts      = sec * 1000000000ULL + nsec;
+
+        pcapng_epb_t epb;
+        uint32_t epb_length = sizeof(epb) + length + padding + sizeof(uint32_t);
+        epb.hdr.type     = PCAPNG_BLOCK_EPB;
+        epb.hdr.length   = epb_length;
+        epb.interface_id = 0;
+        epb.ts_high      = ts >> 32;
+        epb.ts_low       = (uint32_t)ts;
+        epb.caplen       = length;
+        epb.len          = wire_length;
+        append(&epb, sizeof(epb));
+        append(frame, length);
+        append(zeros, padding);
+        append(&epb_length, sizeof(epb_length));
+    }
+
+    ++m_frames;
+}
+//=============================================================================
+
+
+//=============================================================================
+// write() - Writes a batch of received frames to the capture file
+//=============================================================================
+void CPcapWriter::write(const CRawNIC::rx_frame_t* frames, int count)
+{
+    for (int i=0; i<count; ++i)
+    {
+        const CRawNIC::rx_frame_t& f = frames[i];
+        write(f.data, f.length, f.sec, f.nsec, f.wire_length);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// append() - Appends data to the buffer, writing the buffer to the file
+//            whenever it fills up
+//=============================================================================
+void CPcapWriter::append(const void* data, uint32_t length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (length)
+    {
+        if (m_used == m_buffer.size()) flush();
+
+        uint32_t chunk = m_buffer.size() - m_used;
+        if (chunk > length) chunk = length;
+
+        memcpy(m_buffer.data() + m_used, p, chunk);
+        m_used += chunk;
+        p      += chunk;
+        length -= chunk;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// flush() - Writes the buffered records to the file
+//=============================================================================
+void CPcapWriter::flush()
+{
+    const uint8_t* p = m_buffer.data();
+    uint32_t remaining = m_used;
+
+    while (remaining)
+    {
+        ssize_t rc = ::write(m_fd, p, remaining);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0)
+        {
+            perror("pcap write");
+            exit(1);
+        }
+        p         += rc;
+        remaining -= rc;
+        m_bytes   += rc;
+    }
+
+    m_used = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// close() - Flushes the buffer and closes the file
+//=============================================================================
+void CPcapWriter::close()
+{
+    if (m_fd < 0) return;
+    flush();
+    ::close(m_fd);
+    m_fd = -1;
+}
+//=============================================================================
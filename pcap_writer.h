@@ -0,0 +1,87 @@
+//=============================================================================
+// pcap_writer.h - Streams received frames to a pcap or pcapng file
+//
+// Author: D. Wolf
+//
+// Records are gathered into a large buffer and written out with one system
+// call per buffer-full, so that capturing from the RX ring costs little more
+// than a memcpy() per frame.  Nothing but the buffer is held in memory, so a
+// capture can grow as large as the disk allows.
+//
+// Timestamps are written with nanosecond resolution in either format.
+//
+// To use this class:
+//
+// (1) declare an instance of "CPcapWriter"
+//
+// (2) call "open()" with the name of the file and the format to write
+//
+// (3) call "write()" for each frame, or for each batch of frames returned by
+//     CRawNIC::receive_block()
+//
+// (4) call "close()" (or let the destructor do it) to flush the buffer
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "raw_nic.h"
+
+class CPcapWriter
+{
+public:
+
+    // The file formats we can write
+    enum format_t
+    {
+        PCAP,
+        PCAPNG
+    };
+
+    // Constructor and destructor
+    CPcapWriter();
+    ~CPcapWriter();
+
+    // Creates (or truncates) a capture file.  Frames longer than "snaplen"
+    // are cut short.  "buffer_size" is how much we gather before writing,
+    // and can't be zero
+    void        open(const char* filename, format_t format = PCAP,
+                     uint32_t snaplen = 65535, uint32_t buffer_size = 4 << 20);
+
+    // Writes a single frame with the specified timestamp.  "wire_length" is
+    // the frame's original length, if "length" bytes is only part of it
+    void        write(const void* frame, uint32_t length, uint32_t sec, uint32_t nsec,
+                      uint32_t wire_length = 0);
+
+    // Writes frames returned by CRawNIC::receive_block()
+    void        write(const CRawNIC::rx_frame_t* frames, int count);
+
+    // Writes any buffered records to the file
+    void        flush();
+
+    // Flushes the buffer and closes the file
+    void        close();
+
+    // How many frames and file bytes have been written since open()
+    uint64_t    frames() const {return m_frames;}
+    uint64_t    bytes()  const {return m_bytes;}
+
+protected:
+
+    // Appends "length" bytes to the buffer, flushing it first if need be
+    void        append(const void* data, uint32_t length);
+
+    // The file descriptor, or -1 if no file is open
+    int         m_fd;
+
+    // The format we're writing and the snap length
+    format_t    m_format;
+    uint32_t    m_snaplen;
+
+    // Records waiting to be written, and how many bytes of it are in use
+    std::vector<uint8_t> m_buffer;
+    uint32_t    m_used;
+
+    // Statistics
+    uint64_t    m_frames;
+    uint64_t    m_bytes;
+};
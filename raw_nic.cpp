@@ -6,13 +6,40 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
 #include <sys/ioctl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <net/if.h>
+#include <net/ethernet.h>
 #include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+
+// Older C library headers don't define these
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
 #include "raw_nic.h"
 
+
+//=============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//=============================================================================
+static inline uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
 //=============================================================================
 // dump() - Hex-dump a memory region
 //=============================================================================
@@ -41,12 +68,67 @@ static void dump(void* data, int length)
 //=============================================================================
 
 
+//=============================================================================
+// CRawNIC() - Default constructor
+//=============================================================================
+CRawNIC::CRawNIC()
+{
+    m_sd             = -1;
+    m_if_idx         = 0;
+    m_tx_ring_sd     = -1;
+    m_tx_ring        = nullptr;
+    m_tx_ring_size        = 0;
+    m_tx_block_size       = 0;
+    m_tx_frame_size       = 0;
+    m_tx_frames_per_block = 0;
+    m_tx_frame_count      = 0;
+    m_tx_head             = 0;
+    m_tx_committed        = 0;
+    m_send_timing         = false;
+    m_rx_sd               = -1;
+    m_rx_ring             = nullptr;
+    m_rx_ring_size        = 0;
+    m_rx_block_size       = 0;
+    m_rx_block_count      = 0;
+    m_rx_block            = 0;
+    m_rx_held             = false;
+    m_rx_next             = nullptr;
+    m_rx_remaining        = 0;
+    m_numa_node           = -1;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CRawNIC() - Destructor.  Unmaps the rings and closes the sockets
+//=============================================================================
+CRawNIC::~CRawNIC()
+{
+    if (m_tx_ring) munmap(m_tx_ring, m_tx_ring_size);
+    if (m_rx_ring) munmap(m_rx_ring, m_rx_ring_size);
+    if (m_sd >= 0) close(m_sd);
+    if (m_tx_ring_sd >= 0) close(m_tx_ring_sd);
+    if (m_rx_sd >= 0) close(m_rx_sd);
+}
+//=============================================================================
+
+
 //=============================================================================
 // connect_nic() - Opens the raw socket and fetches the index of the specific
-//                 network interface
+//                 network interface, then applies the tuning profile
 //=============================================================================
-void CRawNIC::connect_nic(const char* nic_name)
+void CRawNIC::connect_nic(const char* nic_name, const nic_profile_t& profile)
 {
+    // Keep the profile around; the rings are tuned when they're created
+    m_profile = profile;
+
+    // Pin ourselves first, so that everything below is set up by the CPU
+    // that's going to use it
+    if (profile.cpu >= 0) pin_thread(profile.cpu);
+
+    // Find out which NUMA node the rings belong on
+    if (profile.numa_local) m_numa_node = nic_numa_node(nic_name);
+
     // Open raw socket to send on
     m_sd = socket(AF_PACKET, SOCK_RAW, IPPROTO_RAW);
 
@@ -74,29 +156,63 @@ void CRawNIC::connect_nic(const char* nic_name)
 
     // And save the index of the user-specified network interface
     m_if_idx = if_data.ifr_ifindex;
+
+    // Build the destination socket-address that every send will use.  For
+    // a SOCK_RAW packet socket, the destination MAC is taken from the frame
+    // itself, so the address only needs to identify the interface
+    memset(&m_dest, 0, sizeof(m_dest));
+    m_dest.sll_family  = AF_PACKET;
+    m_dest.sll_ifindex = m_if_idx;
+    m_dest.sll_halen   = 6;
+    memset(m_dest.sll_addr, 0xFF, 6);
+
+    // Apply the transmit-side settings of the profile
+    tune_tx_socket(m_sd);
 }
 //=============================================================================
 
 
 //=============================================================================
-// send() - Transmits a raw ethernet frame over the network interface
+// connect_rx() - Fetches the index of the network interface and applies the
+//                tuning profile, without opening a socket to send on
 //=============================================================================
-void CRawNIC::send(const void* frame, uint16_t frame_length)
+void CRawNIC::connect_rx(const char* nic_name, const nic_profile_t& profile)
 {
-    struct sockaddr_ll socket_address;
+    // Keep the profile around; the RX ring is tuned when it's created
+    m_profile = profile;
 
-    // Fill in the interface index of the socket address
-    socket_address.sll_ifindex = m_if_idx;
+    // Pin ourselves first, so that the ring is set up by the CPU that's
+    // going to use it
+    if (profile.cpu >= 0) pin_thread(profile.cpu);
 
-    // Fill in the length of the destination MAC
-    socket_address.sll_halen = 6;
+    // Find out which NUMA node the ring belongs on
+    if (profile.numa_local) m_numa_node = nic_numa_node(nic_name);
 
-    // Fill in the destination MAC
-    memcpy(socket_address.sll_addr, frame, 6);
+    // Save the index of the user-specified network interface
+    m_if_idx = if_nametoindex(nic_name);
+    if (m_if_idx == 0)
+    {
+        perror(nic_name);
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send() - Transmits a raw ethernet frame over the network interface
+//=============================================================================
+void CRawNIC::send(const void* frame, uint16_t frame_length)
+{
+    uint64_t start = m_send_timing ? now_ns() : 0;
 
     // Send the packet to the network interface
-    int rc = sendto(m_sd, frame, frame_length, 0, (sockaddr*)&socket_address,
-                                                   sizeof(socket_address));
+    int rc = sendto(m_sd, frame, frame_length, 0, (sockaddr*)&m_dest,
+                                                   sizeof(m_dest));
+
+    // Keep track of how it went
+    record_send(start, rc, 1, rc, rc < frame_length);
+
     if (rc < 1)
     {
         printf("sendto failed\n");        
@@ -104,3 +220,790 @@ void CRawNIC::send(const void* frame, uint16_t frame_length)
     }
 }
 //=============================================================================
+
+
+//=============================================================================
+// send_batch() - Transmits a batch of raw ethernet frames over the network
+//                interface via sendmmsg().
+//
+// Returns the number of frames that were handed to the kernel.  This will be
+// less than "count" if the socket's send buffer fills up or an error occurs
+//=============================================================================
+int CRawNIC::send_batch(const frame_t* frames, int count)
+{
+    // This is the maximum number of frames we'll hand to a single sendmmsg()
+    const int CHUNK = 64;
+
+    mmsghdr msg[CHUNK];
+    iovec   iov[CHUNK];
+    int     total_sent = 0;
+
+    while (total_sent < count)
+    {
+        // How many frames will we send in this chunk?
+        int chunk = count - total_sent;
+        if (chunk > CHUNK) chunk = CHUNK;
+
+        // Build a message header for each frame in this chunk
+        for (int i=0; i<chunk; ++i)
+        {
+            const frame_t& frame = frames[total_sent + i];
+            iov[i].iov_base = (void*)frame.data;
+            iov[i].iov_len  = frame.length;
+            memset(&msg[i], 0, sizeof(msg[i]));
+            msg[i].msg_hdr.msg_name    = &m_dest;
+            msg[i].msg_hdr.msg_namelen = sizeof(m_dest);
+            msg[i].msg_hdr.msg_iov     = &iov[i];
+            msg[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        // Hand this chunk of frames to the kernel
+        int rc = send_mmsg(msg, chunk);
+
+        // If nothing was sent, tell the caller how far we got
+        if (rc < 0) break;
+
+        // Keep track of how many frames we've sent
+        total_sent += rc;
+
+        // If the kernel didn't accept the entire chunk, we're done
+        if (rc < chunk) break;
+    }
+
+    // Tell the caller how many frames were sent
+    return total_sent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_batch() - Transmits a batch of raw ethernet frames, each of which is
+//                gathered from several pieces of memory, via sendmmsg()
+//
+// Returns the number of frames that were handed to the kernel
+//=============================================================================
+int CRawNIC::send_batch(const iovec* iov, int iov_per_frame, int count)
+{
+    // This is the maximum number of frames we'll hand to a single sendmmsg()
+    const int CHUNK = 64;
+
+    mmsghdr msg[CHUNK];
+    int     total_sent = 0;
+
+    while (total_sent < count)
+    {
+        // How many frames will we send in this chunk?
+        int chunk = count - total_sent;
+        if (chunk > CHUNK) chunk = CHUNK;
+
+        // Build a message header for each frame in this chunk
+        for (int i=0; i<chunk; ++i)
+        {
+            memset(&msg[i], 0, sizeof(msg[i]));
+            msg[i].msg_hdr.msg_name    = &m_dest;
+            msg[i].msg_hdr.msg_namelen = sizeof(m_dest);
+            msg[i].msg_hdr.msg_iov     = (iovec*)iov + (size_t)(total_sent + i) * iov_per_frame;
+            msg[i].msg_hdr.msg_iovlen  = iov_per_frame;
+        }
+
+        // Hand this chunk of frames to the kernel
+        int rc = send_mmsg(msg, chunk);
+
+        // If nothing was sent, tell the caller how far we got
+        if (rc < 0) break;
+
+        // Keep track of how many frames we've sent
+        total_sent += rc;
+
+        // If the kernel didn't accept the entire chunk, we're done
+        if (rc < chunk) break;
+    }
+
+    // Tell the caller how many frames were sent
+    return total_sent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_all() - Transmits every frame in a scatter-gather batch, backing off
+//              while the kernel is temporarily out of room
+//
+// Returns the number of frames the kernel accepted
+//=============================================================================
+int CRawNIC::send_all(const iovec* iov, int iov_per_frame, int count, int timeout_ms)
+{
+    int      total_sent = 0;
+    uint64_t stalled_since = 0;
+
+    while (total_sent < count)
+    {
+        int rc = send_batch(iov + (size_t)total_sent * iov_per_frame, iov_per_frame,
+                            count - total_sent);
+
+        // Any progress at all means we aren't stalled
+        if (rc > 0)
+        {
+            total_sent   += rc;
+            stalled_since = 0;
+            continue;
+        }
+
+        // The kernel took nothing.  Anything but a full queue is fatal
+        if (errno != EAGAIN && errno != ENOBUFS && errno != EINTR) break;
+
+        // Give up if it's been full for too long
+        uint64_t now = now_ns();
+        if (stalled_since == 0) stalled_since = now;
+        if (now - stalled_since >= timeout_ms * 1000000ULL) break;
+
+        // Wait for room in the socket buffer.  A full qdisc doesn't wake
+        // poll(), so if the socket already looks writable, just let the
+        // driver have the CPU for a moment
+        pollfd pfd = {m_sd, POLLOUT, 0};
+        if (poll(&pfd, 1, 1) > 0) sched_yield();
+    }
+
+    return total_sent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_mmsg() - Hands a set of messages to the kernel with sendmmsg(), and 
+//               keeps track of how it went.  Returns the number of messages
+//               sent, or -1 on error
+//=============================================================================
+int CRawNIC::send_mmsg(mmsghdr* msg, int count)
+{
+    uint64_t start = m_send_timing ? now_ns() : 0;
+
+    int rc = sendmmsg(m_sd, msg, count, 0);
+
+    // Count the bytes in the messages that were sent
+    uint64_t bytes = 0;
+    for (int i=0; i<rc; ++i) bytes += msg[i].msg_len;
+
+    // Keep track of how it went
+    record_send(start, rc, rc, bytes, rc < count);
+
+    // Report anything other than a full socket buffer
+    if (rc < 0 && errno != EAGAIN && errno != ENOBUFS && errno != EINTR)
+    {
+        perror("sendmmsg");
+    }
+
+    return rc;
+}
+//=============================================================================
+
+
+//=============================================================================
+// record_send() - Updates the transmit statistics after a send call
+//
+// Passed: start  = time the call began (0 if we're not timing send calls)
+//         rc     = what the call returned (-1 = error)
+//         frames = the number of frames the call sent
+//         bytes  = the number of bytes the call sent
+//         short_write = true if fewer frames or bytes were sent than asked
+//=============================================================================
+void CRawNIC::record_send(uint64_t start, int rc, uint64_t frames, uint64_t bytes,
+                          bool short_write)
+{
+    // Capture errno before anything else can change it
+    int error = errno;
+
+    if (start) m_stats.record_latency(now_ns() - start);
+
+    if (rc < 0) 
+        m_stats.record_error(error);
+    else
+        m_stats.record_sent(frames, bytes, short_write);
+
+    errno = error;
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable_send_timing() - Turns timing of send calls on or off
+//=============================================================================
+void CRawNIC::enable_send_timing(bool enable)
+{
+    m_send_timing = enable;
+}
+//=============================================================================
+//=============================================================================
+
+
+//=============================================================================
+// enable_txtime() - Turns on SO_TXTIME for our socket, so that each frame can
+//                   carry a launch time
+//=============================================================================
+void CRawNIC::enable_txtime(clockid_t clock_id)
+{
+    sock_txtime config;
+    config.clockid = clock_id;
+    config.flags   = SOF_TXTIME_REPORT_ERRORS;
+
+    if (setsockopt(m_sd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) < 0)
+    {
+        perror("SO_TXTIME");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_at() - Transmits a raw ethernet frame with a launch time attached
+//=============================================================================
+void CRawNIC::send_at(const void* frame, uint16_t frame_length, uint64_t txtime)
+{
+    // Room for a single control message that holds the launch time
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+    memset(control, 0, sizeof(control));
+
+    iovec iov;
+    iov.iov_base = (void*)frame;
+    iov.iov_len  = frame_length;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name       = &m_dest;
+    msg.msg_namelen    = sizeof(m_dest);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    // Attach the launch time to the message
+    cmsghdr* cmsg   = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_TXTIME;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+
+    uint64_t start = m_send_timing ? now_ns() : 0;
+
+    // Send the packet to the network interface
+    int rc = sendmsg(m_sd, &msg, 0);
+
+    // Keep track of how it went
+    record_send(start, rc, 1, rc, rc < frame_length);
+
+    if (rc < 1)
+    {
+        printf("sendmsg failed\n");        
+        perror("sendmsg:");      
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable_vnet_hdr() - Tells the kernel that every frame we send will begin
+//                     with a virtio_net_hdr
+//=============================================================================
+void CRawNIC::enable_vnet_hdr()
+{
+    int enable = 1;
+    if (setsockopt(m_sd, SOL_PACKET, PACKET_VNET_HDR, &enable, sizeof(enable)) < 0)
+    {
+        perror("PACKET_VNET_HDR");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable_tx_ring() - Creates a memory-mapped TPACKET_V2 transmit ring
+//
+// Each slot in the ring begins with a tpacket2_hdr that the kernel uses to
+// track the state of the slot.  The frame data itself lives at a fixed
+// offset from the beginning of the slot.
+//
+// The ring lives on a socket of its own.  A send on a socket with a TX ring
+// only flushes the ring, so if the ring shared m_sd, send() and send_batch()
+// would quietly stop sending the frames they're given
+//=============================================================================
+void CRawNIC::enable_tx_ring(uint32_t frame_size, uint32_t frame_count)
+{
+    // Open the socket the ring belongs to, set up just like m_sd
+    m_tx_ring_sd = socket(AF_PACKET, SOCK_RAW, IPPROTO_RAW);
+    if (m_tx_ring_sd == -1)
+    {
+        perror("socket");
+        exit(1);
+    }
+    tune_tx_socket(m_tx_ring_sd);
+
+    // The kernel requires slot sizes to be a multiple of TPACKET_ALIGNMENT,
+    // and each slot must have room for the tpacket header
+    frame_size = TPACKET_ALIGN(frame_size + TPACKET2_HDRLEN);
+
+    // A ring is made of blocks; each block is a power-of-two number of pages
+    // that holds a whole number of slots
+    uint32_t block_size = getpagesize();
+    while (block_size < frame_size || block_size < 65536) block_size <<= 1;
+
+    // Round the number of slots up to a whole number of blocks
+    uint32_t frames_per_block = block_size / frame_size;
+    uint32_t block_count = (frame_count + frames_per_block - 1) / frames_per_block;
+
+    // We use the TPACKET_V2 slot format
+    int version = TPACKET_V2;
+    if (setsockopt(m_tx_ring_sd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("PACKET_VERSION");
+        exit(1);
+    }
+
+    // The ring's memory is allocated by the kernel when it's created
+    CNumaScope numa_scope(m_numa_node);
+
+    // Ask the kernel to create the TX ring
+    tpacket_req req;
+    req.tp_block_size = block_size;
+    req.tp_block_nr   = block_count;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr   = block_count * frames_per_block;
+    if (setsockopt(m_tx_ring_sd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("PACKET_TX_RING");
+        exit(1);
+    }
+
+    // Map the TX ring into our address space
+    m_tx_ring_size = (size_t)block_size * block_count;
+    void* ring = mmap(nullptr, m_tx_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, m_tx_ring_sd, 0);
+    if (ring == MAP_FAILED)
+    {
+        perror("mmap TX ring");
+        exit(1);
+    }
+
+    // Save the geometry of the ring
+    m_tx_ring             = (uint8_t*)ring;
+    m_tx_block_size       = block_size;
+    m_tx_frame_size       = frame_size;
+    m_tx_frames_per_block = frames_per_block;
+    m_tx_frame_count      = req.tp_frame_nr;
+    m_tx_head             = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// tx_slot_hdr() - Returns a pointer to the tpacket header at the start of the
+//                 specified TX-ring slot.  Slots never straddle a block, so
+//                 any space at the end of a block is skipped over
+//=============================================================================
+tpacket2_hdr* CRawNIC::tx_slot_hdr(uint32_t index)
+{
+    uint32_t block = index / m_tx_frames_per_block;
+    uint32_t frame = index % m_tx_frames_per_block;
+    return (tpacket2_hdr*)(m_tx_ring + (size_t)block * m_tx_block_size 
+                                     + (size_t)frame * m_tx_frame_size);
+}
+//=============================================================================
+
+
+//=============================================================================
+// get_tx_slot() - Returns a pointer to the frame area of the next free slot
+//                 in the TX ring, or nullptr if the ring is full
+//=============================================================================
+uint8_t* CRawNIC::get_tx_slot()
+{
+    // Find the header of the slot at the head of the ring
+    tpacket2_hdr* hdr = tx_slot_hdr(m_tx_head);
+
+    // If the kernel hasn't finished with this slot, the ring is full
+    uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+    {
+        return nullptr;
+    }
+
+    // The frame data begins right after the tpacket header
+    return (uint8_t*)hdr + TPACKET2_HDRLEN - sizeof(sockaddr_ll);
+}
+//=============================================================================
+
+
+//=============================================================================
+// commit_tx_slot() - Hands the slot at the head of the TX ring to the kernel
+//                    and advances to the next slot
+//=============================================================================
+void CRawNIC::commit_tx_slot(uint16_t frame_length)
+{
+    // Find the header of the slot at the head of the ring
+    tpacket2_hdr* hdr = tx_slot_hdr(m_tx_head);
+
+    // Tell the kernel how long the frame is and that it's ready to send
+    hdr->tp_len = frame_length;
+    ++m_tx_committed;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    // Advance to the next slot in the ring
+    if (++m_tx_head == m_tx_frame_count) m_tx_head = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// flush_tx_ring() - Asks the kernel to transmit every slot that has been
+//                   committed.  Returns the number of bytes sent, or -1 on
+//                   error
+//=============================================================================
+int CRawNIC::flush_tx_ring(bool wait)
+{
+    int flags = wait ? 0 : MSG_DONTWAIT;
+    uint64_t start = m_send_timing ? now_ns() : 0;
+
+    // A zero-length send is the signal to the kernel to walk the TX ring
+    int rc = sendto(m_tx_ring_sd, nullptr, 0, flags, (sockaddr*)&m_dest, sizeof(m_dest));
+
+    // Keep track of how it went.  The frames committed since the last flush
+    // are counted as sent once the kernel has been told about them
+    record_send(start, rc, m_tx_committed, rc, false);
+    if (rc >= 0) m_tx_committed = 0;
+
+    // EAGAIN/ENOBUFS just mean the kernel will have to be kicked again later
+    if (rc < 0 && errno != EAGAIN && errno != ENOBUFS && errno != EINTR)
+    {
+        perror("flush_tx_ring");
+    }
+
+    return rc;
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable_rx_ring() - Opens a receive socket bound to our network interface
+//                    and creates a memory-mapped TPACKET_V3 receive ring
+//
+// With TPACKET_V3, the kernel packs variable-length frames back-to-back into
+// large blocks and hands us an entire block at a time
+//=============================================================================
+void CRawNIC::enable_rx_ring(uint32_t block_size, uint32_t block_count,
+                             uint32_t timeout_ms)
+{
+    // Open a raw socket.  With a protocol of zero, it receives nothing until
+    // it's bound: otherwise frames from every interface could land in the
+    // ring before bind() restricts it to ours
+    m_rx_sd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (m_rx_sd == -1)
+    {
+        perror("socket");
+        exit(1);
+    }
+
+    // If there's a receive filter, attach it before anything can be queued
+    if (!m_rx_filter.empty()) attach_rx_filter();
+
+    // We're only interested in frames arriving at the interface, not copies
+    // of the frames that are being transmitted from it.  Older kernels don't
+    // support this, and that's fine
+    int one = 1;
+    setsockopt(m_rx_sd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    // Size the receive buffer and turn on busy polling
+    tune_rx_socket();
+
+    // We use the TPACKET_V3 block format
+    int version = TPACKET_V3;
+    if (setsockopt(m_rx_sd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("PACKET_VERSION");
+        exit(1);
+    }
+
+    // The block size must be a power-of-two multiple of the page size
+    uint32_t min_block_size = getpagesize();
+    while (min_block_size < block_size) min_block_size <<= 1;
+    block_size = min_block_size;
+
+    // The ring's memory is allocated by the kernel when it's created
+    CNumaScope numa_scope(m_numa_node);
+
+    // Ask the kernel to create the RX ring.  With TPACKET_V3 the frame size
+    // is only used for validation; frames are packed into blocks as they come
+    tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size       = block_size;
+    req.tp_block_nr         = block_count;
+    req.tp_frame_size       = 2048;
+    req.tp_frame_nr         = (block_size / req.tp_frame_size) * block_count;
+    req.tp_retire_blk_tov   = timeout_ms;
+    req.tp_feature_req_word = 0;
+    if (setsockopt(m_rx_sd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("PACKET_RX_RING");
+        exit(1);
+    }
+
+    // Map the RX ring into our address space
+    m_rx_ring_size = (size_t)block_size * block_count;
+    void* ring = mmap(nullptr, m_rx_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_LOCKED, m_rx_sd, 0);
+    if (ring == MAP_FAILED)
+    {
+        ring = mmap(nullptr, m_rx_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, m_rx_sd, 0);
+    }
+    if (ring == MAP_FAILED)
+    {
+        perror("mmap RX ring");
+        exit(1);
+    }
+
+    // Bind the receive socket to our network interface, and start receiving
+    // every protocol.  Frames only start arriving now
+    sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family   = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex  = m_if_idx;
+    if (bind(m_rx_sd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+
+    // Save the geometry of the ring
+    m_rx_ring        = (uint8_t*)ring;
+    m_rx_block_size  = block_size;
+    m_rx_block_count = block_count;
+    m_rx_block       = 0;
+    m_rx_held        = false;
+    m_rx_remaining   = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// tune_tx_socket() - Applies the transmit-side settings of the profile to a
+//                    socket we send on
+//=============================================================================
+void CRawNIC::tune_tx_socket(int sd)
+{
+    const nic_profile_t& profile = m_profile;
+
+    // Hand frames straight to the driver.  Note that this also bypasses
+    // any "etf" qdisc, so don't combine it with enable_txtime()
+    if (profile.qdisc_bypass)
+    {
+        int one = 1;
+        if (setsockopt(sd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0)
+        {
+            perror("PACKET_QDISC_BYPASS");
+            exit(1);
+        }
+    }
+
+    // Size the send buffer
+    if (profile.sndbuf) set_buffer_size(sd, SO_SNDBUF, SO_SNDBUFFORCE, profile.sndbuf);
+}
+//=============================================================================
+
+
+//=============================================================================
+// tune_rx_socket() - Applies the receive-side settings of the profile to the
+//                    receive socket
+//=============================================================================
+void CRawNIC::tune_rx_socket()
+{
+    const nic_profile_t& profile = m_profile;
+
+    // Size the receive buffer
+    if (profile.rcvbuf) set_buffer_size(m_rx_sd, SO_RCVBUF, SO_RCVBUFFORCE, profile.rcvbuf);
+
+    // The rest of the settings are all about busy polling
+    struct {bool wanted; int option; int value; const char* name;} setting[] =
+    {
+        {profile.busy_poll_usecs  > 0, SO_BUSY_POLL,        profile.busy_poll_usecs,  "SO_BUSY_POLL"       },
+        {profile.busy_poll_budget > 0, SO_BUSY_POLL_BUDGET, profile.busy_poll_budget, "SO_BUSY_POLL_BUDGET"},
+        {profile.prefer_busy_poll,     SO_PREFER_BUSY_POLL, 1,                        "SO_PREFER_BUSY_POLL"}
+    };
+
+    for (auto& s : setting)
+    {
+        if (!s.wanted) continue;
+        if (setsockopt(m_rx_sd, SOL_SOCKET, s.option, &s.value, sizeof(s.value)) < 0)
+        {
+            perror(s.name);
+            exit(1);
+        }
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// set_buffer_size() - Sets the size of a socket buffer.  The "force" option
+//                     can exceed the system-wide limit, but needs privileges,
+//                     so if it fails we settle for the ordinary option
+//=============================================================================
+void CRawNIC::set_buffer_size(int sd, int option, int force_option, int size)
+{
+    if (setsockopt(sd, SOL_SOCKET, force_option, &size, sizeof(size)) == 0) return;
+
+    if (setsockopt(sd, SOL_SOCKET, option, &size, sizeof(size)) < 0)
+    {
+        perror("setsockopt buffer size");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// set_rx_filter() - Compiles a receive filter, and attaches it to the receive
+//                   socket if we have one yet
+//=============================================================================
+void CRawNIC::set_rx_filter(const rx_filter_t& filter)
+{
+    m_rx_filter = compile_rx_filter(filter);
+    if (m_rx_sd >= 0) attach_rx_filter();
+}
+//=============================================================================
+
+
+//=============================================================================
+// attach_rx_filter() - Attaches the compiled receive filter to the receive
+//                      socket
+//=============================================================================
+void CRawNIC::attach_rx_filter()
+{
+    sock_fprog prog;
+    prog.len    = m_rx_filter.size();
+    prog.filter = m_rx_filter.data();
+    if (setsockopt(m_rx_sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    {
+        perror("SO_ATTACH_FILTER");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// join_fanout() - Adds our receive socket to a PACKET_FANOUT group
+//=============================================================================
+uint16_t CRawNIC::join_fanout(uint16_t group_id, int mode, int bpf_prog_fd)
+{
+    // The low 16 bits are the group ID, the high 16 bits are the mode
+    int fanout = group_id | (mode << 16);
+    if (setsockopt(m_rx_sd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0)
+    {
+        perror("PACKET_FANOUT");
+        exit(1);
+    }
+
+    // In eBPF mode, the group needs a program to steer frames with
+    if ((mode & 0xFF) == PACKET_FANOUT_EBPF)
+    {
+        if (setsockopt(m_rx_sd, SOL_PACKET, PACKET_FANOUT_DATA, &bpf_prog_fd,
+                       sizeof(bpf_prog_fd)) < 0)
+        {
+            perror("PACKET_FANOUT_DATA");
+            exit(1);
+        }
+    }
+
+    // Find out which group we ended up in, in case the kernel picked it
+    socklen_t length = sizeof(fanout);
+    if (getsockopt(m_rx_sd, SOL_PACKET, PACKET_FANOUT, &fanout, &length) < 0)
+    {
+        perror("PACKET_FANOUT");
+        exit(1);
+    }
+
+    return fanout & 0xFFFF;
+}
+//=============================================================================
+
+
+//=============================================================================
+// receive_block() - Waits for the kernel to retire a block of the RX ring,
+//                   then fills in descriptors for the frames in that block
+//
+// Returns the number of frame descriptors filled in
+//=============================================================================
+int CRawNIC::receive_block(rx_frame_t* frames, int max_frames, int timeout_ms)
+{
+    // If we don't already own a block, wait for the kernel to give us one
+    if (!m_rx_held)
+    {
+        tpacket_block_desc* desc = (tpacket_block_desc*)
+                                   (m_rx_ring + (size_t)m_rx_block * m_rx_block_size);
+
+        // Wait until the block belongs to us
+        while ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) 
+                & TP_STATUS_USER) == 0)
+        {
+            if (timeout_ms == 0) return 0;
+
+            pollfd pfd;
+            pfd.fd      = m_rx_sd;
+            pfd.events  = POLLIN | POLLERR;
+            pfd.revents = 0;
+            int rc = poll(&pfd, 1, timeout_ms);
+
+            // If we timed out (or were interrupted), tell the caller
+            if (rc <= 0 && timeout_ms > 0) return 0;
+        }
+
+        // We now own this block.  Point to its first frame
+        m_rx_held      = true;
+        m_rx_remaining = desc->hdr.bh1.num_pkts;
+        m_rx_next      = (uint8_t*)desc + desc->hdr.bh1.offset_to_first_pkt;
+    }
+
+    // Fill in a descriptor for as many frames as the caller can hold
+    int count = 0;
+    while (count < max_frames && m_rx_remaining)
+    {
+        tpacket3_hdr* hdr = (tpacket3_hdr*)m_rx_next;
+        frames[count].data   = m_rx_next + hdr->tp_mac;
+        frames[count].length = hdr->tp_snaplen;
+        frames[count].sec    = hdr->tp_sec;
+        frames[count].nsec   = hdr->tp_nsec;
+        frames[count].wire_length = hdr->tp_len;
+        ++count;
+
+        // Point to the next frame in the block
+        m_rx_next += hdr->tp_next_offset;
+        --m_rx_remaining;
+    }
+
+    // Tell the caller how many frames we found
+    return count;
+}
+//=============================================================================
+
+
+//=============================================================================
+// release_block() - Hands the current RX-ring block back to the kernel, as
+//                   long as every frame in it has been given to the caller
+//=============================================================================
+void CRawNIC::release_block()
+{
+    // If we don't own a block, or the caller hasn't seen every frame in
+    // it yet, there's nothing to release
+    if (!m_rx_held || m_rx_remaining) return;
+
+    // Give the block back to the kernel
+    tpacket_block_desc* desc = (tpacket_block_desc*)
+                               (m_rx_ring + (size_t)m_rx_block * m_rx_block_size);
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    // And move on to the next block in the ring
+    if (++m_rx_block == m_rx_block_count) m_rx_block = 0;
+    m_rx_held = false;
+}
+//=============================================================================
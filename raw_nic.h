@@ -5,18 +5,161 @@
 //=============================================================================
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <vector>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include "tx_stats.h"
+#include "rx_filter.h"
+#include "nic_profile.h"
 
 class CRawNIC
 {
 
 public:
 
-    void    connect_nic(const char* nic_name);
+    // Describes a single frame in a batch of frames passed to send_batch()
+    struct frame_t
+    {
+        const void* data;
+        uint16_t    length;
+    };
+
+    // Constructor and destructor
+    CRawNIC();
+    ~CRawNIC();
+
+    // Describes a single received frame.  "data" points directly into the
+    // RX ring and remains valid until the block is released.  "length" is
+    // the number of bytes at "data"; "wire_length" is the length the frame
+    // had on the wire, which is larger if a snap length cut it short
+    struct rx_frame_t
+    {
+        const uint8_t* data;
+        uint32_t       length;
+        uint32_t       sec;
+        uint32_t       nsec;
+        uint32_t       wire_length;
+    };
+
+    // Opens the socket we send on.  "profile" tunes the sockets and rings
+    // for the host; the default profile changes nothing
+    void    connect_nic(const char* nic_name, const nic_profile_t& profile = nic_profile_t());
+
+    // Same as connect_nic(), for a NIC that's only going to receive: no
+    // socket to send on is opened.  Call enable_rx_ring() next
+    void    connect_rx(const char* nic_name, const nic_profile_t& profile = nic_profile_t());
+
+    // Returns the socket that frames are sent on, for classes that need to
+    // set options on it or read its error queue
+    int     socket_fd() const {return m_sd;}
+
+    // Returns the index of the network interface
+    int     if_index() const {return m_if_idx;}
+
+    // Returns the NUMA node our rings are placed on, or -1 if the profile
+    // didn't ask for NUMA placement (or the NIC's node isn't known)
+    int     numa_node() const {return m_numa_node;}
 
     // If frame_length is more than 1500 bytes, make sure the MTU of 
     // your NIC is set to a large enough value!
     void    send(const void* frame, uint16_t frame_length);
 
+    // Transmits "count" frames using as few system calls as possible.  
+    // Returns the number of frames that were accepted by the kernel.  If this
+    // is less than "count", the caller may resubmit the remaining frames.
+    int     send_batch(const frame_t* frames, int count);
+
+    // Same as above, but each frame is gathered from "iov_per_frame" pieces.
+    // The pieces of frame N are iov[N * iov_per_frame] onwards
+    int     send_batch(const iovec* iov, int iov_per_frame, int count);
+
+    // Same as above, but keeps resubmitting until every frame is accepted,
+    // waiting for room whenever the kernel is temporarily out of it (EAGAIN,
+    // ENOBUFS or EINTR).  Returns the number of frames accepted, which is
+    // less than "count" only on a hard error, or if the kernel accepted
+    // nothing for "timeout_ms"
+    int     send_all(const iovec* iov, int iov_per_frame, int count, int timeout_ms = 1000);
+
+    // Turns on SO_TXTIME so that send_at() can tell the kernel when each 
+    // frame should leave.  The interface needs an "etf" qdisc that uses 
+    // the same clock for the launch times to be honored
+    void    enable_txtime(clockid_t clock_id = CLOCK_TAI);
+
+    // Transmits a frame no earlier than "txtime" nanoseconds, measured on
+    // the clock passed to enable_txtime()
+    void    send_at(const void* frame, uint16_t frame_length, uint64_t txtime);
+
+    // Turns on PACKET_VNET_HDR.  From then on, every frame sent must begin
+    // with a virtio_net_hdr, which can ask the kernel (or the NIC) to 
+    // segment the frame and compute its checksum.  See write_gso_header()
+    void    enable_vnet_hdr();
+
+    // Sets up a memory-mapped PACKET_TX_RING of "frame_count" slots, each of
+    // which can hold a frame of up to "frame_size" bytes.  Once this is 
+    // called, frames can be built directly inside the ring via get_tx_slot().
+    // The ring gets a socket of its own, so send() and send_batch() still
+    // send the caller's frames and can be mixed freely with the ring
+    void    enable_tx_ring(uint32_t frame_size = 2048, uint32_t frame_count = 4096);
+
+    // Returns a pointer to the next free TX-ring slot, or nullptr if every
+    // slot is still waiting to be sent.  Build a frame there (for instance
+    // via write_header()), then call commit_tx_slot()
+    uint8_t* get_tx_slot();
+
+    // Marks the slot returned by get_tx_slot() as ready for transmission
+    void    commit_tx_slot(uint16_t frame_length);
+
+    // Tells the kernel to transmit every committed TX-ring slot.  If "wait"
+    // is false, this returns without waiting for the frames to go out
+    int     flush_tx_ring(bool wait = false);
+
+    // Sets up a memory-mapped TPACKET_V3 PACKET_RX_RING of "block_count"
+    // blocks of "block_size" bytes.  The kernel hands a block to us when it 
+    // fills up or when "timeout_ms" expires, whichever comes first.  Larger
+    // blocks lower the per-frame cost; shorter timeouts lower the latency
+    void    enable_rx_ring(uint32_t block_size = 1 << 20, uint32_t block_count = 64,
+                           uint32_t timeout_ms = 10);
+
+    // Waits up to "timeout_ms" (-1 = forever) for a block of received frames
+    // and fills in up to "max_frames" frame descriptors.  Returns the number
+    // of frames filled in.  If the block holds more than "max_frames" frames,
+    // the rest are returned by subsequent calls
+    int     receive_block(rx_frame_t* frames, int max_frames, int timeout_ms = -1);
+
+    // Compiles "filter" into a classic BPF program and attaches it to the
+    // receive socket, so that the kernel only queues the frames we want.
+    // This may be called before or after enable_rx_ring(); calling it
+    // before means that no unwanted frames ever reach the RX ring
+    void    set_rx_filter(const rx_filter_t& filter);
+
+    // Joins the receive socket to PACKET_FANOUT group "group_id", so that the
+    // frames arriving at the interface are spread across every socket in
+    // the group.  "mode" is one of the PACKET_FANOUT_XXX modes; for
+    // PACKET_FANOUT_EBPF, "bpf_prog_fd" is a loaded socket-filter program
+    // that returns the index of the socket to deliver each frame to.  If
+    // "mode" includes PACKET_FANOUT_FLAG_UNIQUEID, "group_id" must be 0 and
+    // the kernel creates a new group with an ID nobody else is using.
+    // Returns the ID of the group we joined.  Must be called after
+    // enable_rx_ring()
+    uint16_t join_fanout(uint16_t group_id, int mode, int bpf_prog_fd = -1);
+
+    // Hands the current block back to the kernel once every frame in it has
+    // been returned by receive_block().  Frame descriptors that refer to the
+    // block are no longer valid after this
+    void    release_block();
+
+    // Call this to turn on a histogram of how long each send call takes.  
+    // This costs two clock reads per call, so it's off by default
+    void    enable_send_timing(bool enable = true);
+
+    // Returns a snapshot of the transmit statistics.  This is lock-free, and
+    // may be called from any thread at any time
+    tx_stats_t tx_stats() const {return m_stats.snapshot();}
+
 protected:
 
     // Socket descriptor
@@ -24,4 +167,79 @@ protected:
     
     // Network interface index
     int     m_if_idx;
-};
\ No newline at end of file
+
+    // The tuning profile passed to connect_nic(), and the NUMA node that
+    // rings are allocated on (-1 = wherever the kernel likes)
+    nic_profile_t m_profile;
+    int         m_numa_node;
+
+    // The destination socket-address, built once in connect_nic()
+    sockaddr_ll m_dest;
+
+    // The socket the TX ring belongs to, and the memory-mapped ring itself
+    // (nullptr if there isn't one).  Once a socket has a TX ring, every send
+    // on it walks the ring and ignores the caller's buffer, so the ring
+    // can't share m_sd
+    int         m_tx_ring_sd;
+    uint8_t*    m_tx_ring;
+
+    // Size of the TX ring in bytes, size of each block and of each slot,
+    // the number of slots per block and the total number of slots
+    size_t      m_tx_ring_size;
+    uint32_t    m_tx_block_size;
+    uint32_t    m_tx_frame_size;
+    uint32_t    m_tx_frames_per_block;
+    uint32_t    m_tx_frame_count;
+
+    // Index of the next TX-ring slot that we'll hand out
+    uint32_t    m_tx_head;
+
+    // Socket descriptor for the receive side, and the memory-mapped RX ring
+    int         m_rx_sd;
+    uint8_t*    m_rx_ring;
+
+    // Size of the RX ring in bytes, size of each block, and number of blocks
+    size_t      m_rx_ring_size;
+    uint32_t    m_rx_block_size;
+    uint32_t    m_rx_block_count;
+
+    // Index of the block we're reading from, and whether we own it
+    uint32_t    m_rx_block;
+    bool        m_rx_held;
+
+    // The next frame in the current block, and how many frames are left
+    uint8_t*    m_rx_next;
+    uint32_t    m_rx_remaining;
+
+    // The compiled receive filter, if there is one
+    std::vector<sock_filter> m_rx_filter;
+
+    // Number of TX-ring slots committed since the last flush
+    uint32_t    m_tx_committed;
+
+    // Transmit statistics, and whether we're timing send calls
+    CTxStats    m_stats;
+    bool        m_send_timing;
+
+    // Returns a pointer to the tpacket header of the specified TX-ring slot
+    tpacket2_hdr* tx_slot_hdr(uint32_t index);
+
+    // Applies the transmit-side settings of the profile to a socket
+    void        tune_tx_socket(int sd);
+
+    // Applies the receive-side settings of the profile
+    void        tune_rx_socket();
+
+    // Sets the size of a socket buffer
+    void        set_buffer_size(int sd, int option, int force_option, int size);
+
+    // Attaches m_rx_filter to the receive socket
+    void        attach_rx_filter();
+
+    // Calls sendmmsg() and keeps track of how it went
+    int         send_mmsg(mmsghdr* msg, int count);
+
+    // Updates the transmit statistics after a send call
+    void        record_send(uint64_t start, int rc, uint64_t frames, uint64_t bytes,
+                            bool short_write);
+};
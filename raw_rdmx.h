@@ -11,16 +11,27 @@
 //
 // (3) call "write_header()" to write the 64-byte Ethernet/IPv4/UDP/RDMX
 //     frame header at your desired location.
+//
+// If sequencing is turned on, every header also carries a sequence number
+// and the time it was written, so that a receiver (see CSeqTracker) can spot
+// lost, duplicated and reordered frames, and measure one-way latency.  Each
+// CRawRDMX instance is one stream with its own sequence numbers.
 //=============================================================================
 #pragma once
 #include <cstdint>
+#include <ctime>
+#include "frame_builder.h"
 
 class CRawRDMX
 {
 public:
 
-    // Constructer fills in header field constants
-    CRawRDMX();
+    // The frame builder this class wraps, and the size of its header
+    typedef CFrameBuilder<eth_layer_t, ipv4_layer_t, udp_layer_t, rdmx_layer_t> builder_t;
+    static constexpr size_t HEADER_SIZE = builder_t::header_size;
+
+    // Constructor
+    CRawRDMX() : sequencing_(false), timestamps_(false), seq_(0) {}
 
     // Call this to define source and destination MAC addresses.  If dst_mac
     // is "nullptr", it will be set to the broadcoast MAC (FF:FF:FF:FF:FF:FF)
@@ -32,12 +43,96 @@ public:
     // Call this to define the source and destination UDP ports
     void    set_udp_ports(uint16_t src_port, uint16_t dst_port = 11111);
 
-    // Call this to write out a valid Ethernet/IPv4/UDP/RDMX header
-    void    write_header(void* where, uint16_t payload_length, uint64_t target_addr);
+    // Call this to turn UDP checksum generation on or off (default is off)
+    void    set_udp_checksum(bool enable) {builder_.set_udp_checksum(enable);}
+
+    // Call this to have every header carry a sequence number, starting at
+    // "first_seq", and (if "timestamps" is true) its CLOCK_REALTIME transmit
+    // time.  Sequencing is off by default.  Timestamps are off unless asked
+    // for: write_header() reads the clock for every frame, which costs far
+    // more than the rest of the header does.  write_headers() reads it once
+    // per batch
+    void    set_sequencing(bool enable, bool timestamps = false, uint32_t first_seq = 0)
+    {
+        sequencing_ = enable;
+        timestamps_ = enable && timestamps;
+        seq_        = first_seq;
+    }
+
+    // Returns true if sequencing is on
+    bool    sequencing() const {return sequencing_;}
+
+    // Returns the sequence number the next header will carry
+    uint32_t next_seq() const {return seq_;}
+
+    // Call this to write out a valid Ethernet/IPv4/UDP/RDMX header.  If UDP
+    // checksums are on, the payload must already be filled in, either at
+    // "payload" or, if that is nullptr, directly after the header
+    void    write_header(void* where, uint16_t payload_length, uint64_t target_addr,
+                         const void* payload = nullptr)
+    {
+        stamp_header(where, payload_length, target_addr, payload, timestamps_ ? clock_ns() : 0,
+                     sequencing_ ? seq_++ : 0);
+    }
+
+    // Same as above, but the header carries sequence number "seq" rather than
+    // the next one, and the next one doesn't change.  This is for resending
+    // a frame that was lost
+    void    rewrite_header(void* where, uint16_t payload_length, uint64_t target_addr,
+                           uint32_t seq, const void* payload = nullptr)
+    {
+        stamp_header(where, payload_length, target_addr, payload, timestamps_ ? clock_ns() : 0, seq);
+    }
+
+    // Call this to write out headers for "count" frames at once.  where[i]
+    // receives a header for a payload of payload_length[i] bytes that is
+    // destined for target_addr[i].  The whole batch shares one timestamp
+    void    write_headers(void* const* where, const uint16_t* payload_length,
+                          const uint64_t* target_addr, int count)
+    {
+        uint64_t tx_ns = timestamps_ ? clock_ns() : 0;
+        for (int i=0; i<count; ++i)
+        {
+            stamp_header(where[i], payload_length[i], target_addr[i], nullptr, tx_ns,
+                         sequencing_ ? seq_++ : 0);
+        }
+    }
+
+    // Gives access to the underlying frame builder
+    builder_t& builder() {return builder_;}
 
 protected:
 
-    // This will contain the template for the Ethernet/IPv4/UDP/RDMX frame
-    unsigned char frame_[64];
-};
+    // Stamps a header, filling in the per-frame RDMX fields
+    void    stamp_header(void* where, uint16_t payload_length, uint64_t target_addr,
+                         const void* payload, uint64_t tx_ns, uint32_t seq)
+    {
+        builder_.stamp(where, payload_length, payload, [&](uint8_t* frame)
+        {
+            rdmx_hdr_t& rdmx = builder_t::hdr<rdmx_layer_t>(frame);
+            rdmx.target_addr = htonll(target_addr);
+            if (sequencing_)
+            {
+                rdmx.seq   = htonl(seq);
+                rdmx.tx_ns = htonll(tx_ns);
+            }
+        });
+    }
 
+    // Returns CLOCK_REALTIME in nanoseconds
+    static uint64_t clock_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // This builds the Ethernet/IPv4/UDP/RDMX frame headers
+    builder_t   builder_;
+
+    // Sequencing: whether it's on, whether we stamp transmit times, and the
+    // next sequence number
+    bool        sequencing_;
+    bool        timestamps_;
+    uint32_t    seq_;
+};
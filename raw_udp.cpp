@@ -4,119 +4,8 @@
 // Author: D. Wolf
 //=============================================================================
 #include <cstring>
-#include <cassert>
-#include <arpa/inet.h>
 #include "raw_udp.h"
 
-#pragma pack(push, 1)
-
-struct eth_hdr_t
-{
-    uint8_t     dst_mac[6];
-    uint8_t     src_mac[6];
-    uint16_t    frame_type;
-};
-
-struct ipv4_hdr_t
-{
-    uint8_t     version;
-    uint8_t     dsf;
-    uint16_t    length;
-    uint16_t    id;
-    uint16_t    flags;
-    uint8_t     time_to_live;
-    uint8_t     protocol;
-    uint16_t    checksum;
-    uint8_t     src_ip[4];
-    uint8_t     dst_ip[4];
-};
-
-struct udp_hdr_t
-{
-    uint16_t    src_port;
-    uint16_t    dst_port;
-    uint16_t    length;
-    uint16_t    checksum;
-};
-
-struct raw_udp_t
-{
-    eth_hdr_t   eth;
-    ipv4_hdr_t  ipv4;
-    udp_hdr_t   udp;
-};
-
-
-#pragma pack(pop)
-
-//=============================================================================
-// ipv4_checksum() - Computes the 16-bit checksum of an IPv4 header
-//=============================================================================
-static uint16_t ipv4_checksum(ipv4_hdr_t& header)
-{
-    uint16_t correction;
-    uint32_t checksum = 0;
-
-    // We're going to treat the IPv4 header as a sequence of ten
-    // 16-bit big-endian integers
-    uint16_t* entry = (uint16_t*)&header;
-
-    // A standard IPv4 header is ten 16-bit integers
-    for (int i=0; i<10; ++i)
-    {
-        // When we're computing the checksum, we don't
-        // include the checksum field itself 
-        if (i != 5) checksum += ntohs(entry[i]);
-    }
-
-    // Add the upper 16-bits and the lower 16-bits together
-    correction = checksum >> 16;
-    checksum &= 0xFFFF;
-    checksum += correction;
-
-    // An IPv4 checksum is the 1's complement of the above calculation
-    return ~checksum;
-}
-//=============================================================================
-
-
-//=============================================================================
-// CRawUDP - Default constructor
-//=============================================================================
-CRawUDP::CRawUDP()
-{
-    // Ensure that the structures are the expected sizes
-    assert(sizeof(eth_hdr_t ) == 14);
-    assert(sizeof(ipv4_hdr_t) == 20);
-    assert(sizeof(udp_hdr_t ) ==  8);
-    assert(sizeof(raw_udp_t ) == 42);
-
-    // Set the entire frame header template to all zeros
-    memset(frame_, 0, sizeof(frame_));
-
-    // Create a handy structure reference to the frame header template
-    raw_udp_t& frame = *(raw_udp_t*)frame_;
-
-    // Set the Ethernet frame type to "IPv4"
-    frame.eth.frame_type = htons(0x0800);
-
-    // Use some reasonable default MAC addresses
-    memset(frame.eth.src_mac, 0x00, 6);
-    memset(frame.eth.dst_mac, 0xFF, 6);
-
-    // Fill in the IPv4 Header
-    frame.ipv4.version      = 0x45;            // 0x45 = Standard IPv4
-    frame.ipv4.dsf          = 0;               // Unused
-    frame.ipv4.id           = htons(0xDEAD);   // Unused
-    frame.ipv4.flags        = htons(0x4000);   // Flags = "Don't fragment this packet"
-    frame.ipv4.time_to_live = 0x40;            // This packet should live for 64 hops
-    frame.ipv4.protocol     = 0x11;            // 0x11 = UDP 
-
-    // The UDP checksum is always 0
-    frame.udp.checksum = 0;
-}
-//=============================================================================
-
 
 //=============================================================================
 // set_mac_addrs() - Defines the source and destination MAC address for the
@@ -126,16 +15,16 @@ void CRawUDP::set_mac_addrs(const void* src_mac, const void* dst_mac)
 {
     unsigned char broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
-    // Create a handy structure reference to the frame header template
-    raw_udp_t& frame = *(raw_udp_t*)frame_;
+    // Create a handy reference to the Ethernet header of the template
+    eth_hdr_t& eth = builder_.hdr<eth_layer_t>();
 
     // If the caller didn't give us a dst_mac, we will target this 
     // ethernet frame to the ethernet-broadcast address
     if (dst_mac == nullptr) dst_mac = broadcast_mac;
 
     // Copy the MAC addresses into the frame header template
-    memcpy(frame.eth.src_mac, src_mac, 6);
-    memcpy(frame.eth.dst_mac, dst_mac, 6);
+    memcpy(eth.src_mac, src_mac, 6);
+    memcpy(eth.dst_mac, dst_mac, 6);
 }
 //=============================================================================
 
@@ -146,12 +35,15 @@ void CRawUDP::set_mac_addrs(const void* src_mac, const void* dst_mac)
 //=============================================================================
 void CRawUDP::set_ip_addrs(const void* src_ip, const void* dst_ip)
 {
-    // Create a handy structure reference to the frame header template
-    raw_udp_t& frame = *(raw_udp_t*)frame_;
+    // Create a handy reference to the IPv4 header of the template
+    ipv4_hdr_t& ipv4 = builder_.hdr<ipv4_layer_t>();
 
     // Copy the IP addresses into the frame header template
-    memcpy(frame.ipv4.src_ip, src_ip, 4);
-    memcpy(frame.ipv4.dst_ip, dst_ip, 4);
+    memcpy(ipv4.src_ip, src_ip, 4);
+    memcpy(ipv4.dst_ip, dst_ip, 4);
+
+    // The IP addresses are part of the IPv4 and UDP checksums
+    builder_.refresh();
 }
 //=============================================================================
 
@@ -161,40 +53,11 @@ void CRawUDP::set_ip_addrs(const void* src_ip, const void* dst_ip)
 //=============================================================================
 void CRawUDP::set_udp_ports(uint16_t src_port, uint16_t dst_port)
 {
-    // Create a handy structure reference to the frame header template
-    raw_udp_t& frame = *(raw_udp_t*)frame_;
+    // Create a handy reference to the UDP header of the template
+    udp_hdr_t& udp = builder_.hdr<udp_layer_t>();
 
     // Store the UDP port numbers into the frame header template
-    frame.udp.src_port = htons(src_port);
-    frame.udp.dst_port = htons(dst_port);
+    udp.src_port = htons(src_port);
+    udp.dst_port = htons(dst_port);
 }
 //=============================================================================
-
-
-//=============================================================================
-// write_header() - Writes out a complete Ethernet/IPv4/UDP header
-//=============================================================================
-void CRawUDP::write_header(void* where, uint16_t payload_length)
-{
-    // Copy the frame header template into the caller's buffer
-    memcpy(where, frame_, sizeof(frame_));    
-
-    // Create a handy structure reference to the caller's frame header
-    raw_udp_t& frame = *(raw_udp_t*)where;
-
-    // Compute the length of the IPv4 packet
-    uint16_t ip4_length = sizeof(ipv4_hdr_t)
-                        + sizeof(udp_hdr_t)
-                        + payload_length;
-    
-    // Compute the length of the UDP datagram
-    uint16_t udp_length = sizeof(udp_hdr_t) + payload_length;
-
-    // Store the lengths into the caller's frame header
-    frame.ipv4.length = htons(ip4_length);
-    frame.udp.length  = htons(udp_length);
-
-    // Write the IPv4 checksum into the frame header
-    frame.ipv4.checksum = htons(ipv4_checksum(frame.ipv4));
-}
-//=============================================================================
\ No newline at end of file
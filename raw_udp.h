@@ -11,16 +11,26 @@
 //
 // (3) call "write_header()" to write the 42-byte Ethernet/IPv4/UDP frame
 //     header at your desired location.
+//
+// For bulk streams, call CRawNIC::enable_vnet_hdr() and build "super-frames"
+// with "write_gso_header()" instead.  The kernel (or the NIC) splits each
+// super-frame into datagrams and computes their UDP checksums for us.
 //=============================================================================
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include "frame_builder.h"
 
 class CRawUDP
 {
 public:
 
-    // Constructer fills in header field constants
-    CRawUDP();
+    // The frame builder this class wraps, and the size of its header
+    typedef CFrameBuilder<eth_layer_t, ipv4_layer_t, udp_layer_t> builder_t;
+    static constexpr size_t HEADER_SIZE = builder_t::header_size;
+
+    // The size of a virtio_net_hdr plus a frame header
+    static constexpr size_t GSO_HEADER_SIZE = sizeof(vnet_hdr_t) + HEADER_SIZE;
 
     // Call this to define source and destination MAC addresses.  If dst_mac
     // is "nullptr", it will be set to the broadcoast MAC (FF:FF:FF:FF:FF:FF)
@@ -32,13 +42,56 @@ public:
     // Call this to define the source and destination UDP ports
     void    set_udp_ports(uint16_t src_port, uint16_t dst_port);
 
-    // Call this to write out a valid Ethernet/IPv4/UDP header
-    void    write_header(void* where, uint16_t payload_length);
+    // Call this to turn UDP checksum generation on or off (default is off)
+    void    set_udp_checksum(bool enable) {builder_.set_udp_checksum(enable);}
 
-protected:
+    // Call this to write out a valid Ethernet/IPv4/UDP header.  If UDP 
+    // checksums are on, the payload must already be filled in, either at
+    // "payload" or, if that is nullptr, directly after the header
+    void    write_header(void* where, uint16_t payload_length,
+                         const void* payload = nullptr)
+    {
+        builder_.stamp(where, payload_length, payload);
+    }
 
-    // This will contain the template for the Ethernet/IPv4/UDP frame
-    unsigned char frame_[42];
-};
+    // Call this to write out headers for "count" frames at once.  where[i]
+    // receives a header for a payload of payload_length[i] bytes
+    void    write_headers(void* const* where, const uint16_t* payload_length,
+                          int count)
+    {
+        for (int i=0; i<count; ++i) builder_.stamp(where[i], payload_length[i]);
+    }
+
+    // Call this to write a virtio_net_hdr followed by an Ethernet/IPv4/UDP 
+    // header for a super-frame that carries "payload_length" bytes.  The
+    // super-frame is split into datagrams of "segment_size" payload bytes
+    // each, and their UDP checksums are computed for us.  If "segment_size"
+    // is 0, the frame is sent as a single datagram and only its checksum is
+    // offloaded.  Send GSO_HEADER_SIZE + payload_length bytes from "where"
+    // on a CRawNIC that has had enable_vnet_hdr() called.
+    //
+    // The IPv4 length field limits payload_length to 65507 bytes
+    void    write_gso_header(void* where, uint16_t payload_length,
+                             uint16_t segment_size)
+    {
+        // On a little-endian machine, virtio_net_hdr fields are in host order
+        vnet_hdr_t& vnet = *(vnet_hdr_t*)where;
+        vnet.flags       = VNET_F_NEEDS_CSUM;
+        vnet.gso_type    = (segment_size && payload_length > segment_size)
+                         ? VNET_GSO_UDP_L4 : VNET_GSO_NONE;
+        vnet.hdr_len     = HEADER_SIZE;
+        vnet.gso_size    = segment_size;
+        vnet.csum_start  = builder_t::offset<udp_layer_t>;
+        vnet.csum_offset = offsetof(udp_hdr_t, checksum);
 
+        builder_.stamp_partial((uint8_t*)where + sizeof(vnet), payload_length);
+    }
 
+    // Gives access to the underlying frame builder
+    builder_t& builder() {return builder_;}
+
+protected:
+
+    // This builds the Ethernet/IPv4/UDP frame headers
+    builder_t   builder_;
+};
@@ -0,0 +1,354 @@
+//=============================================================================
+// This class sends raw ethernet frames asynchronously via io_uring
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "raw_uring.h"
+
+//=============================================================================
+// There are no C library wrappers for the io_uring system calls
+//=============================================================================
+static int io_uring_setup(uint32_t entries, io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                          uint32_t flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   nullptr, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, const void* arg,
+                             uint32_t nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+//=============================================================================
+
+
+//=============================================================================
+// CUringNIC() - Default constructor
+//=============================================================================
+CUringNIC::CUringNIC()
+{
+    m_ring_fd       = -1;
+    m_sq_head       = nullptr;
+    m_sq_tail       = nullptr;
+    m_sq_array      = nullptr;
+    m_sq_mask       = 0;
+    m_sq_entries    = 0;
+    m_sq_local_tail = 0;
+    m_sq_submitted  = 0;
+    m_sqes          = nullptr;
+    m_cq_head       = nullptr;
+    m_cq_tail       = nullptr;
+    m_cq_mask       = 0;
+    m_cqes          = nullptr;
+    m_sq_map        = nullptr;
+    m_sq_map_size   = 0;
+    m_cq_map        = nullptr;
+    m_cq_map_size   = 0;
+    m_sqes_map_size = 0;
+    m_in_flight     = 0;
+    m_pool          = nullptr;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CUringNIC() - Destructor.  Unmaps the queues and closes the ring
+//=============================================================================
+CUringNIC::~CUringNIC()
+{
+    if (m_sqes) munmap(m_sqes, m_sqes_map_size);
+    if (m_cq_map && m_cq_map != m_sq_map) munmap(m_cq_map, m_cq_map_size);
+    if (m_sq_map) munmap(m_sq_map, m_sq_map_size);
+    if (m_ring_fd >= 0) close(m_ring_fd);
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable_uring() - Creates the io_uring and maps its queues
+//
+// Sends that carry no destination address (which is what io_uring's send
+// and write operations produce) go out on the interface the packet socket
+// is bound to, so we bind it here.  The socket is also registered as a
+// fixed file, which saves a file-table lookup on every send
+//=============================================================================
+void CUringNIC::enable_uring(uint32_t queue_depth)
+{
+    // Bind the packet socket to the interface, without subscribing to any
+    // incoming frames
+    sockaddr_ll addr = m_dest;
+    addr.sll_protocol = 0;
+    if (bind(m_sd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+
+    // Create the ring.  The completion queue defaults to twice the size of
+    // the submission queue
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ring_fd = io_uring_setup(queue_depth, &params);
+    if (m_ring_fd < 0)
+    {
+        perror("io_uring_setup");
+        exit(1);
+    }
+
+    // Compute the size of each queue's mapping
+    m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cq_map_size = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+
+    // On modern kernels, both queues share a single mapping
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+    {
+        if (m_cq_map_size > m_sq_map_size) m_sq_map_size = m_cq_map_size;
+        m_cq_map_size = m_sq_map_size;
+    }
+
+    // Map the submission queue
+    m_sq_map = mmap(nullptr, m_sq_map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_map == MAP_FAILED)
+    {
+        perror("mmap SQ ring");
+        exit(1);
+    }
+
+    // Map the completion queue
+    m_cq_map = m_sq_map;
+    if (!single_mmap)
+    {
+        m_cq_map = mmap(nullptr, m_cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_map == MAP_FAILED)
+        {
+            perror("mmap CQ ring");
+            exit(1);
+        }
+    }
+
+    // Map the array of submission-queue entries
+    m_sqes_map_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqes_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        perror("mmap SQEs");
+        exit(1);
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    // Find the fields of each queue
+    uint8_t* sq = (uint8_t*)m_sq_map;
+    m_sq_head       = (uint32_t*)(sq + params.sq_off.head);
+    m_sq_tail       = (uint32_t*)(sq + params.sq_off.tail);
+    m_sq_array      = (uint32_t*)(sq + params.sq_off.array);
+    m_sq_mask       = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    m_sq_entries    = params.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    m_sq_submitted  = m_sq_local_tail;
+
+    uint8_t* cq = (uint8_t*)m_cq_map;
+    m_cq_head = (uint32_t*)(cq + params.cq_off.head);
+    m_cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    m_cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    m_cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Our SQEs are always used in order, so the index array never changes
+    for (uint32_t i=0; i<m_sq_entries; ++i) m_sq_array[i] = i;
+
+    // There can be no more sends in flight than there are SQEs
+    m_pending.resize(m_sq_entries);
+    m_free_pending.clear();
+    for (uint32_t i=m_sq_entries; i>0; --i) m_free_pending.push_back(i - 1);
+
+    // Register the socket as fixed file 0
+    if (io_uring_register(m_ring_fd, IORING_REGISTER_FILES, &m_sd, 1) < 0)
+    {
+        perror("IORING_REGISTER_FILES");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// register_buffers() - Pins the caller's frame buffers in the kernel
+//=============================================================================
+void CUringNIC::register_buffers(const iovec* iov, int count)
+{
+    if (io_uring_register(m_ring_fd, IORING_REGISTER_BUFFERS, iov, count) < 0)
+    {
+        perror("IORING_REGISTER_BUFFERS");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// get_sqe() - Returns the next free submission-queue entry, cleared, or
+//             nullptr if "queue_depth" sends are already in flight.  The
+//             entry's user_data identifies the send to reap()
+//
+// Limiting the number of sends in flight to the size of the submission
+// queue means that neither queue can ever overflow
+//=============================================================================
+io_uring_sqe* CUringNIC::get_sqe(uint64_t user_data, uint32_t length)
+{
+    if (m_in_flight >= m_sq_entries) return nullptr;
+
+    // Remember what reap() will need to know about this send
+    uint32_t slot = m_free_pending.back();
+    m_free_pending.pop_back();
+    m_pending[slot] = {user_data, length};
+
+    io_uring_sqe* sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = slot;
+    ++m_sq_local_tail;
+    ++m_in_flight;
+    return sqe;
+}
+//=============================================================================
+
+
+//=============================================================================
+// submit() - Queues a send of a frame
+//=============================================================================
+bool CUringNIC::submit(const void* frame, uint16_t frame_length, uint64_t user_data)
+{
+    io_uring_sqe* sqe = get_sqe(user_data, frame_length);
+    if (sqe == nullptr) return false;
+
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->flags     = IOSQE_FIXED_FILE;
+    sqe->fd        = 0;
+    sqe->addr      = (uint64_t)frame;
+    sqe->len       = frame_length;
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// submit_fixed() - Queues a send of a frame that lies in a registered buffer
+//
+// A write to a socket is a send with no flags, and unlike a send, a write
+// can use a registered buffer
+//=============================================================================
+bool CUringNIC::submit_fixed(int buf_index, const void* frame, uint16_t frame_length,
+                             uint64_t user_data)
+{
+    io_uring_sqe* sqe = get_sqe(user_data, frame_length);
+    if (sqe == nullptr) return false;
+
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->flags     = IOSQE_FIXED_FILE;
+    sqe->fd        = 0;
+    sqe->addr      = (uint64_t)frame;
+    sqe->len       = frame_length;
+    sqe->buf_index = buf_index;
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// flush() - Publishes every queued send and tells the kernel about them
+//=============================================================================
+int CUringNIC::flush()
+{
+    uint32_t to_submit = m_sq_local_tail - m_sq_submitted;
+    if (to_submit == 0) return 0;
+
+    // Make the new entries visible to the kernel
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    int rc = io_uring_enter(m_ring_fd, to_submit, 0, 0);
+    if (rc < 0)
+    {
+        if (errno != EAGAIN && errno != EBUSY && errno != EINTR)
+        {
+            perror("io_uring_enter");
+        }
+        return -1;
+    }
+
+    m_sq_submitted += rc;
+    return rc;
+}
+//=============================================================================
+
+
+//=============================================================================
+// reap() - Collects the completions of sends, updates the transmit
+//          statistics to match, and recycles pooled frames
+//=============================================================================
+int CUringNIC::reap(completion_t* out, int max_count, int min_count)
+{
+    // Make sure the kernel knows about everything we've queued
+    flush();
+
+    uint32_t head  = *m_cq_head;
+    uint32_t avail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) - head;
+
+    // If there aren't enough completions yet, wait for them
+    if (min_count > 0 && avail < (uint32_t)min_count)
+    {
+        if (io_uring_enter(m_ring_fd, 0, min_count, IORING_ENTER_GETEVENTS) < 0
+            && errno != EINTR)
+        {
+            perror("io_uring_enter");
+        }
+        avail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) - head;
+    }
+
+    if (avail > (uint32_t)max_count) avail = max_count;
+
+    for (uint32_t i=0; i<avail; ++i)
+    {
+        const io_uring_cqe& cqe = m_cqes[(head + i) & m_cq_mask];
+
+        // Find out which send this was, and free its slot
+        uint32_t  slot = (uint32_t)cqe.user_data;
+        pending_t send = m_pending[slot];
+        m_free_pending.push_back(slot);
+
+        out[i].user_data = send.user_data;
+        out[i].result    = cqe.res;
+
+        if (cqe.res < 0)
+            m_stats.record_error(-cqe.res);
+        else
+            m_stats.record_sent(1, cqe.res, (uint32_t)cqe.res < send.length);
+
+        // If this frame came from our pool, the pool can have it back
+        const void* frame = (const void*)send.user_data;
+        if (m_pool && m_pool->contains(frame)) m_pool->free(frame);
+    }
+
+    // Tell the kernel we're done with those completions
+    __atomic_store_n(m_cq_head, head + avail, __ATOMIC_RELEASE);
+    m_in_flight -= avail;
+
+    return avail;
+}
+//=============================================================================
@@ -0,0 +1,131 @@
+//=============================================================================
+// raw_uring.h - This class sends raw ethernet frames asynchronously via
+//               io_uring
+//
+// Author: D. Wolf
+//
+// CRawNIC::send() blocks in the kernel until the frame has been queued to
+// the NIC, so a thread can't build the next frame while the last one is
+// being transmitted.  CUringNIC queues sends to an io_uring instead: submit()
+// returns immediately, and the caller reaps completions in batches later on.
+// A frame's buffer must not be reused until its completion has been reaped.
+//
+// To use this class:
+//
+// (1) call "connect_nic()" as usual, then "enable_uring()"
+//
+// (2) optionally, call "register_buffers()" to pin the frame buffers in the
+//     kernel, and send from them with "submit_fixed()"
+//
+// (3) call "submit()" or "submit_fixed()" for each frame, "flush()" to hand
+//     the queued sends to the kernel, and "reap()" to collect completions
+//
+// If the frames come from a CFramePool, call "recycle_to()" and pass each
+// frame's address as its "user_data": reap() then returns the frames to the
+// pool as their sends complete
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+#include "raw_nic.h"
+#include "frame_pool.h"
+
+class CUringNIC : public CRawNIC
+{
+public:
+
+    // Describes the completion of a single send
+    struct completion_t
+    {
+        uint64_t    user_data;  // Whatever was passed to submit()
+        int32_t     result;     // Bytes sent, or -errno
+    };
+
+    // Constructor and destructor
+    CUringNIC();
+    ~CUringNIC();
+
+    // Creates the io_uring.  At most "queue_depth" sends can be in flight
+    // at once.  Must be called after connect_nic()
+    void    enable_uring(uint32_t queue_depth = 4096);
+
+    // Registers "count" buffers with the kernel so that they needn't be
+    // mapped on every send.  Buffer "i" is iov[i]
+    void    register_buffers(const iovec* iov, int count);
+
+    // Queues a frame for transmission.  Returns false if "queue_depth"
+    // sends are already in flight; reap() some completions and try again
+    bool    submit(const void* frame, uint16_t frame_length, uint64_t user_data = 0);
+
+    // Same as above, but the frame lies within registered buffer "buf_index"
+    bool    submit_fixed(int buf_index, const void* frame, uint16_t frame_length,
+                         uint64_t user_data = 0);
+
+    // Hands every queued send to the kernel.  Returns the number submitted,
+    // or -1 on error
+    int     flush();
+
+    // Flushes, then fills in up to "max_count" completions, waiting until
+    // at least "min_count" are available.  Returns the number filled in
+    int     reap(completion_t* out, int max_count, int min_count = 0);
+
+    // Completed frames whose "user_data" points into "pool" will be
+    // returned to it by reap().  Pass nullptr to turn this off
+    void    recycle_to(CFramePool* pool) {m_pool = pool;}
+
+    // Returns the number of sends that have been queued but not reaped
+    uint32_t in_flight() const {return m_in_flight;}
+
+protected:
+
+    // A send that's in flight: what the caller passed as "user_data", and
+    // how many bytes we asked the kernel to send
+    struct pending_t
+    {
+        uint64_t    user_data;
+        uint32_t    length;
+    };
+
+    // Obtains a free submission-queue entry for a send of "length" bytes,
+    // or nullptr if we're at the queue-depth limit
+    struct io_uring_sqe* get_sqe(uint64_t user_data, uint32_t length);
+
+    // The io_uring file descriptor
+    int         m_ring_fd;
+
+    // The submission queue
+    uint32_t*   m_sq_head;
+    uint32_t*   m_sq_tail;
+    uint32_t*   m_sq_array;
+    uint32_t    m_sq_mask;
+    uint32_t    m_sq_entries;
+    uint32_t    m_sq_local_tail;
+    uint32_t    m_sq_submitted;
+    struct io_uring_sqe* m_sqes;
+
+    // The completion queue
+    uint32_t*   m_cq_head;
+    uint32_t*   m_cq_tail;
+    uint32_t    m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+
+    // The mappings of the queues
+    void*       m_sq_map;
+    size_t      m_sq_map_size;
+    void*       m_cq_map;
+    size_t      m_cq_map_size;
+    size_t      m_sqes_map_size;
+
+    // The number of sends queued but not yet reaped
+    uint32_t    m_in_flight;
+
+    // Every send in flight has a slot in "m_pending", and the kernel's
+    // user_data is the index of that slot.  Sends can complete in any
+    // order, so the free slots are kept on a stack
+    std::vector<pending_t> m_pending;
+    std::vector<uint32_t>  m_free_pending;
+
+    // If this isn't nullptr, completed frames are returned to this pool
+    CFramePool* m_pool;
+};
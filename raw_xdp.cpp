@@ -0,0 +1,644 @@
+//=============================================================================
+// This class sends and receives raw ethernet frames through an AF_XDP socket
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#include "raw_xdp.h"
+
+//=============================================================================
+// These may be missing from older C library headers
+//=============================================================================
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+//=============================================================================
+
+// The bytes the kernel keeps free at the front of each UMEM chunk.  A frame
+// we transmit has to fit in the rest of the chunk
+static const uint32_t UMEM_HEADROOM = 0;
+
+
+//=============================================================================
+// bpf() - There's no C library wrapper for the bpf system call
+//=============================================================================
+static int bpf(int cmd, bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+//=============================================================================
+
+
+//=============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//=============================================================================
+static inline uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// CXdpNIC() - Default constructor
+//=============================================================================
+CXdpNIC::CXdpNIC()
+{
+    m_sd            = -1;
+    m_if_idx        = 0;
+    m_umem          = nullptr;
+    m_umem_size     = 0;
+    m_frame_size    = 0;
+    m_tx_free       = nullptr;
+    m_tx_free_count = 0;
+    m_tx_chunks     = 0;
+    m_rx_held       = 0;
+    m_map_fd        = -1;
+    m_prog_fd       = -1;
+    m_link_fd       = -1;
+    m_zero_copy     = false;
+    m_native        = false;
+    memset(&m_fill, 0, sizeof(m_fill));
+    memset(&m_comp, 0, sizeof(m_comp));
+    memset(&m_rx,   0, sizeof(m_rx));
+    memset(&m_tx,   0, sizeof(m_tx));
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CXdpNIC() - Destructor.  Detaches the XDP program and frees everything
+//=============================================================================
+CXdpNIC::~CXdpNIC()
+{
+    // Closing the link detaches the XDP program from the NIC
+    if (m_link_fd >= 0) close(m_link_fd);
+    if (m_prog_fd >= 0) close(m_prog_fd);
+    if (m_map_fd  >= 0) close(m_map_fd);
+
+    ring_t* ring[] = {&m_fill, &m_comp, &m_rx, &m_tx};
+    for (ring_t* r : ring) if (r->map) munmap(r->map, r->map_size);
+
+    if (m_sd >= 0) close(m_sd);
+    if (m_umem) munmap(m_umem, m_umem_size);
+    delete[] m_tx_free;
+}
+//=============================================================================
+
+
+//=============================================================================
+// connect_nic() - Creates the UMEM and the AF_XDP socket, binds it to a queue
+//                 of the NIC and attaches the XDP program that feeds it
+//=============================================================================
+void CXdpNIC::connect_nic(const char* nic_name, int queue_id,
+                          uint32_t frame_count, uint32_t frame_size)
+{
+    // The rings are sized to half the UMEM, and ring sizes must be powers
+    // of two
+    if (frame_count < 2 || (frame_count & (frame_count - 1)))
+    {
+        fprintf(stderr, "CXdpNIC: frame_count must be a power of two\n");
+        exit(1);
+    }
+
+    // Chunks are aligned, so the kernel (and our completion-address mask)
+    // need their size to be a power of two that fits in a page
+    if (frame_size != 2048 && frame_size != 4096)
+    {
+        fprintf(stderr, "CXdpNIC: frame_size must be 2048 or 4096\n");
+        exit(1);
+    }
+
+    // Find the index of the network interface
+    m_if_idx = if_nametoindex(nic_name);
+    if (m_if_idx == 0)
+    {
+        perror("if_nametoindex");
+        exit(1);
+    }
+
+    // Open the AF_XDP socket
+    m_sd = socket(AF_XDP, SOCK_RAW, 0);
+    if (m_sd == -1)
+    {
+        perror("socket AF_XDP");
+        exit(1);
+    }
+
+    // Allocate the UMEM.  It must be page aligned, which mmap guarantees
+    m_frame_size = frame_size;
+    m_umem_size  = (size_t)frame_count * frame_size;
+    void* umem   = mmap(nullptr, m_umem_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED)
+    {
+        perror("mmap UMEM");
+        exit(1);
+    }
+    m_umem = (uint8_t*)umem;
+
+    // Register the UMEM with the socket
+    xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr       = (uint64_t)m_umem;
+    reg.len        = m_umem_size;
+    reg.chunk_size = frame_size;
+    reg.headroom   = UMEM_HEADROOM;
+    if (setsockopt(m_sd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    {
+        perror("XDP_UMEM_REG");
+        exit(1);
+    }
+
+    // Every ring has room for half of the chunks in the UMEM
+    uint32_t ring_size = frame_count / 2;
+    struct {int option; const char* name;} ring_opt[] =
+    {
+        {XDP_UMEM_FILL_RING,       "XDP_UMEM_FILL_RING"},
+        {XDP_UMEM_COMPLETION_RING, "XDP_UMEM_COMPLETION_RING"},
+        {XDP_RX_RING,              "XDP_RX_RING"},
+        {XDP_TX_RING,              "XDP_TX_RING"}
+    };
+    for (auto& opt : ring_opt)
+    {
+        if (setsockopt(m_sd, SOL_XDP, opt.option, &ring_size, sizeof(ring_size)) < 0)
+        {
+            perror(opt.name);
+            exit(1);
+        }
+    }
+
+    // Find out where each ring's indices and descriptors live
+    xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(m_sd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    {
+        perror("XDP_MMAP_OFFSETS");
+        exit(1);
+    }
+
+    // Map the rings into our address space
+    map_ring(m_fill, ring_size, XDP_UMEM_PGOFF_FILL_RING, off.fr.producer,
+             off.fr.consumer, off.fr.flags, off.fr.desc, sizeof(uint64_t));
+    map_ring(m_comp, ring_size, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr.producer,
+             off.cr.consumer, off.cr.flags, off.cr.desc, sizeof(uint64_t));
+    map_ring(m_rx,   ring_size, XDP_PGOFF_RX_RING, off.rx.producer,
+             off.rx.consumer, off.rx.flags, off.rx.desc, sizeof(xdp_desc));
+    map_ring(m_tx,   ring_size, XDP_PGOFF_TX_RING, off.tx.producer,
+             off.tx.consumer, off.tx.flags, off.tx.desc, sizeof(xdp_desc));
+
+    // The first half of the UMEM receives frames: give it all to the kernel
+    uint64_t* fill = (uint64_t*)m_fill.desc;
+    for (uint32_t i=0; i<ring_size; ++i) fill[i] = (uint64_t)i * frame_size;
+    m_fill.cached_prod = ring_size;
+    __atomic_store_n(m_fill.producer, m_fill.cached_prod, __ATOMIC_RELEASE);
+
+    // The second half of the UMEM transmits frames
+    m_tx_chunks     = frame_count - ring_size;
+    m_tx_free       = new uint64_t[m_tx_chunks];
+    m_tx_free_count = m_tx_chunks;
+    for (uint32_t i=0; i<m_tx_chunks; ++i)
+    {
+        m_tx_free[i] = (uint64_t)(frame_count - 1 - i) * frame_size;
+    }
+
+    // Bind the socket to the queue, preferring zero-copy mode
+    sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = m_if_idx;
+    sxdp.sxdp_queue_id = queue_id;
+    sxdp.sxdp_flags    = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    m_zero_copy = (bind(m_sd, (sockaddr*)&sxdp, sizeof(sxdp)) == 0);
+    if (!m_zero_copy)
+    {
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(m_sd, (sockaddr*)&sxdp, sizeof(sxdp)) < 0)
+        {
+            perror("bind AF_XDP");
+            exit(1);
+        }
+    }
+
+    // And steer the frames arriving on that queue to our socket
+    attach_program(queue_id);
+}
+//=============================================================================
+
+
+//=============================================================================
+// map_ring() - Maps one of the socket's rings into our address space
+//
+// Passed: ring      = the ring structure to fill in
+//         size      = the number of descriptors in the ring
+//         pgoff     = the mmap offset that selects which ring to map
+//         producer, consumer, flags, desc = offsets reported by the kernel
+//         desc_size = the size of a single descriptor
+//=============================================================================
+void CXdpNIC::map_ring(ring_t& ring, uint32_t size, uint64_t pgoff,
+                       uint32_t producer, uint32_t consumer, uint32_t flags,
+                       uint32_t desc, size_t desc_size)
+{
+    ring.map_size = desc + size * desc_size;
+    ring.map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_sd, pgoff);
+    if (ring.map == MAP_FAILED)
+    {
+        perror("mmap XDP ring");
+        exit(1);
+    }
+
+    uint8_t* base = (uint8_t*)ring.map;
+    ring.producer    = (uint32_t*)(base + producer);
+    ring.consumer    = (uint32_t*)(base + consumer);
+    ring.flags       = (uint32_t*)(base + flags);
+    ring.desc        = base + desc;
+    ring.size        = size;
+    ring.mask        = size - 1;
+    ring.cached_prod = *ring.producer;
+    ring.cached_cons = *ring.consumer;
+}
+//=============================================================================
+
+
+//=============================================================================
+// attach_program() - Creates an XSKMAP that holds our socket, then loads and
+//                    attaches an XDP program that redirects frames to it
+//
+// The program is the equivalent of:
+//
+//     return bpf_redirect_map(&xsk_map, ctx->rx_queue_index, XDP_PASS);
+//
+// Frames arriving on queues that have no socket in the map are passed up to
+// the kernel's networking stack as usual
+//=============================================================================
+void CXdpNIC::attach_program(int queue_id)
+{
+    bpf_attr attr;
+
+    // Create the map.  It needs an entry for every queue up to ours
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(uint32_t);
+    attr.max_entries = queue_id + 1;
+    m_map_fd = bpf(BPF_MAP_CREATE, &attr);
+    if (m_map_fd < 0)
+    {
+        perror("BPF_MAP_CREATE");
+        exit(1);
+    }
+
+    // Hand-assembled, since we don't want to depend on a BPF compiler
+    bpf_insn prog[] =
+    {
+        // r2 = ctx->rx_queue_index
+        {BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, 16, 0},
+
+        // r1 = &xsk_map (a 64-bit immediate takes two instructions)
+        {BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, m_map_fd},
+        {0, 0, 0, 0, 0},
+
+        // r3 = XDP_PASS
+        {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS},
+
+        // r0 = bpf_redirect_map(r1, r2, r3)
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map},
+
+        // return r0
+        {BPF_JMP | BPF_EXIT, 0, 0, 0, 0}
+    };
+
+    // Load the program
+    static char log[4096];
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns     = (uint64_t)prog;
+    attr.insn_cnt  = sizeof(prog) / sizeof(prog[0]);
+    attr.license   = (uint64_t)"GPL";
+    attr.log_buf   = (uint64_t)log;
+    attr.log_size  = sizeof(log);
+    attr.log_level = 1;
+    m_prog_fd = bpf(BPF_PROG_LOAD, &attr);
+    if (m_prog_fd < 0)
+    {
+        perror("BPF_PROG_LOAD");
+        fprintf(stderr, "%s\n", log);
+        exit(1);
+    }
+
+    // Attach it to the NIC, in native mode if the driver supports it
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd        = m_prog_fd;
+    attr.link_create.target_ifindex = m_if_idx;
+    attr.link_create.attach_type    = BPF_XDP;
+    attr.link_create.flags          = XDP_FLAGS_DRV_MODE;
+    m_link_fd = bpf(BPF_LINK_CREATE, &attr);
+    m_native  = (m_link_fd >= 0);
+    if (!m_native)
+    {
+        attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        m_link_fd = bpf(BPF_LINK_CREATE, &attr);
+        if (m_link_fd < 0)
+        {
+            perror("BPF_LINK_CREATE");
+            exit(1);
+        }
+    }
+
+    // Finally, put our socket into the map
+    uint32_t key = queue_id, value = m_sd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = m_map_fd;
+    attr.key    = (uint64_t)&key;
+    attr.value  = (uint64_t)&value;
+    attr.flags  = BPF_ANY;
+    if (bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    {
+        perror("BPF_MAP_UPDATE_ELEM");
+        exit(1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send() - Transmits a raw ethernet frame over the network interface
+//=============================================================================
+void CXdpNIC::send(const void* frame, uint16_t frame_length)
+{
+    frame_t desc = {frame, frame_length};
+    if (send_batch(&desc, 1) < 1)
+    {
+        printf("CXdpNIC: send failed\n");
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_batch() - Copies a batch of frames into the UMEM and transmits them
+//
+// Returns the number of frames that were queued for transmission.  This will
+// be less than "count" if we run out of transmit chunks, or if a frame is too
+// big for a chunk, in which case errno is EMSGSIZE and the batch stops there
+//=============================================================================
+int CXdpNIC::send_batch(const frame_t* frames, int count)
+{
+    int queued = 0;
+
+    while (queued < count)
+    {
+        // A frame that doesn't fit in a chunk can't be sent at all
+        uint16_t length = frames[queued].length;
+        if (length > m_frame_size - UMEM_HEADROOM)
+        {
+            errno = EMSGSIZE;
+            break;
+        }
+
+        // Find a free chunk to copy the frame into
+        uint8_t* slot = get_tx_slot();
+
+        // If there are none, push what we have and try again
+        if (slot == nullptr)
+        {
+            if (flush_tx_ring() < 0) break;
+            slot = get_tx_slot();
+            if (slot == nullptr) break;
+        }
+
+        // Copy the frame into the chunk and queue it
+        memcpy(slot, frames[queued].data, length);
+        commit_tx_slot(length);
+        ++queued;
+    }
+
+    // Kick off transmission of everything we queued, keeping the reason we
+    // stopped early (if we did) for the caller
+    int error = errno;
+    flush_tx_ring();
+    errno = error;
+
+    return queued;
+}
+//=============================================================================
+
+
+//=============================================================================
+// get_tx_slot() - Returns a pointer to a free transmit chunk, or nullptr if
+//                 every chunk is waiting to be transmitted
+//=============================================================================
+uint8_t* CXdpNIC::get_tx_slot()
+{
+    if (m_tx_free_count == 0) reclaim_tx();
+    if (m_tx_free_count == 0) return nullptr;
+    return m_umem + m_tx_free[m_tx_free_count - 1];
+}
+//=============================================================================
+
+
+//=============================================================================
+// commit_tx_slot() - Places the chunk returned by get_tx_slot() on the TX ring
+//
+// There is one TX-ring entry per transmit chunk, so the ring can't overflow
+//=============================================================================
+void CXdpNIC::commit_tx_slot(uint16_t frame_length)
+{
+    xdp_desc& desc = ((xdp_desc*)m_tx.desc)[m_tx.cached_prod & m_tx.mask];
+    desc.addr    = m_tx_free[--m_tx_free_count];
+    desc.len     = frame_length;
+    desc.options = 0;
+    ++m_tx.cached_prod;
+}
+//=============================================================================
+
+
+//=============================================================================
+// flush_tx_ring() - Publishes every committed frame to the kernel and kicks it
+//                   into transmitting them
+//
+// In copy mode, the kernel only transmits from within the kick, so we keep
+// kicking until the TX ring has drained.  If "wait" is true, we also wait
+// (for at most "timeout_ms") for every frame to complete.  A link that's
+// down never completes anything, so the wait can't be open-ended.  Returns
+// 0, or -1 on error or timeout
+//=============================================================================
+int CXdpNIC::flush_tx_ring(bool wait, int timeout_ms)
+{
+    // Make the committed descriptors visible to the kernel
+    __atomic_store_n(m_tx.producer, m_tx.cached_prod, __ATOMIC_RELEASE);
+
+    uint64_t deadline = wait ? now_ns() + timeout_ms * 1000000ULL : 0;
+
+    while (true)
+    {
+        uint32_t before = __atomic_load_n(m_tx.consumer, __ATOMIC_ACQUIRE);
+
+        // Kick the kernel if it has asked us to (or if it's in copy mode)
+        if (!m_zero_copy || (*m_tx.flags & XDP_RING_NEED_WAKEUP))
+        {
+            int rc = sendto(m_sd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+            if (rc < 0 && errno != EAGAIN && errno != EBUSY
+                       && errno != ENOBUFS && errno != ENETDOWN)
+            {
+                perror("sendto AF_XDP");
+                return -1;
+            }
+        }
+
+        // Recycle the chunks of frames that have been transmitted
+        reclaim_tx();
+
+        // Are there frames the kernel hasn't picked up yet?
+        uint32_t after = __atomic_load_n(m_tx.consumer, __ATOMIC_ACQUIRE);
+        bool pending = (after != m_tx.cached_prod);
+
+        // If we're waiting, keep going until every chunk is back, or we
+        // run out of time.  Let the kernel have the CPU while it's stalled
+        if (wait)
+        {
+            if (m_tx_free_count == m_tx_chunks) break;
+            if (after == before)
+            {
+                if (now_ns() >= deadline)
+                {
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+                sched_yield();
+            }
+            continue;
+        }
+
+        // Otherwise, stop once the kernel has everything, or stops making
+        // progress, or it will transmit on its own (zero-copy mode)
+        if (!pending || after == before || m_zero_copy) break;
+    }
+
+    return 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// reclaim_tx() - Moves the chunks of frames that have finished transmitting
+//                from the completion ring back to the free list
+//=============================================================================
+void CXdpNIC::reclaim_tx()
+{
+    uint32_t producer = __atomic_load_n(m_comp.producer, __ATOMIC_ACQUIRE);
+    if (producer == m_comp.cached_cons) return;
+
+    const uint64_t* comp = (const uint64_t*)m_comp.desc;
+    while (m_comp.cached_cons != producer)
+    {
+        m_tx_free[m_tx_free_count++] = comp[m_comp.cached_cons++ & m_comp.mask];
+    }
+
+    // Tell the kernel we're done with those completion entries
+    __atomic_store_n(m_comp.consumer, m_comp.cached_cons, __ATOMIC_RELEASE);
+}
+//=============================================================================
+
+
+//=============================================================================
+// receive_block() - Waits for received frames, and fills in a descriptor for
+//                   each of them
+//
+// AF_XDP doesn't timestamp frames, so every frame returned by a single call
+// is stamped with the (CLOCK_REALTIME) time we picked it up
+//
+// Returns the number of frames filled in, 0 on timeout
+//=============================================================================
+int CXdpNIC::receive_block(rx_frame_t* frames, int max_frames, int timeout_ms)
+{
+    // How many frames are in the RX ring that we haven't handed out yet?
+    uint32_t first = m_rx.cached_cons + m_rx_held;
+    uint32_t avail = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE) - first;
+
+    // If there are none, wait for some to arrive
+    if (avail == 0)
+    {
+        pollfd pfd;
+        pfd.fd      = m_sd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+        avail = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE) - first;
+        if (avail == 0) return 0;
+    }
+
+    if (avail > (uint32_t)max_frames) avail = max_frames;
+
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    // Fill in a descriptor for each frame
+    const xdp_desc* desc = (const xdp_desc*)m_rx.desc;
+    for (uint32_t i=0; i<avail; ++i)
+    {
+        const xdp_desc& d = desc[(first + i) & m_rx.mask];
+        frames[i].data   = m_umem + d.addr;
+        frames[i].length = d.len;
+        frames[i].sec    = ts.tv_sec;
+        frames[i].nsec   = ts.tv_nsec;
+        frames[i].wire_length = d.len;
+    }
+
+    // We own these frames until release_block() is called
+    m_rx_held += avail;
+    return avail;
+}
+//=============================================================================
+
+
+//=============================================================================
+// release_block() - Hands the chunks of every frame returned by
+//                   receive_block() back to the kernel via the fill ring
+//=============================================================================
+void CXdpNIC::release_block()
+{
+    if (m_rx_held == 0) return;
+
+    // The fill ring has room for every receive chunk, so it can't overflow
+    const xdp_desc* desc = (const xdp_desc*)m_rx.desc;
+    uint64_t*       fill = (uint64_t*)m_fill.desc;
+    uint64_t        mask = ~(uint64_t)(m_frame_size - 1);
+    for (uint32_t i=0; i<m_rx_held; ++i)
+    {
+        uint64_t addr = desc[m_rx.cached_cons++ & m_rx.mask].addr;
+        fill[m_fill.cached_prod++ & m_fill.mask] = addr & mask;
+    }
+    m_rx_held = 0;
+
+    // Publish the new fill entries, then free the RX-ring entries
+    __atomic_store_n(m_fill.producer, m_fill.cached_prod, __ATOMIC_RELEASE);
+    __atomic_store_n(m_rx.consumer,   m_rx.cached_cons,   __ATOMIC_RELEASE);
+
+    // If the kernel ran dry of fill entries, it may need a nudge
+    if (*m_fill.flags & XDP_RING_NEED_WAKEUP)
+    {
+        recvfrom(m_sd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+}
+//=============================================================================
@@ -0,0 +1,149 @@
+//=============================================================================
+// raw_xdp.h - This class sends and receives raw ethernet frames through an
+//             AF_XDP socket
+//
+// Author: D. Wolf
+//
+// It offers the same send/receive API as CRawNIC, but frames live in a
+// shared "UMEM" area that the kernel (or the NIC, in zero-copy mode) reads
+// and writes directly, bypassing most of the kernel's networking stack.
+//
+// To use this class:
+//
+// (1) declare an instance of "CXdpNIC"
+//
+// (2) call "connect_nic()".  This binds an AF_XDP socket to one receive
+//     queue of the NIC and attaches a small XDP program that steers the
+//     frames arriving on that queue to us.  Zero-copy and native XDP are
+//     tried first; if the driver doesn't support them (veth, for instance)
+//     we fall back to copy mode and generic ("SKB") XDP
+//
+// (3) call "send()"/"send_batch()" just like CRawNIC, or build frames
+//     in-place with "get_tx_slot()", "commit_tx_slot()" and
+//     "flush_tx_ring()"
+//
+// (4) call "receive_block()" and "release_block()" to receive frames
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "raw_nic.h"
+
+class CXdpNIC
+{
+public:
+
+    // Frame descriptors are the same as CRawNIC's
+    typedef CRawNIC::frame_t    frame_t;
+    typedef CRawNIC::rx_frame_t rx_frame_t;
+
+    // Constructor and destructor
+    CXdpNIC();
+    ~CXdpNIC();
+
+    // Binds to receive-queue "queue_id" of the NIC.  The UMEM is made of
+    // "frame_count" chunks of "frame_size" bytes; half are used to receive
+    // and half to transmit.  "frame_size" must be 2048 or 4096
+    void    connect_nic(const char* nic_name, int queue_id = 0,
+                        uint32_t frame_count = 4096, uint32_t frame_size = 2048);
+
+    // Returns true if the socket is running in zero-copy mode
+    bool    is_zero_copy() const {return m_zero_copy;}
+
+    // Returns true if the XDP program is attached in native (driver) mode
+    bool    is_native() const {return m_native;}
+
+    // Copies a frame into the UMEM and transmits it
+    void    send(const void* frame, uint16_t frame_length);
+
+    // Copies "count" frames into the UMEM and transmits them.  Returns the
+    // number of frames that were queued for transmission.  A frame too big
+    // for a chunk stops the batch, with errno set to EMSGSIZE
+    int     send_batch(const frame_t* frames, int count);
+
+    // Returns a pointer to a free UMEM chunk to build a frame in, or nullptr
+    // if every transmit chunk is in flight
+    uint8_t* get_tx_slot();
+
+    // Queues the chunk returned by get_tx_slot() for transmission
+    void    commit_tx_slot(uint16_t frame_length);
+
+    // Tells the kernel about every committed frame, and reclaims the chunks
+    // of frames that have finished transmitting.  If "wait" is true, waits
+    // up to "timeout_ms" for every frame to finish.  Returns 0, or -1 on
+    // error or if the wait timed out (errno is then ETIMEDOUT)
+    int     flush_tx_ring(bool wait = false, int timeout_ms = 1000);
+
+    // Waits up to "timeout_ms" (-1 = forever) for received frames and fills
+    // in up to "max_frames" frame descriptors.  Returns the number of frames
+    // filled in.  The frames remain valid until release_block() is called
+    int     receive_block(rx_frame_t* frames, int max_frames, int timeout_ms = -1);
+
+    // Hands the chunks of every frame returned by receive_block() back to
+    // the kernel
+    void    release_block();
+
+protected:
+
+    // A producer/consumer ring that's shared with the kernel
+    struct ring_t
+    {
+        uint32_t*   producer;
+        uint32_t*   consumer;
+        uint32_t*   flags;
+        void*       desc;
+        uint32_t    mask;
+        uint32_t    size;
+
+        // Our private copies of the indices we own
+        uint32_t    cached_prod;
+        uint32_t    cached_cons;
+
+        // The address and length of the ring's mapping
+        void*       map;
+        size_t      map_size;
+    };
+
+    // Maps one of the socket's rings into our address space
+    void    map_ring(ring_t& ring, uint32_t size, uint64_t pgoff,
+                     uint32_t producer, uint32_t consumer, uint32_t flags,
+                     uint32_t desc, size_t desc_size);
+
+    // Creates the XSKMAP and XDP program, and attaches it to the NIC
+    void    attach_program(int queue_id);
+
+    // Moves the chunks of frames that have been sent to the free list
+    void    reclaim_tx();
+
+    // The AF_XDP socket, and the interface and queue it's bound to
+    int     m_sd;
+    int     m_if_idx;
+
+    // The UMEM area, and the size of each chunk in it
+    uint8_t*    m_umem;
+    size_t      m_umem_size;
+    uint32_t    m_frame_size;
+
+    // The fill, completion, RX and TX rings
+    ring_t      m_fill;
+    ring_t      m_comp;
+    ring_t      m_rx;
+    ring_t      m_tx;
+
+    // A stack of transmit chunks that are free to use
+    uint64_t*   m_tx_free;
+    uint32_t    m_tx_free_count;
+    uint32_t    m_tx_chunks;
+
+    // The number of frames returned by receive_block() that we still own
+    uint32_t    m_rx_held;
+
+    // File descriptors for the XSKMAP, the XDP program and its link
+    int         m_map_fd;
+    int         m_prog_fd;
+    int         m_link_fd;
+
+    // How we ended up attached
+    bool        m_zero_copy;
+    bool        m_native;
+};
@@ -0,0 +1,124 @@
+//=============================================================================
+// rdmx_bulk.cpp - Class for sending a large buffer as a stream of RDMX frames
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include "rdmx_bulk.h"
+
+// The size of an Ethernet/IPv4/UDP/RDMX header, and the room each one takes
+// up in the header pool, rounded up to a whole number of cache-lines
+static const int RDMX_HEADER_SIZE = CRawRDMX::HEADER_SIZE;
+static const int HEADER_STRIDE    = (RDMX_HEADER_SIZE + 63) & ~63;
+
+
+//=============================================================================
+// CRdmxBulk() - Constructor
+//=============================================================================
+CRdmxBulk::CRdmxBulk(CRawNIC& nic, CRawRDMX& header, int batch_size)
+    : m_nic(nic), m_header(header)
+{
+    m_batch_size  = batch_size;
+
+    // Each header gets its own cache-line
+    m_header_pool = (uint8_t*)aligned_alloc(64, batch_size * HEADER_STRIDE);
+
+    // Each frame is sent as a header and a payload
+    m_iov = new iovec[2 * batch_size];
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CRdmxBulk() - Destructor
+//=============================================================================
+CRdmxBulk::~CRdmxBulk()
+{
+    free(m_header_pool);
+    delete[] m_iov;
+}
+//=============================================================================
+
+
+//=============================================================================
+// fill_pattern() - Fills a buffer with a test pattern, seeding each frame's
+//                  worth with the target address that frame will carry
+//=============================================================================
+void CRdmxBulk::fill_pattern(void* buffer, uint64_t length, uint64_t target_addr,
+                             pattern_t pattern, uint16_t max_payload)
+{
+    uint8_t* payload = (uint8_t*)buffer;
+    if (max_payload == 0) return;
+
+    for (uint64_t offset = 0; offset < length; offset += max_payload)
+    {
+        uint32_t payload_length = max_payload;
+        if (length - offset < max_payload) payload_length = length - offset;
+        fill_payload(payload + offset, payload_length, pattern, target_addr + offset);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send() - Splits a buffer into RDMX frames and transmits them in batches
+//=============================================================================
+uint64_t CRdmxBulk::send(const void* buffer, uint64_t length, uint64_t target_addr,
+                         uint16_t max_payload)
+{
+    const uint8_t* payload = (const uint8_t*)buffer;
+    uint64_t       bytes_sent = 0;
+
+    // With no room for a payload, we'd never get anywhere
+    if (max_payload == 0)
+    {
+        fprintf(stderr, "CRdmxBulk::send(): max_payload must be non-zero\n");
+        return 0;
+    }
+
+    while (bytes_sent < length)
+    {
+        uint64_t batch_bytes = 0;
+        int      count = 0;
+
+        // Build a batch of frames
+        while (count < m_batch_size && bytes_sent + batch_bytes < length)
+        {
+            uint64_t offset = bytes_sent + batch_bytes;
+
+            // How many bytes of the buffer will this frame carry?
+            uint16_t payload_length = max_payload;
+            if (length - offset < max_payload) payload_length = length - offset;
+
+            // Build the header in the pool
+            uint8_t* header = m_header_pool + count * HEADER_STRIDE;
+            m_header.write_header(header, payload_length, target_addr + offset,
+                                  payload + offset);
+
+            // The frame is the header followed by a slice of the buffer
+            m_iov[2*count    ].iov_base = header;
+            m_iov[2*count    ].iov_len  = RDMX_HEADER_SIZE;
+            m_iov[2*count + 1].iov_base = (void*)(payload + offset);
+            m_iov[2*count + 1].iov_len  = payload_length;
+
+            batch_bytes += payload_length;
+            ++count;
+        }
+
+        // Hand the batch to the kernel, waiting out a full queue.  If it
+        // still won't take all of it, tell the caller how far we got
+        int sent = m_nic.send_all(m_iov, 2, count);
+        if (sent < count)
+        {
+            for (int i=0; i<sent; ++i) bytes_sent += m_iov[2*i + 1].iov_len;
+            return bytes_sent;
+        }
+
+        // The entire batch has been sent
+        bytes_sent += batch_bytes;
+    }
+
+    return bytes_sent;
+}
+//=============================================================================
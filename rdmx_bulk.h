@@ -0,0 +1,63 @@
+//=============================================================================
+// rdmx_bulk.h - Class for sending a large buffer as a stream of RDMX frames
+//
+// Author: D. Wolf
+//
+// The buffer is carved into frames of at most "max_payload" bytes, and the
+// RDMX target address is stepped along with it.  The headers are built in a
+// small pool of our own; the payload of each frame is sent straight from the
+// caller's buffer, so payload bytes are never copied in user space.
+//
+// To use this class:
+//
+// (1) set up a CRawNIC and a CRawRDMX header template as usual
+//
+// (2) declare an instance of "CRdmxBulk" that refers to them
+//
+// (3) call "send()" for each buffer you want to transfer.  To send test
+//     patterns, fill the buffer with "fill_pattern()" first
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <sys/uio.h>
+#include "raw_nic.h"
+#include "raw_rdmx.h"
+#include "payload.h"
+
+class CRdmxBulk
+{
+public:
+
+    // "batch_size" is the number of frames handed to the kernel at once
+    CRdmxBulk(CRawNIC& nic, CRawRDMX& header, int batch_size = 64);
+    ~CRdmxBulk();
+
+    // Sends "length" bytes from "buffer" so that they land at "target_addr"
+    // onward at the receiver.  A full transmit queue is waited out.  Returns
+    // the number of payload bytes that were handed to the kernel, which is
+    // less than "length" only on a hard error, if the queue stays full for
+    // a second, or if "max_payload" is 0
+    uint64_t    send(const void* buffer, uint64_t length, uint64_t target_addr,
+                     uint16_t max_payload = 8192);
+
+    // Fills "buffer" with a test pattern, one frame's worth at a time, so
+    // that every payload send() carves out of it (with the same
+    // "target_addr" and "max_payload") passes a CPayloadChecker
+    static void fill_pattern(void* buffer, uint64_t length, uint64_t target_addr,
+                             pattern_t pattern, uint16_t max_payload = 8192);
+
+protected:
+
+    // The NIC we transmit on, and the template we build headers from
+    CRawNIC&    m_nic;
+    CRawRDMX&   m_header;
+
+    // Maximum number of frames per batch
+    int         m_batch_size;
+
+    // Room to build "m_batch_size" frame headers
+    uint8_t*    m_header_pool;
+
+    // Two I/O vectors (header and payload) per frame in the batch
+    iovec*      m_iov;
+};
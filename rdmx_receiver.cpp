@@ -0,0 +1,176 @@
+//=============================================================================
+// rdmx_receiver.cpp - A software RDMX endpoint
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include "rdmx_receiver.h"
+#include "frame_parser.h"
+
+
+//=============================================================================
+// CRdmxReceiver() - Default constructor
+//=============================================================================
+CRdmxReceiver::CRdmxReceiver()
+{
+    m_base        = nullptr;
+    m_size        = 0;
+    m_mapped_size = 0;
+    m_port        = 11111;
+    reset_counters();
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CRdmxReceiver() - Destructor.  Unmaps the region if we allocated it
+//=============================================================================
+CRdmxReceiver::~CRdmxReceiver()
+{
+    if (m_mapped_size) munmap(m_base, m_mapped_size);
+}
+//=============================================================================
+
+
+//=============================================================================
+// set_region() - Defines the memory region that RDMX payloads are stored in
+//=============================================================================
+void CRdmxReceiver::set_region(void* base, uint64_t size)
+{
+    // If we had allocated a region of our own, we no longer need it
+    if (m_mapped_size) munmap(m_base, m_mapped_size);
+    m_mapped_size = 0;
+
+    m_base = (uint8_t*)base;
+    m_size = size;
+}
+//=============================================================================
+
+
+//=============================================================================
+// map_region() - Allocates a memory region for RDMX payloads to be stored in
+//=============================================================================
+void* CRdmxReceiver::map_region(uint64_t size, bool hugepages)
+{
+    void* region = MAP_FAILED;
+
+    // If we've been asked to, try to back the region with 2MB huge pages
+    if (hugepages)
+    {
+        uint64_t huge_size = (size + 0x1FFFFF) & ~(uint64_t)0x1FFFFF;
+        region = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (region != MAP_FAILED) size = huge_size;
+    }
+
+    // If we don't have a region yet, use ordinary pages
+    if (region == MAP_FAILED)
+    {
+        region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+
+    // If we couldn't allocate the region, barf
+    if (region == MAP_FAILED)
+    {
+        perror("mmap RDMX region");
+        exit(1);
+    }
+
+    // Start using the new region
+    set_region(region, size);
+    m_mapped_size = size;
+    return region;
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset_counters() - Sets all of the completion counters to zero
+//=============================================================================
+void CRdmxReceiver::reset_counters()
+{
+    m_frames.store(0, std::memory_order_relaxed);
+    m_bytes.store(0, std::memory_order_relaxed);
+    m_out_of_bounds.store(0, std::memory_order_relaxed);
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_frame() - Validates an Ethernet/IPv4/UDP/RDMX frame and copies its
+//                  payload to (base + target_addr)
+//
+// Returns true if the payload was stored
+//=============================================================================
+bool CRdmxReceiver::handle_frame(const void* frame, uint32_t length)
+{
+    // Find the UDP datagram inside the frame
+    udp_frame_t udp;
+    if (!parse_udp_frame(frame, length, udp)) return false;
+
+    // It has to be addressed to our RDMX port
+    if (udp.udp->dst_port != htons(m_port)) return false;
+
+    // It has to carry an RDMX header with the RDMX magic number
+    if (udp.payload_length < sizeof(rdmx_hdr_t)) return false;
+    const rdmx_hdr_t& rdmx = *(const rdmx_hdr_t*)udp.payload;
+    if (rdmx.magic != htons(0x0122)) return false;
+
+    // Determine the length of the payload
+    uint32_t payload_length = udp.payload_length - sizeof(rdmx_hdr_t);
+
+    // Make sure the payload falls entirely within our region
+    uint64_t target_addr = be64toh(rdmx.target_addr);
+    if (target_addr > m_size || payload_length > m_size - target_addr)
+    {
+        m_out_of_bounds.store(m_out_of_bounds.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+        return false;
+    }
+
+    // Store the payload into the region
+    memcpy(m_base + target_addr, udp.payload + sizeof(rdmx_hdr_t), payload_length);
+
+    // And let consumers know that it has arrived
+    m_frames.store(m_frames.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    m_bytes.store(m_bytes.load(std::memory_order_relaxed) + payload_length, std::memory_order_release);
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// poll() - Receives a block of frames from the NIC and handles every frame in
+//          it.  Returns the number of RDMX payloads that were stored
+//=============================================================================
+int CRdmxReceiver::poll(CRawNIC& nic, int timeout_ms)
+{
+    CRawNIC::rx_frame_t frame[64];
+    int stored = 0;
+
+    // Fetch the first batch of frames, waiting for it if we need to
+    int count = nic.receive_block(frame, 64, timeout_ms);
+
+    // Handle every frame in the block
+    while (count)
+    {
+        for (int i=0; i<count; ++i)
+        {
+            if (handle_frame(frame[i].data, frame[i].length)) ++stored;
+        }
+        count = nic.receive_block(frame, 64, 0);
+    }
+
+    // We're done with the block, give it back to the kernel
+    nic.release_block();
+
+    // Tell the caller how many payloads we stored
+    return stored;
+}
+//=============================================================================
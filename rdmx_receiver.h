@@ -0,0 +1,88 @@
+//=============================================================================
+// rdmx_receiver.h - A software RDMX endpoint
+//
+// Author: D. Wolf
+//
+// This class does in software what an RDMX-capable FPGA does in hardware: it
+// accepts Ethernet/IPv4/UDP/RDMX frames and copies each payload to offset
+// "target_addr" within a memory region that we've been given.
+//
+// To use this class:
+//
+// (1) declare an instance of "CRdmxReceiver"
+//
+// (2) call either "set_region()" or "map_region()" to define the memory
+//     region that RDMX payloads are written into
+//
+// (3) call "poll()" in a loop to receive frames from a CRawNIC that has had
+//     its RX ring enabled, or feed frames to "handle_frame()" yourself
+//
+// (4) call "bytes_received()" to find out how much data has arrived
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include "raw_nic.h"
+
+class CRdmxReceiver
+{
+public:
+
+    // Constructor and destructor
+    CRdmxReceiver();
+    ~CRdmxReceiver();
+
+    // Call this to use a memory region that the caller owns
+    void        set_region(void* base, uint64_t size);
+
+    // Call this to allocate a region.  If "hugepages" is true, we'll try to
+    // back the region with huge pages first.  Returns the region's address
+    void*       map_region(uint64_t size, bool hugepages = true);
+
+    // Call this to define the UDP port we accept RDMX frames on
+    void        set_udp_port(uint16_t port = 11111) {m_port = port;}
+
+    // Returns the UDP port we accept RDMX frames on
+    uint16_t    udp_port() const {return m_port;}
+
+    // Parses a single Ethernet frame and, if it is a valid RDMX frame that
+    // fits within the region, copies its payload into place.  Returns true
+    // if the payload was stored
+    bool        handle_frame(const void* frame, uint32_t length);
+
+    // Waits for one block of frames from the NIC and handles every frame in
+    // it.  Returns the number of RDMX payloads that were stored
+    int         poll(CRawNIC& nic, int timeout_ms = -1);
+
+    // Call these to find out how many payloads and payload bytes have been
+    // stored.  Payload data is visible once it's been counted
+    uint64_t    frames_received() const {return m_frames.load(std::memory_order_acquire);}
+    uint64_t    bytes_received()  const {return m_bytes.load(std::memory_order_acquire);}
+
+    // The number of RDMX frames dropped because they fell outside the region
+    uint64_t    out_of_bounds()   const {return m_out_of_bounds.load(std::memory_order_relaxed);}
+
+    // Call this to reset all of the counters to zero
+    void        reset_counters();
+
+    // Returns the base address and size of the target region
+    uint8_t*    base() const {return m_base;}
+    uint64_t    size() const {return m_size;}
+
+protected:
+
+    // The region that RDMX payloads are written into
+    uint8_t*    m_base;
+    uint64_t    m_size;
+
+    // If we allocated the region ourselves, this is the size of the mapping
+    uint64_t    m_mapped_size;
+
+    // The UDP port that RDMX frames are addressed to
+    uint16_t    m_port;
+
+    // Completion counters.  These are written only by the receiving thread
+    std::atomic<uint64_t> m_frames;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_out_of_bounds;
+};
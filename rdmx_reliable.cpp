@@ -0,0 +1,603 @@
+//=============================================================================
+// rdmx_reliable.cpp - Selective retransmission for RDMX transfers
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include "rdmx_reliable.h"
+#include "frame_parser.h"
+
+// The size of an Ethernet/IPv4/UDP/RDMX header
+static const int RDMX_HEADER_SIZE = CRawRDMX::HEADER_SIZE;
+
+// A frame that has just been resent isn't resent again for this long, so
+// that status frames sent while it's in flight don't cause duplicates
+static const uint64_t RESEND_HOLDOFF_NS = 2000000;
+
+// While waiting for acknowledgements, the sender asks for a status frame
+// this often
+static const int SYNC_INTERVAL_MS = 2;
+
+// The sender gives up if nothing is acknowledged for this long
+static const uint64_t ACK_TIMEOUT_NS = 1000000000;
+
+
+//=============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//=============================================================================
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// find_ctrl() - If "frame" is a control frame addressed to UDP port "port"
+//               (in network byte order), returns a pointer to its control
+//               header.  Otherwise returns nullptr
+//=============================================================================
+static const rdmx_ctrl_hdr_t* find_ctrl(const void* frame, uint32_t length, uint16_t port)
+{
+    // Find the UDP datagram inside the frame
+    udp_frame_t udp;
+    if (!parse_udp_frame(frame, length, udp)) return nullptr;
+    if (udp.udp->dst_port != port) return nullptr;
+
+    // It has to carry the control magic number, and all of its ranges
+    if (udp.payload_length < sizeof(rdmx_ctrl_hdr_t)) return nullptr;
+    const rdmx_ctrl_hdr_t* ctrl = (const rdmx_ctrl_hdr_t*)udp.payload;
+    if (ctrl->magic != htons(RDMX_CTRL_MAGIC)) return nullptr;
+
+    uint32_t ctrl_length = sizeof(rdmx_ctrl_hdr_t) + ctrl->count * sizeof(rdmx_ctrl_range_t);
+    if (ctrl_length > udp.payload_length) return nullptr;
+
+    return ctrl;
+}
+//=============================================================================
+
+
+
+//=============================================================================
+// CRdmxReliableSender() - Constructor
+//=============================================================================
+CRdmxReliableSender::CRdmxReliableSender(CRawNIC& nic, CRawRDMX& header, uint32_t window,
+                                         int batch_size)
+    : m_nic(nic), m_header(header)
+{
+    m_batch_size = batch_size;
+
+    // Each header gets its own cache-line
+    m_header_pool = (uint8_t*)aligned_alloc(64, batch_size * RDMX_HEADER_SIZE);
+
+    // Each frame is sent as a header and a payload
+    m_iov = new iovec[2 * batch_size];
+
+    // The window is a power of two, so a sequence number can index it
+    uint32_t size = 64;
+    while (size < window) size <<= 1;
+    m_window.resize(size);
+    m_mask = size - 1;
+
+    // Every frame we send needs a sequence number
+    if (!m_header.sequencing()) m_header.set_sequencing(true);
+    m_first_seq = m_header.next_seq();
+    m_acked     = m_first_seq;
+
+    // No loss until we're told otherwise
+    set_loss(0);
+
+    m_sent          = 0;
+    m_retransmits   = 0;
+    m_dropped       = 0;
+    m_unrecoverable = 0;
+    m_status_frames = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CRdmxReliableSender() - Destructor
+//=============================================================================
+CRdmxReliableSender::~CRdmxReliableSender()
+{
+    free(m_header_pool);
+    delete[] m_iov;
+}
+//=============================================================================
+
+
+//=============================================================================
+// set_loss() - Drops a fraction of the frames we send, to simulate loss
+//=============================================================================
+void CRdmxReliableSender::set_loss(double probability, uint64_t seed)
+{
+    m_loss = probability;
+    m_rng  = seed ? seed : 1;
+}
+//=============================================================================
+
+
+//=============================================================================
+// should_drop() - Returns true if the next frame should be dropped.  This is
+//                 a xorshift generator compared against the loss probability
+//=============================================================================
+bool CRdmxReliableSender::should_drop()
+{
+    if (m_loss <= 0) return false;
+
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 7;
+    m_rng ^= m_rng << 17;
+
+    return (m_rng >> 11) * 0x1.0p-53 < m_loss;
+}
+//=============================================================================
+
+
+//=============================================================================
+// add_to_batch() - Builds the header of a frame in slot "count" of the batch
+//
+// A first transmission always takes the next sequence number, even if it's
+// then dropped, so that the receiver sees a gap
+//=============================================================================
+bool CRdmxReliableSender::add_to_batch(int count, const sent_t& frame, bool resend)
+{
+    uint8_t* header = m_header_pool + count * RDMX_HEADER_SIZE;
+
+    if (resend)
+        m_header.rewrite_header(header, frame.length, frame.target_addr, frame.seq, frame.payload);
+    else
+        m_header.write_header(header, frame.length, frame.target_addr, frame.payload);
+
+    if (should_drop())
+    {
+        ++m_dropped;
+        return false;
+    }
+
+    // The frame is the header followed by a slice of the caller's buffer
+    m_iov[2*count    ].iov_base = header;
+    m_iov[2*count    ].iov_len  = RDMX_HEADER_SIZE;
+    m_iov[2*count + 1].iov_base = (void*)frame.payload;
+    m_iov[2*count + 1].iov_len  = frame.length;
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_batch() - Hands a batch to the kernel, waiting out a full queue.
+//                Returns the number of frames it took
+//=============================================================================
+int CRdmxReliableSender::send_batch(int count)
+{
+    return count ? m_nic.send_all(m_iov, 2, count) : 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send() - Splits a buffer into RDMX frames and transmits them in batches,
+//          never getting more than a window ahead of the receiver
+//=============================================================================
+uint64_t CRdmxReliableSender::send(const void* buffer, uint64_t length, uint64_t target_addr,
+                                   uint16_t max_payload)
+{
+    const uint8_t* payload = (const uint8_t*)buffer;
+    uint64_t       bytes_sent = 0;
+    uint64_t       stalled_since = 0;
+
+    while (bytes_sent < length)
+    {
+        // Resend whatever the receiver has asked for
+        poll(0);
+
+        // How many more frames can we send before we're a window ahead?
+        uint32_t in_flight = m_header.next_seq() - m_acked;
+        uint32_t room      = m_window.size() - in_flight;
+
+        // If there's no room, ask the receiver where it's at, and wait for
+        // it to tell us.  If it never does, give up
+        if (room == 0)
+        {
+            uint64_t now = now_ns();
+            if (stalled_since == 0) stalled_since = now;
+            if (now - stalled_since > ACK_TIMEOUT_NS) break;
+            send_sync();
+            poll(SYNC_INTERVAL_MS);
+            continue;
+        }
+        stalled_since = 0;
+
+        // Build a batch of frames
+        int      count = 0;
+        uint32_t built = 0;
+        while (built < (uint32_t)m_batch_size && built < room && bytes_sent < length)
+        {
+            // How many bytes of the buffer will this frame carry?
+            uint16_t payload_length = max_payload;
+            if (length - bytes_sent < max_payload) payload_length = length - bytes_sent;
+
+            // Remember the frame in case we have to send it again
+            sent_t& frame     = m_window[m_header.next_seq() & m_mask];
+            frame.payload     = payload + bytes_sent;
+            frame.target_addr = target_addr + bytes_sent;
+            frame.resent_ns   = 0;
+            frame.seq         = m_header.next_seq();
+            frame.length      = payload_length;
+
+            if (add_to_batch(count, frame, false)) ++count;
+
+            bytes_sent += payload_length;
+            ++built;
+        }
+
+        // Hand the batch to the kernel.  If it won't take it even after
+        // waiting for room, something is badly wrong
+        int sent = send_batch(count);
+        m_sent += sent;
+        if (sent < count) break;
+    }
+
+    return bytes_sent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// poll() - Receives a block of frames and handles any status frames in it.
+//          Returns the number of frames that were resent
+//=============================================================================
+int CRdmxReliableSender::poll(int timeout_ms)
+{
+    CRawNIC::rx_frame_t frame[64];
+    int resent = 0;
+
+    // Fetch the first batch of frames, waiting for it if we need to
+    int count = m_nic.receive_block(frame, 64, timeout_ms);
+
+    // Handle every frame in the block
+    while (count)
+    {
+        for (int i=0; i<count; ++i) resent += handle_frame(frame[i].data, frame[i].length);
+        count = m_nic.receive_block(frame, 64, 0);
+    }
+
+    // We're done with the block, give it back to the kernel
+    m_nic.release_block();
+
+    return resent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_frame() - If this is a status frame from the receiver, notes what's
+//                  been acknowledged and resends what's missing.  Returns the
+//                  number of frames resent
+//=============================================================================
+int CRdmxReliableSender::handle_frame(const void* frame, uint32_t length)
+{
+    // Status frames come back to the port we send from
+    uint16_t port = m_header.builder().hdr<udp_layer_t>().src_port;
+
+    const rdmx_ctrl_hdr_t* ctrl = find_ctrl(frame, length, port);
+    if (ctrl == nullptr || ctrl->type != RDMX_CTRL_STATUS) return 0;
+    ++m_status_frames;
+
+    // Everything from "first_seq" up to "next_seq" has arrived.  That's only
+    // an acknowledgement if "first_seq" is where we started
+    uint32_t first = ntohl(ctrl->first_seq);
+    uint32_t acked = ntohl(ctrl->next_seq);
+    if ((int32_t)(first - m_first_seq) <= 0 && (int32_t)(acked - m_acked) > 0) m_acked = acked;
+
+    uint32_t next_seq = m_header.next_seq();
+    uint64_t now      = now_ns();
+    const rdmx_ctrl_range_t* range = (const rdmx_ctrl_range_t*)(ctrl + 1);
+    int count = 0, resent = 0;
+
+    // Resend every frame in every missing range
+    for (int r=0; r<ctrl->count; ++r)
+    {
+        uint32_t first = ntohl(range[r].first);
+        uint32_t total = ntohl(range[r].count);
+        if (total > m_window.size()) total = m_window.size();
+
+        for (uint32_t seq = first; seq != first + total; ++seq)
+        {
+            // Ignore anything we haven't sent, or that's been acknowledged
+            if ((int32_t)(seq - next_seq) >= 0 || (int32_t)(seq - m_acked) < 0) continue;
+
+            // If it's left the window, it's gone for good
+            sent_t& sent = m_window[seq & m_mask];
+            if (sent.seq != seq || sent.payload == nullptr)
+            {
+                ++m_unrecoverable;
+                continue;
+            }
+
+            // If we've just resent it, it's probably still on its way
+            if (now - sent.resent_ns < RESEND_HOLDOFF_NS) continue;
+            sent.resent_ns = now;
+
+            if (add_to_batch(count, sent, true)) ++count;
+            if (count == m_batch_size)
+            {
+                resent += send_batch(count);
+                count = 0;
+            }
+        }
+    }
+
+    resent += send_batch(count);
+
+    m_retransmits += resent;
+    return resent;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_sync() - Tells the receiver which sequence numbers we've sent, which
+//               makes it reply with a status frame.  "type" is SYNC, or FIN
+//               if there's nothing more to come
+//=============================================================================
+void CRdmxReliableSender::send_sync(uint8_t type)
+{
+    uint8_t frame[CRawUDP::HEADER_SIZE + sizeof(rdmx_ctrl_hdr_t)];
+
+    // A SYNC frame is addressed the same way as our data frames
+    CRawRDMX::builder_t& builder = m_header.builder();
+    eth_hdr_t&  eth  = builder.hdr<eth_layer_t>();
+    ipv4_hdr_t& ipv4 = builder.hdr<ipv4_layer_t>();
+    udp_hdr_t&  udp  = builder.hdr<udp_layer_t>();
+    m_ctrl.set_mac_addrs(eth.src_mac, eth.dst_mac);
+    m_ctrl.set_ip_addrs(ipv4.src_ip, ipv4.dst_ip);
+    m_ctrl.set_udp_ports(ntohs(udp.src_port), ntohs(udp.dst_port));
+
+    // Fill in the payload, then the header in front of it
+    rdmx_ctrl_hdr_t& ctrl = *(rdmx_ctrl_hdr_t*)(frame + CRawUDP::HEADER_SIZE);
+    ctrl.magic     = htons(RDMX_CTRL_MAGIC);
+    ctrl.type      = type;
+    ctrl.count     = 0;
+    ctrl.first_seq = htonl(m_first_seq);
+    ctrl.next_seq  = htonl(m_header.next_seq());
+    m_ctrl.write_header(frame, sizeof(ctrl));
+
+    m_nic.send(frame, sizeof(frame));
+}
+//=============================================================================
+
+
+//=============================================================================
+// finish() - Tells the receiver that the transfer is over, and waits for it
+//            to acknowledge everything we've sent
+//=============================================================================
+bool CRdmxReliableSender::finish(int timeout_ms)
+{
+    uint64_t deadline = now_ns() + timeout_ms * 1000000ULL;
+
+    while ((int32_t)(m_header.next_seq() - m_acked) > 0)
+    {
+        if (now_ns() >= deadline) return false;
+        send_sync(RDMX_CTRL_FIN);
+        poll(SYNC_INTERVAL_MS);
+    }
+
+    return true;
+}
+//=============================================================================
+
+
+
+//=============================================================================
+// CRdmxReliableReceiver() - Constructor
+//=============================================================================
+CRdmxReliableReceiver::CRdmxReliableReceiver(CRawNIC& nic, CRdmxReceiver& store,
+                                             uint32_t window)
+    : m_nic(nic), m_store(store), m_tracker(window)
+{
+    m_have_peer      = false;
+    m_have_local_mac = false;
+    m_synced         = false;
+    m_finished       = false;
+    m_sync_next      = 0;
+    m_interval_ns    = 2000000;
+    m_last_status_ns = 0;
+    m_status_due     = false;
+    m_fresh          = false;
+    m_status_frames  = 0;
+    memset(m_local_mac, 0, sizeof(m_local_mac));
+}
+//=============================================================================
+
+
+//=============================================================================
+// set_local_mac() - Defines the source MAC of our status frames
+//=============================================================================
+void CRdmxReliableReceiver::set_local_mac(const void* mac)
+{
+    memcpy(m_local_mac, mac, 6);
+    m_have_local_mac = true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// learn_peer() - Addresses our status frames to whoever sent "frame"
+//=============================================================================
+void CRdmxReliableReceiver::learn_peer(const void* frame, uint32_t length)
+{
+    udp_frame_t parsed;
+    if (!parse_udp_frame(frame, length, parsed)) return;
+
+    const eth_hdr_t&  eth  = *parsed.eth;
+    const ipv4_hdr_t& ipv4 = *parsed.ipv4;
+    const udp_hdr_t&  udp  = *parsed.udp;
+
+    // If the data was broadcast or multicast, its destination MAC isn't ours
+    const uint8_t* src_mac = eth.dst_mac;
+    if (m_have_local_mac || (eth.dst_mac[0] & 1)) src_mac = m_local_mac;
+
+    m_ctrl.set_mac_addrs(src_mac, eth.src_mac);
+    m_ctrl.set_ip_addrs(ipv4.dst_ip, ipv4.src_ip);
+    m_ctrl.set_udp_ports(ntohs(udp.dst_port), ntohs(udp.src_port));
+    m_have_peer = true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_frame() - Handles a SYNC, FIN or RDMX frame.  Returns true if an
+//                  RDMX payload was stored
+//=============================================================================
+bool CRdmxReliableReceiver::handle_frame(const void* frame, uint32_t length)
+{
+    // Is this a SYNC or FIN from the sender?
+    const rdmx_ctrl_hdr_t* ctrl = find_ctrl(frame, length, htons(m_store.udp_port()));
+    if (ctrl)
+    {
+        if (ctrl->type != RDMX_CTRL_SYNC && ctrl->type != RDMX_CTRL_FIN) return false;
+
+        // Everything from "first" up to "next" has been sent
+        uint32_t first = ntohl(ctrl->first_seq);
+        uint32_t next  = ntohl(ctrl->next_seq);
+        if (next != first) m_tracker.expect(first, next - 1);
+
+        // A FIN means that's all there is, until a SYNC describes more.  One
+        // that describes less than we've already heard about is out of date
+        bool fin   = (ctrl->type == RDMX_CTRL_FIN);
+        bool newer = !m_synced || (int32_t)(next - m_sync_next) > 0;
+        if (newer)
+        {
+            m_sync_next = next;
+            m_finished  = fin;
+        }
+        else if (fin && next == m_sync_next)
+        {
+            m_finished = true;
+        }
+
+        learn_peer(frame, length);
+        m_synced     = true;
+        m_status_due = true;
+        return false;
+    }
+
+    // Otherwise, it has to be an RDMX frame
+    if (!m_tracker.handle_frame(frame, length, 0)) return false;
+    if (!m_have_peer) learn_peer(frame, length);
+    m_fresh = true;
+
+    return m_store.handle_frame(frame, length);
+}
+//=============================================================================
+
+
+//=============================================================================
+// poll() - Receives a block of frames, handles every frame in it, and sends
+//          a status frame if one is due.  Returns the number of RDMX payloads
+//          that were stored
+//=============================================================================
+int CRdmxReliableReceiver::poll(int timeout_ms)
+{
+    CRawNIC::rx_frame_t frame[64];
+    int stored = 0;
+
+    m_tracker.set_udp_port(m_store.udp_port());
+
+    // Fetch the first batch of frames, waiting for it if we need to
+    int count = m_nic.receive_block(frame, 64, timeout_ms);
+
+    // Handle every frame in the block
+    while (count)
+    {
+        for (int i=0; i<count; ++i)
+        {
+            if (handle_frame(frame[i].data, frame[i].length)) ++stored;
+        }
+        count = m_nic.receive_block(frame, 64, 0);
+    }
+
+    // We're done with the block, give it back to the kernel
+    m_nic.release_block();
+
+    // Send a status frame if the sender asked for one, or if there's news
+    // and we haven't sent one in a while
+    if (m_have_peer)
+    {
+        bool news = m_fresh || m_tracker.missing();
+        if (m_status_due || (news && now_ns() - m_last_status_ns >= m_interval_ns))
+            send_status();
+    }
+
+    return stored;
+}
+//=============================================================================
+
+
+//=============================================================================
+// send_status() - Sends the sender a status frame: where the unbroken run of
+//                 arrivals ends, and the ranges that are missing after that
+//=============================================================================
+void CRdmxReliableReceiver::send_status()
+{
+    uint8_t frame[CRawUDP::HEADER_SIZE + sizeof(rdmx_ctrl_hdr_t)
+                + MAX_RANGES * sizeof(rdmx_ctrl_range_t)];
+    seq_range_t missing[MAX_RANGES];
+
+    int count = m_tracker.missing_ranges(missing, MAX_RANGES);
+
+    // Everything from the start of the stream to the first gap has arrived.
+    // If nothing has arrived and nothing is missing, nothing was sent
+    uint32_t first_seq = m_tracker.first();
+    uint32_t next_seq  = m_tracker.highest() + 1;
+    if (count)
+        next_seq = missing[0].first;
+    else if (m_tracker.received() == 0)
+        first_seq = next_seq = m_sync_next;
+
+    // Fill in the payload
+    rdmx_ctrl_hdr_t&   ctrl  = *(rdmx_ctrl_hdr_t*)(frame + CRawUDP::HEADER_SIZE);
+    rdmx_ctrl_range_t* range = (rdmx_ctrl_range_t*)(&ctrl + 1);
+    ctrl.magic     = htons(RDMX_CTRL_MAGIC);
+    ctrl.type      = RDMX_CTRL_STATUS;
+    ctrl.count     = count;
+    ctrl.first_seq = htonl(first_seq);
+    ctrl.next_seq  = htonl(next_seq);
+    for (int i=0; i<count; ++i)
+    {
+        range[i].first = htonl(missing[i].first);
+        range[i].count = htonl(missing[i].count);
+    }
+
+    // And the header in front of it
+    uint16_t payload_length = sizeof(ctrl) + count * sizeof(rdmx_ctrl_range_t);
+    m_ctrl.write_header(frame, payload_length);
+    m_nic.send(frame, CRawUDP::HEADER_SIZE + payload_length);
+
+    m_last_status_ns = now_ns();
+    m_status_due     = false;
+    m_fresh          = false;
+    ++m_status_frames;
+}
+//=============================================================================
+
+
+//=============================================================================
+// complete() - Returns true once the sender has sent a FIN and everything
+//              it described has arrived
+//=============================================================================
+bool CRdmxReliableReceiver::complete() const
+{
+    if (!m_finished || m_tracker.missing() || m_tracker.lost()) return false;
+    if (m_tracker.received() == 0) return true;
+    return (int32_t)(m_tracker.highest() + 1 - m_sync_next) >= 0;
+}
+//=============================================================================
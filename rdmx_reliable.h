@@ -0,0 +1,285 @@
+//=============================================================================
+// rdmx_reliable.h - Selective retransmission for RDMX transfers
+//
+// Author: D. Wolf
+//
+// RDMX has no retransmission of its own: if one frame of a large transfer is
+// lost, the only remedy is to send the whole buffer again.  These two classes
+// add an optional layer on top of sequenced RDMX (see
+// CRawRDMX::set_sequencing()) that resends only the frames that went missing:
+//
+//   CRdmxReliableSender   - sends a buffer the way CRdmxBulk does, and
+//                           remembers (by reference, without copying) the
+//                           most recent "window" frames it has sent
+//
+//   CRdmxReliableReceiver - tracks the sequence numbers that arrive, and
+//                           every so often tells the sender which ones it's
+//                           still waiting for
+//
+// The two ends talk with small control frames that travel over the same raw
+// sockets as the data.  Each is a UDP datagram whose payload is an
+// "rdmx_ctrl_hdr_t", followed (in a status frame) by up to MAX_RANGES runs
+// of missing sequence numbers:
+//
+//   SYNC   - sender to receiver, to the RDMX port: "I've sent every sequence
+//            number from first_seq up to (but not including) next_seq"
+//
+//   FIN    - the same as a SYNC, sent by finish(), which adds "and that's
+//            everything".  Until one arrives, the receiver can't tell the
+//            end of the transfer from a pause in the middle of it
+//
+//   STATUS - receiver to sender, back to the port the data came from: "I have
+//            everything from first_seq up to next_seq, and I'm missing these
+//            ranges".  A status frame with no ranges is a plain
+//            acknowledgement.  Until the receiver has seen a SYNC, it can't
+//            know whether the first frames of the stream were lost, so the
+//            sender ignores acknowledgements that start after its first frame
+//
+// The receiver sends a status frame whenever new data or gaps have been
+// seen in the last interval, and immediately in reply to a SYNC.  The sender
+// never lets itself get more than "window" frames ahead of what's been
+// acknowledged, so every frame the receiver can ask for is still in its
+// window; both ends should be given the same window size.
+//
+// Since frames are sent by reference, the buffer passed to send() must stay
+// intact until finish() returns.
+//
+// For testing, the sender can be told to drop a fraction of the frames it
+// would have sent (retransmissions included) with "set_loss()".
+//
+// To use these classes:
+//
+// (1) on both ends, set up a CRawNIC with its RX ring enabled.  A short
+//     block timeout (a millisecond or two) keeps the round trip short
+//
+// (2) on the sending end, declare a "CRdmxReliableSender" that refers to the
+//     NIC and a CRawRDMX header template, call "send()" for each buffer,
+//     then "finish()" to wait until everything has been acknowledged
+//
+// (3) on the receiving end, declare a "CRdmxReliableReceiver" that refers to
+//     the NIC and a CRdmxReceiver, and call "poll()" in a loop until
+//     "complete()" returns true
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+#include "raw_nic.h"
+#include "raw_rdmx.h"
+#include "raw_udp.h"
+#include "rdmx_receiver.h"
+#include "seq_tracker.h"
+
+// The payload of a control frame.  All fields are big-endian
+#pragma pack(push, 1)
+struct rdmx_ctrl_hdr_t
+{
+    uint16_t    magic;
+    uint8_t     type;
+    uint8_t     count;
+    uint32_t    first_seq;
+    uint32_t    next_seq;
+};
+
+// A run of missing sequence numbers in a status frame.  Big-endian
+struct rdmx_ctrl_range_t
+{
+    uint32_t    first;
+    uint32_t    count;
+};
+#pragma pack(pop)
+
+// The magic number and the types of control frame
+enum
+{
+    RDMX_CTRL_MAGIC  = 0x0123,
+    RDMX_CTRL_SYNC   = 1,
+    RDMX_CTRL_STATUS = 2,
+    RDMX_CTRL_FIN    = 3
+};
+
+
+class CRdmxReliableSender
+{
+public:
+
+    // "window" is rounded up to a power of two.  "batch_size" is the number
+    // of frames handed to the kernel at once.  Sequencing is turned on in
+    // "header" if it isn't already
+    CRdmxReliableSender(CRawNIC& nic, CRawRDMX& header, uint32_t window = 65536,
+                        int batch_size = 64);
+    ~CRdmxReliableSender();
+
+    // Sends "length" bytes from "buffer" so that they land at "target_addr"
+    // onward at the receiver, resending lost frames as the receiver asks for
+    // them.  A full transmit queue is waited out.  Returns the number of
+    // payload bytes that were handed to the kernel (or dropped by
+    // set_loss()), which is less than "length" only if the receiver stopped
+    // acknowledging or the NIC failed
+    uint64_t    send(const void* buffer, uint64_t length, uint64_t target_addr,
+                     uint16_t max_payload = 8192);
+
+    // Waits up to "timeout_ms" for status frames from the receiver, and
+    // resends whatever they ask for.  Returns the number of frames resent
+    int         poll(int timeout_ms = 0);
+
+    // Tells the receiver the transfer is over, and waits up to "timeout_ms"
+    // for it to acknowledge everything we've sent.  Returns true if it did
+    bool        finish(int timeout_ms = 1000);
+
+    // Drops this fraction (0 to 1) of the frames we would have sent
+    void        set_loss(double probability, uint64_t seed = 1);
+
+    // Frames sent for the first time, frames resent, frames dropped on
+    // purpose, frames the receiver asked for that had already left the
+    // window, and status frames received
+    uint64_t    frames_sent()    const {return m_sent;}
+    uint64_t    retransmits()    const {return m_retransmits;}
+    uint64_t    dropped()        const {return m_dropped;}
+    uint64_t    unrecoverable()  const {return m_unrecoverable;}
+    uint64_t    status_frames()  const {return m_status_frames;}
+
+    // Everything before this sequence number has been acknowledged
+    uint32_t    acked() const {return m_acked;}
+
+protected:
+
+    // A frame we've sent and might have to send again
+    struct sent_t
+    {
+        const uint8_t*  payload;
+        uint64_t        target_addr;
+        uint64_t        resent_ns;
+        uint32_t        seq;
+        uint16_t        length;
+    };
+
+    // Builds a frame in slot "count" of the batch.  Returns false (and
+    // builds nothing) if set_loss() says the frame should be dropped
+    bool        add_to_batch(int count, const sent_t& frame, bool resend);
+
+    // Hands "count" frames in the batch to the kernel, waiting out a full
+    // queue.  Returns the number of frames it took
+    int         send_batch(int count);
+
+    // Handles one received frame, resending whatever a status frame asks for
+    int         handle_frame(const void* frame, uint32_t length);
+
+    // Sends a SYNC (or FIN) frame describing everything we've sent
+    void        send_sync(uint8_t type = RDMX_CTRL_SYNC);
+
+    // True if set_loss() says the next frame should be dropped
+    bool        should_drop();
+
+    // The NIC we transmit on, and the template we build headers from
+    CRawNIC&    m_nic;
+    CRawRDMX&   m_header;
+
+    // The template we build SYNC frames from
+    CRawUDP     m_ctrl;
+
+    // Maximum number of frames per batch, room to build that many headers,
+    // and two I/O vectors (header and payload) per frame
+    int         m_batch_size;
+    uint8_t*    m_header_pool;
+    iovec*      m_iov;
+
+    // The window of recently sent frames, indexed by sequence number
+    std::vector<sent_t> m_window;
+    uint32_t    m_mask;
+
+    // The first sequence number we sent, and everything before "m_acked"
+    // has been acknowledged
+    uint32_t    m_first_seq;
+    uint32_t    m_acked;
+
+    // Loss injection: the probability, and the state of the random numbers
+    double      m_loss;
+    uint64_t    m_rng;
+
+    // Counters
+    uint64_t    m_sent;
+    uint64_t    m_retransmits;
+    uint64_t    m_dropped;
+    uint64_t    m_unrecoverable;
+    uint64_t    m_status_frames;
+};
+
+
+class CRdmxReliableReceiver
+{
+public:
+
+    // The most missing ranges a status frame will carry
+    static const int MAX_RANGES = 128;
+
+    // Frames are stored by "store", and status frames are sent on "nic".
+    // "window" should match the sender's
+    CRdmxReliableReceiver(CRawNIC& nic, CRdmxReceiver& store, uint32_t window = 65536);
+
+    // The source MAC of status frames.  By default it's the destination MAC
+    // of the data, which only works if the sender addressed us directly
+    void        set_local_mac(const void* mac);
+
+    // How often we send status frames while data is arriving or frames are
+    // missing (default 2000 microseconds)
+    void        set_status_interval(uint32_t usecs) {m_interval_ns = usecs * 1000ULL;}
+
+    // Waits up to "timeout_ms" (-1 = forever) for a block of frames, handles
+    // every frame in it, and sends a status frame if one is due.  Returns
+    // the number of RDMX payloads stored
+    int         poll(int timeout_ms = -1);
+
+    // True once the sender has finished, and everything it sent has arrived
+    bool        complete() const;
+
+    // The sequence tracker that's following the sender
+    const CSeqTracker& tracker() const {return m_tracker;}
+
+    // The number of status frames we've sent
+    uint64_t    status_frames() const {return m_status_frames;}
+
+protected:
+
+    // Handles one received frame.  Returns true if an RDMX payload was stored
+    bool        handle_frame(const void* frame, uint32_t length);
+
+    // Points our status frames back at whoever sent "frame"
+    void        learn_peer(const void* frame, uint32_t length);
+
+    // Tells the sender what we have and what's missing
+    void        send_status();
+
+    // The NIC we send status frames on, and the receiver that stores payloads
+    CRawNIC&        m_nic;
+    CRdmxReceiver&  m_store;
+
+    // Follows the sequence numbers of the data
+    CSeqTracker     m_tracker;
+
+    // The template we build status frames from, and whether it's been
+    // pointed at a sender yet
+    CRawUDP     m_ctrl;
+    bool        m_have_peer;
+
+    // The source MAC of status frames, if one was given
+    uint8_t     m_local_mac[6];
+    bool        m_have_local_mac;
+
+    // Once the sender has sent a SYNC, everything before "m_sync_next"
+    // has been sent.  Once it has sent a FIN, that's all it will send
+    bool        m_synced;
+    bool        m_finished;
+    uint32_t    m_sync_next;
+
+    // When status frames are sent: the interval, when the last one was
+    // sent, whether one is due right now, and whether data has arrived
+    // since the last one
+    uint64_t    m_interval_ns;
+    uint64_t    m_last_status_ns;
+    bool        m_status_due;
+    bool        m_fresh;
+
+    // The number of status frames we've sent
+    uint64_t    m_status_frames;
+};
@@ -0,0 +1,158 @@
+//=============================================================================
+// rx_engine.cpp - A multi-threaded receiver built on PACKET_FANOUT
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include "rx_engine.h"
+
+// Handy shortcuts for the memory orders we use
+static const std::memory_order relaxed = std::memory_order_relaxed;
+static const std::memory_order acquire = std::memory_order_acquire;
+static const std::memory_order release = std::memory_order_release;
+
+
+//=============================================================================
+// CRxEngine() - Default constructor
+//=============================================================================
+CRxEngine::CRxEngine()
+{
+    m_group_id   = 0;
+    m_has_filter = false;
+    m_ready.store(0, relaxed);
+    m_stop.store(false, relaxed);
+}
+//=============================================================================
+
+
+//=============================================================================
+// ~CRxEngine() - Destructor.  Stops the workers if they're still running
+//=============================================================================
+CRxEngine::~CRxEngine()
+{
+    stop();
+}
+//=============================================================================
+
+
+//=============================================================================
+// add_worker() - Adds a worker to the engine
+//=============================================================================
+void CRxEngine::add_worker(int cpu, callback_t callback)
+{
+    std::unique_ptr<worker_t> worker(new worker_t);
+    worker->cpu      = cpu;
+    worker->callback = callback;
+    worker->frames.store(0, relaxed);
+    worker->bytes.store(0, relaxed);
+    m_worker.push_back(std::move(worker));
+}
+//=============================================================================
+
+
+//=============================================================================
+// start() - Starts every worker, and waits for them to be ready
+//
+// The workers join the fanout group in order, so that in CPU mode (and in
+// EBPF mode) worker N is socket N of the group
+//=============================================================================
+void CRxEngine::start(const char* nic_name, mode_t mode, int bpf_prog_fd,
+                      uint32_t block_size, uint32_t block_count, bool rollover)
+{
+    for (auto& worker : m_worker)
+    {
+        if (worker->thread.joinable())
+        {
+            fprintf(stderr, "CRxEngine::start(): already running, call stop() first\n");
+            exit(1);
+        }
+    }
+
+    m_stop.store(false, relaxed);
+    m_ready.store(0, relaxed);
+
+    // The workers are handed the mode with the rollover flag already in it
+    int fanout_mode = mode | (rollover ? PACKET_FANOUT_FLAG_ROLLOVER : 0);
+
+    for (int i=0; i<workers(); ++i)
+    {
+        m_worker[i]->thread = std::thread(&CRxEngine::worker_main, this, i, nic_name,
+                                          fanout_mode, bpf_prog_fd, block_size, block_count);
+
+        // Wait for this worker to join the group before starting the next
+        while (m_ready.load(acquire) <= i) sched_yield();
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// stop() - Tells every worker to stop, and waits for them to exit
+//=============================================================================
+void CRxEngine::stop()
+{
+    m_stop.store(true, relaxed);
+    for (auto& worker : m_worker)
+    {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// worker_main() - Pins the thread, sets up its RX ring, then hands batches of
+//                 frames to the worker's callback until we're told to stop
+//=============================================================================
+void CRxEngine::worker_main(int index, const char* nic_name, int mode, int bpf_prog_fd,
+                            uint32_t block_size, uint32_t block_count)
+{
+    worker_t& worker = *m_worker[index];
+
+    // Pin ourselves to our CPU before the RX ring is allocated, so that
+    // the ring lives in our CPU's NUMA node
+    if (worker.cpu >= 0) pin_thread(worker.cpu);
+
+    // Create our own receive socket and RX ring.  The NIC belongs to this
+    // thread, so stop() closes it, and the next start() opens a new one.  A
+    // short block timeout keeps latency down when traffic is light
+    CRawNIC nic;
+    nic.connect_rx(nic_name);
+    if (m_has_filter) nic.set_rx_filter(m_filter);
+    nic.enable_rx_ring(block_size, block_count, 10);
+
+    // The first worker has the kernel create a group with an ID that no
+    // other socket on the system is using, and the rest join it
+    if (index == 0)
+        m_group_id = nic.join_fanout(0, mode | PACKET_FANOUT_FLAG_UNIQUEID, bpf_prog_fd);
+    else
+        nic.join_fanout(m_group_id, mode, bpf_prog_fd);
+
+    // Tell start() that we're ready
+    m_ready.fetch_add(1, release);
+
+    const int MAX_FRAMES = 256;
+    CRawNIC::rx_frame_t frame[MAX_FRAMES];
+
+    while (!m_stop.load(relaxed))
+    {
+        // Wait (briefly, so we notice being stopped) for some frames
+        int count = nic.receive_block(frame, MAX_FRAMES, 100);
+        if (count == 0) continue;
+
+        // Hand them to the callback
+        worker.callback(index, frame, count);
+
+        // Keep track of what we've received
+        uint64_t bytes = 0;
+        for (int i=0; i<count; ++i) bytes += frame[i].length;
+        worker.frames.fetch_add(count, relaxed);
+        worker.bytes.fetch_add(bytes, relaxed);
+
+        // Give the block back to the kernel once we've seen all of it
+        nic.release_block();
+    }
+}
+//=============================================================================
@@ -0,0 +1,140 @@
+//=============================================================================
+// rx_engine.h - A multi-threaded receiver built on PACKET_FANOUT
+//
+// Author: D. Wolf
+//
+// A single receive socket (and the single thread that drains it) can't keep
+// up with several 10G streams.  CRxEngine opens one CRawNIC, with its own
+// RX ring, per worker thread and joins them all to one PACKET_FANOUT group.
+// The kernel then spreads the arriving frames across the workers.
+//
+// Each worker has its own callback and its own counters, and shares nothing
+// with the other workers, so no locks are needed anywhere.  A worker can be
+// pinned to a CPU; its RX ring is set up from the pinned thread, so the
+// ring's memory comes from that CPU's NUMA node.
+//
+// Choosing a mode:
+//
+//   HASH - frames of a flow always go to the same worker.  A single UDP
+//          flow (one CRawUDP template) can only use one worker
+//
+//   LB   - frames are dealt out round-robin.  RDMX frames can be processed
+//          in any order, so this spreads even a single RDMX flow evenly
+//
+//   CPU  - frames go to the worker whose index matches the CPU that
+//          received them.  Use this with RSS, and pin worker N to CPU N
+//
+//   EBPF - a socket-filter program of your own picks the worker
+//
+// Rollover is off unless start() is asked for it.  With rollover on, a
+// frame that arrives for a worker whose RX ring is full goes to another
+// worker instead of being dropped.  That trades drops for ordering: in
+// HASH mode the frames of one flow can then be split across workers, and
+// in CPU mode a worker can be handed frames from another CPU.  In LB mode
+// nothing is promised about order anyway, so rollover costs nothing there.
+//
+// To use this class:
+//
+// (1) call "add_worker()" once per worker
+//
+// (2) call "start()"
+//
+// (3) call "stop()" when you're done
+//
+// The fanout group gets an ID from the kernel that no other socket is using
+// (PACKET_FANOUT_FLAG_UNIQUEID, Linux 4.3 and later), so engines in this and
+// other processes never end up sharing a group by accident.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <linux/if_packet.h>
+#include "raw_nic.h"
+
+class CRxEngine
+{
+public:
+
+    // A worker's callback is handed batches of frames.  The frames are only
+    // valid until the callback returns
+    typedef std::function<void(int worker, const CRawNIC::rx_frame_t* frames,
+                               int count)> callback_t;
+
+    // How frames are spread across the workers
+    enum mode_t
+    {
+        HASH = PACKET_FANOUT_HASH,
+        LB   = PACKET_FANOUT_LB,
+        CPU  = PACKET_FANOUT_CPU,
+        EBPF = PACKET_FANOUT_EBPF
+    };
+
+    // Constructor and destructor
+    CRxEngine();
+    ~CRxEngine();
+
+    // Adds a worker that's pinned to "cpu" (-1 = don't pin) and that calls
+    // "callback" with each batch of frames it receives
+    void    add_worker(int cpu, callback_t callback);
+
+    // Gives every worker a receive filter, so that only the frames we want
+    // reach the workers.  Call this before start()
+    void    set_filter(const rx_filter_t& filter) {m_filter = filter; m_has_filter = true;}
+
+    // Creates the sockets, joins them to a fanout group and starts the
+    // workers.  Returns once every worker is ready to receive.  In EBPF
+    // mode, "bpf_prog_fd" is the program that picks the worker.  "rollover"
+    // turns on PACKET_FANOUT_FLAG_ROLLOVER (see above)
+    void    start(const char* nic_name, mode_t mode = HASH, int bpf_prog_fd = -1,
+                  uint32_t block_size = 1 << 20, uint32_t block_count = 64,
+                  bool rollover = false);
+
+    // Tells the workers to stop, and waits for them to finish.  Their
+    // sockets are closed, and start() may be called again
+    void    stop();
+
+    // Returns the number of workers
+    int     workers() const {return (int)m_worker.size();}
+
+    // Returns the number of frames and bytes a worker has received
+    uint64_t frames(int worker) const {return m_worker[worker]->frames.load(std::memory_order_relaxed);}
+    uint64_t bytes(int worker)  const {return m_worker[worker]->bytes.load(std::memory_order_relaxed);}
+
+protected:
+
+    // Everything that belongs to a single worker, on cache-lines of its own.
+    // The worker's CRawNIC lives on its thread's stack
+    struct alignas(64) worker_t
+    {
+        std::thread             thread;
+        int                     cpu;
+        callback_t              callback;
+        std::atomic<uint64_t>   frames;
+        std::atomic<uint64_t>   bytes;
+    };
+
+    // The body of each worker thread.  "mode" includes any fanout flags
+    void    worker_main(int index, const char* nic_name, int mode, int bpf_prog_fd,
+                        uint32_t block_size, uint32_t block_count);
+
+    // The workers
+    std::vector<std::unique_ptr<worker_t>> m_worker;
+
+    // The receive filter each worker uses, if there is one
+    rx_filter_t m_filter;
+    bool        m_has_filter;
+
+    // The ID of our fanout group, which the kernel picks when the first
+    // worker joins
+    uint16_t    m_group_id;
+
+    // The number of workers that have joined the fanout group
+    std::atomic<int>  m_ready;
+
+    // Set to true to tell the workers to stop
+    std::atomic<bool> m_stop;
+};
@@ -0,0 +1,116 @@
+//=============================================================================
+// rx_filter.cpp - Compiles a simple receive-filter spec into a classic BPF
+//                 program
+//
+// Author: D. Wolf
+//
+// For an RDMX filter, the generated program is:
+//
+//          ldh  [12]               ; EtherType
+//          jne  #0x0800, drop
+//          ldb  [23]               ; IPv4 protocol
+//          jne  #17, drop
+//          ldh  [20]               ; IPv4 fragment offset
+//          jset #0x1fff, drop      ; later fragments have no UDP header
+//          ldxb 4*([14]&0xf)       ; X = length of the IPv4 header
+//          ldh  [x+16]             ; UDP destination port
+//          jne  #11111, drop
+//          ldh  [x+22]             ; RDMX magic number
+//          jne  #0x0122, drop
+//          ret  #snaplen
+//    drop: ret  #0
+//=============================================================================
+#include "rx_filter.h"
+
+// Offsets of the fields we look at.  Fields beyond the IPv4 header are
+// relative to the start of it, since the IPv4 header can carry options
+static const uint32_t ETHERTYPE_OFFSET = 12;
+static const uint32_t IPV4_OFFSET      = 14;
+static const uint32_t IPV4_FRAG_OFFSET = IPV4_OFFSET + 6;
+static const uint32_t IPV4_PROTO       = IPV4_OFFSET + 9;
+static const uint32_t UDP_DST_PORT     = IPV4_OFFSET + 2;
+static const uint32_t RDMX_MAGIC       = IPV4_OFFSET + 8;
+
+// Values we compare those fields against
+static const uint16_t ETHERTYPE_IPV4   = 0x0800;
+static const uint8_t  IP_PROTOCOL_UDP  = 17;
+static const uint16_t RDMX_MAGIC_VALUE = 0x0122;
+
+// Marks a conditional jump that should go to the "drop" instruction
+static const uint8_t  TO_DROP          = 0xFF;
+
+
+//=============================================================================
+// compile_rx_filter() - Compiles a filter spec into a classic BPF program
+//=============================================================================
+std::vector<sock_filter> compile_rx_filter(const rx_filter_t& filter)
+{
+    std::vector<sock_filter> prog;
+
+    // Work out which fields we need to check
+    bool     rdmx        = filter.rdmx;
+    uint16_t dst_port    = filter.dst_port;
+    uint8_t  ip_protocol = filter.ip_protocol;
+    uint16_t ethertype   = filter.ethertype;
+    if (rdmx || dst_port) ip_protocol = IP_PROTOCOL_UDP;
+    if (ip_protocol)      ethertype   = ETHERTYPE_IPV4;
+
+    // Adds an instruction that falls through if it matches, or drops the
+    // frame if it doesn't
+    auto require = [&](uint16_t code, uint32_t k)
+    {
+        prog.push_back(BPF_JUMP(BPF_JMP | code | BPF_K, k, 0, TO_DROP));
+    };
+
+    // Check the EtherType
+    if (ethertype)
+    {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFFSET));
+        require(BPF_JEQ, ethertype);
+    }
+
+    // Check the IPv4 protocol
+    if (ip_protocol)
+    {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, IPV4_PROTO));
+        require(BPF_JEQ, ip_protocol);
+    }
+
+    // Check the fields that follow the IPv4 header
+    if (dst_port || rdmx)
+    {
+        // Only the first fragment of a datagram has a UDP header
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, IPV4_FRAG_OFFSET));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, TO_DROP, 0));
+
+        // Find the length of the IPv4 header
+        prog.push_back(BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, IPV4_OFFSET));
+
+        if (dst_port)
+        {
+            prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_IND, UDP_DST_PORT));
+            require(BPF_JEQ, dst_port);
+        }
+
+        if (rdmx)
+        {
+            prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_IND, RDMX_MAGIC));
+            require(BPF_JEQ, RDMX_MAGIC_VALUE);
+        }
+    }
+
+    // Keep the frames that get this far, and drop the rest
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, filter.snaplen));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+    // Point every "drop" jump at the last instruction
+    const size_t drop = prog.size() - 1;
+    for (size_t i=0; i<drop; ++i)
+    {
+        if (prog[i].jt == TO_DROP) prog[i].jt = drop - i - 1;
+        if (prog[i].jf == TO_DROP) prog[i].jf = drop - i - 1;
+    }
+
+    return prog;
+}
+//=============================================================================
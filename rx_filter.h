@@ -0,0 +1,57 @@
+//=============================================================================
+// rx_filter.h - Compiles a simple receive-filter spec into a classic BPF
+//               program that the kernel runs on every arriving frame
+//
+// Author: D. Wolf
+//
+// Frames that don't match the filter are dropped in the kernel, before they
+// are ever copied into our RX ring.  Frames that do match are cut down to
+// "snaplen" bytes.
+//
+// A field that is zero matches anything.  Asking for a UDP port or for RDMX
+// implies UDP, and asking for an IP protocol implies IPv4.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <linux/filter.h>
+
+struct rx_filter_t
+{
+    uint16_t    ethertype;      // e.g. 0x0800 for IPv4
+    uint8_t     ip_protocol;    // e.g. 17 for UDP
+    uint16_t    dst_port;       // UDP destination port
+    bool        rdmx;           // true = the RDMX magic number must be present
+    uint32_t    snaplen;        // How many bytes of each frame to keep
+
+    // Matches every frame, whole
+    rx_filter_t()
+    {
+        ethertype   = 0;
+        ip_protocol = 0;
+        dst_port    = 0;
+        rdmx        = false;
+        snaplen     = 0xFFFFFFFF;
+    }
+
+    // Matches IPv4/UDP frames sent to the specified port
+    static rx_filter_t udp(uint16_t port)
+    {
+        rx_filter_t filter;
+        filter.dst_port = port;
+        return filter;
+    }
+
+    // Matches RDMX frames sent to the specified port
+    static rx_filter_t rdmx_frames(uint16_t port = 11111)
+    {
+        rx_filter_t filter;
+        filter.dst_port = port;
+        filter.rdmx     = true;
+        return filter;
+    }
+};
+
+// Compiles a filter spec into a classic BPF program
+std::vector<sock_filter> compile_rx_filter(const rx_filter_t& filter);
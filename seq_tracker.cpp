@@ -0,0 +1,363 @@
+//=============================================================================
+// seq_tracker.cpp - Tracks the sequence numbers of a received RDMX stream
+//
+// Author: D. Wolf
+//
+// Sequence numbers are 32 bits and wrap around, so they're always compared
+// by the sign of their (32-bit) difference.
+//=============================================================================
+#include <cstring>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "seq_tracker.h"
+#include "frame_parser.h"
+
+
+//=============================================================================
+// CSeqTracker() - Constructor
+//=============================================================================
+CSeqTracker::CSeqTracker(uint32_t window)
+{
+    // The window is a whole number of 64-bit words, and a power of two
+    m_window = 64;
+    while (m_window < window) m_window <<= 1;
+    m_mask = m_window - 1;
+    m_bits.resize(m_window / 64);
+
+    m_port = 11111;
+    reset();
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset() - Forgets every sequence number and zeros the counters
+//=============================================================================
+void CSeqTracker::reset()
+{
+    memset(m_bits.data(), 0, m_bits.size() * sizeof(uint64_t));
+    m_started     = false;
+    m_first       = 0;
+    m_highest     = 0;
+    m_received    = 0;
+    m_lost        = 0;
+    m_missing     = 0;
+    m_reordered   = 0;
+    m_duplicates  = 0;
+    m_too_old     = 0;
+    m_max_reorder = 0;
+    m_lat_count   = 0;
+    m_lat_min     = 0;
+    m_lat_max     = 0;
+    m_lat_sum     = 0;
+    m_clock_skew  = 0;
+    memset(m_lat_hist, 0, sizeof(m_lat_hist));
+}
+//=============================================================================
+
+
+//=============================================================================
+// advance() - Slides the window forward so that "seq" is the newest sequence
+//             number in it.  Every sequence number that slides out without
+//             having arrived is lost
+//=============================================================================
+void CSeqTracker::advance(uint32_t seq, bool arrived)
+{
+    uint32_t distance = seq - m_highest;
+
+    // If we've jumped past the whole window, everything in it that hadn't
+    // arrived is lost, as is everything we jumped over
+    if (distance >= m_window)
+    {
+        m_lost   += m_missing + (distance - m_window);
+        m_missing = m_window - arrived;
+        memset(m_bits.data(), 0, m_bits.size() * sizeof(uint64_t));
+        m_highest = seq;
+        return;
+    }
+
+    // Otherwise, look at each sequence number that's about to slide out.
+    // Ones from before the start of the stream don't count
+    for (uint32_t next = m_highest + 1; next != seq + 1; ++next)
+    {
+        uint32_t old = next - m_window;
+        if (!test(old) && (int32_t)(old - m_first) >= 0)
+        {
+            ++m_lost;
+            --m_missing;
+        }
+        clear(next);
+    }
+
+    // Everything between the old newest and the new one is now missing
+    m_missing += distance - arrived;
+    m_highest  = seq;
+}
+//=============================================================================
+
+
+//=============================================================================
+// on_seq() - Records the arrival of a sequence number
+//=============================================================================
+void CSeqTracker::on_seq(uint32_t seq)
+{
+    ++m_received;
+
+    // The first sequence number starts the window
+    if (!m_started)
+    {
+        m_started = true;
+        m_first   = seq;
+        m_highest = seq;
+        set(seq);
+        return;
+    }
+
+    int32_t ahead = seq - m_highest;
+
+    // The usual case: it's newer than anything we've seen
+    if (ahead > 0)
+    {
+        advance(seq);
+        set(seq);
+        return;
+    }
+
+    // It's older than the newest.  If it's outside the window, we can't say
+    // whether we've seen it before
+    uint32_t behind = -ahead;
+    if (behind >= m_window)
+    {
+        ++m_too_old;
+        return;
+    }
+
+    if (test(seq))
+    {
+        ++m_duplicates;
+        return;
+    }
+
+    // It's filling in a gap
+    set(seq);
+    ++m_reordered;
+    if (behind > m_max_reorder) m_max_reorder = behind;
+    if ((int32_t)(seq - m_first) >= 0) --m_missing;
+}
+//=============================================================================
+
+
+//=============================================================================
+// expect() - Slides the window up to "last" as if it had been sent, so that
+//            anything between the newest arrival and "last" is missing.  If
+//            the stream started before the first arrival, anything between
+//            "first" and that arrival is missing too
+//=============================================================================
+void CSeqTracker::expect(uint32_t first, uint32_t last)
+{
+    // If nothing has arrived yet, the stream starts at "first"
+    if (!m_started)
+    {
+        m_started = true;
+        m_first   = first;
+        m_highest = first - 1;
+    }
+
+    // If the first frames of the stream never arrived, move its start back
+    else if ((int32_t)(first - m_first) < 0)
+    {
+        // Anything from before the window is already lost
+        uint32_t seq    = first;
+        uint32_t oldest = m_highest - m_mask;
+        if ((int32_t)(oldest - seq) > 0)
+        {
+            uint32_t end = ((int32_t)(oldest - m_first) < 0) ? oldest : m_first;
+            m_lost += end - seq;
+            seq     = end;
+        }
+
+        // Anything inside it that hasn't arrived is missing
+        for (; seq != m_first; ++seq) if (!test(seq)) ++m_missing;
+        m_first = first;
+    }
+
+    if ((int32_t)(last - m_highest) > 0) advance(last, false);
+}
+//=============================================================================
+
+
+//=============================================================================
+// missing_ranges() - Finds the runs of sequence numbers in the window that
+//                    haven't arrived.  Whole words of arrivals are skipped
+//                    at a time
+//=============================================================================
+int CSeqTracker::missing_ranges(seq_range_t* ranges, int max_ranges) const
+{
+    if (!m_started || m_missing == 0) return 0;
+
+    // The window starts at the first sequence number, or "window" back from
+    // the newest, whichever is later
+    uint32_t seq = m_highest - m_mask;
+    if ((int32_t)(seq - m_first) < 0) seq = m_first;
+
+    int count = 0;
+    while ((int32_t)(m_highest - seq) >= 0 && count < max_ranges)
+    {
+        // Skip a whole word of arrivals
+        if ((seq & 63) == 0 && (int32_t)(m_highest - seq) >= 63
+                            && m_bits[(seq & m_mask) >> 6] == ~0ULL)
+        {
+            seq += 64;
+            continue;
+        }
+
+        if (test(seq))
+        {
+            ++seq;
+            continue;
+        }
+
+        // Either extend the current run, or start a new one
+        if (count && ranges[count-1].first + ranges[count-1].count == seq)
+            ++ranges[count-1].count;
+        else
+            ranges[count++] = {seq, 1};
+
+        ++seq;
+    }
+
+    // If we ran out of room in the middle of a run, finish it
+    while (count && (int32_t)(m_highest - seq) >= 0 && !test(seq)
+                 && ranges[count-1].first + ranges[count-1].count == seq)
+    {
+        ++ranges[count-1].count;
+        ++seq;
+    }
+
+    return count;
+}
+//=============================================================================
+
+
+//=============================================================================
+// on_latency() - Adds a one-way latency to the statistics
+//=============================================================================
+void CSeqTracker::on_latency(uint64_t tx_ns, uint64_t rx_ns)
+{
+    // If the receive time is before the transmit time, the clocks disagree
+    if (rx_ns < tx_ns)
+    {
+        ++m_clock_skew;
+        return;
+    }
+
+    uint64_t ns = rx_ns - tx_ns;
+    if (m_lat_count == 0 || ns < m_lat_min) m_lat_min = ns;
+    if (ns > m_lat_max) m_lat_max = ns;
+    m_lat_sum += ns;
+    ++m_lat_count;
+
+    // The bucket number is the number of significant bits in "ns"
+    int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= HIST_BUCKETS) bucket = HIST_BUCKETS - 1;
+    ++m_lat_hist[bucket];
+}
+//=============================================================================
+
+
+//=============================================================================
+// latency_percentile() - Estimates a latency percentile from the histogram.
+//                        The answer is the top of the bucket it falls in
+//=============================================================================
+uint64_t CSeqTracker::latency_percentile(double pct) const
+{
+    if (m_lat_count == 0) return 0;
+
+    uint64_t target = (uint64_t)(pct / 100 * m_lat_count + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int bucket=0; bucket<HIST_BUCKETS; ++bucket)
+    {
+        seen += m_lat_hist[bucket];
+        if (seen < target) continue;
+
+        uint64_t top = (bucket == 0) ? 0 : (1ULL << bucket) - 1;
+        return (top < m_lat_max) ? top : m_lat_max;
+    }
+
+    return m_lat_max;
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_frame() - Parses an RDMX frame and records its sequence number and
+//                  (if it carries a transmit time) its latency
+//
+// Returns false if this isn't an RDMX frame
+//=============================================================================
+bool CSeqTracker::handle_frame(const void* frame, uint32_t length, uint64_t rx_ns)
+{
+    // Find the UDP datagram inside the frame
+    udp_frame_t udp;
+    if (!parse_udp_frame(frame, length, udp)) return false;
+
+    // It has to be addressed to our RDMX port, and carry the magic number
+    if (udp.udp->dst_port != htons(m_port)) return false;
+    if (udp.payload_length < sizeof(rdmx_hdr_t)) return false;
+
+    const rdmx_hdr_t& rdmx = *(const rdmx_hdr_t*)udp.payload;
+    if (rdmx.magic != htons(0x0122)) return false;
+
+    on_seq(ntohl(rdmx.seq));
+
+    uint64_t tx_ns = be64toh(rdmx.tx_ns);
+    if (tx_ns && rx_ns) on_latency(tx_ns, rx_ns);
+
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// check() - Handles a batch of received frames.  Returns the number of RDMX
+//           frames among them
+//=============================================================================
+int CSeqTracker::check(const CRawNIC::rx_frame_t* frames, int count)
+{
+    int handled = 0;
+
+    for (int i=0; i<count; ++i)
+    {
+        const CRawNIC::rx_frame_t& f = frames[i];
+        uint64_t rx_ns = f.sec * 1000000000ULL + f.nsec;
+        if (handle_frame(f.data, f.length, rx_ns)) ++handled;
+    }
+
+    return handled;
+}
+//=============================================================================
+
+
+//=============================================================================
+// report() - Prints the counters and the latency summary
+//=============================================================================
+void CSeqTracker::report(FILE* ofile) const
+{
+    fprintf(ofile, "received %lu  lost %lu  missing %lu  reordered %lu (max %u back)  "
+            "duplicates %lu  too old %lu\n", m_received, m_lost, m_missing,
+            m_reordered, m_max_reorder, m_duplicates, m_too_old);
+
+    if (m_lat_count)
+    {
+        fprintf(ofile, "latency (ns): min %lu  mean %lu  p50 < %lu  p99 < %lu  p99.9 < %lu  max %lu\n",
+                m_lat_min, latency_mean(), latency_percentile(50), latency_percentile(99),
+                latency_percentile(99.9), m_lat_max);
+    }
+
+    if (m_clock_skew)
+        fprintf(ofile, "%lu frames arrived before they were sent (clocks out of sync)\n",
+                m_clock_skew);
+}
+//=============================================================================
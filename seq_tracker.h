@@ -0,0 +1,162 @@
+//=============================================================================
+// seq_tracker.h - Tracks the sequence numbers of a received RDMX stream
+//
+// Author: D. Wolf
+//
+// A sliding window of bits, one per sequence number, remembers which of the
+// most recent "window" sequence numbers have arrived.  From that we count:
+//
+//   lost       - sequence numbers that slid out of the window without ever
+//                arriving
+//   missing    - sequence numbers inside the window that haven't arrived
+//                (yet).  These either arrive late or become lost
+//   reordered  - frames that arrived after a frame with a later sequence
+//                number
+//   duplicates - frames whose sequence number had already arrived
+//   too_old    - frames so far behind the newest that they're outside the
+//                window (a very late frame, or a duplicate of one)
+//
+// A frame in sequence costs a bit test, a bit clear and a bit set, so this
+// can be left on at full rate.
+//
+// If the sender stamps transmit times, one-way latency is measured against
+// the receive timestamp.  That's only meaningful if both hosts' clocks are
+// synchronized (with PTP, say); latencies below zero are counted as
+// "clock_skew" and otherwise ignored.
+//
+// One tracker follows one stream.  With several senders, use one tracker
+// per sender.
+//
+// To use this class:
+//
+// (1) declare an instance of "CSeqTracker" with the window size you want
+//
+// (2) pass received frames to "check()" or "handle_frame()", or feed it
+//     sequence numbers yourself with "on_seq()"
+//
+// (3) call "report()", or look at the counters
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "raw_nic.h"
+
+// A run of consecutive sequence numbers
+struct seq_range_t
+{
+    uint32_t    first;
+    uint32_t    count;
+};
+
+class CSeqTracker
+{
+public:
+
+    // The number of log2 buckets in the latency histogram.  Bucket N counts
+    // latencies between 2^(N-1) and 2^N - 1 nanoseconds
+    static const int HIST_BUCKETS = 40;
+
+    // "window" is rounded up to a multiple of 64 sequence numbers
+    CSeqTracker(uint32_t window = 4096);
+
+    // Defines the UDP port that RDMX frames are addressed to
+    void        set_udp_port(uint16_t port = 11111) {m_port = port;}
+
+    // Records the arrival of a sequence number
+    void        on_seq(uint32_t seq);
+
+    // Tells the tracker that every sequence number from "first" through
+    // "last" was sent, so that any of them that haven't arrived are counted
+    // as missing.  Without this, losing the last frames of a stream would go
+    // unnoticed
+    void        expect(uint32_t first, uint32_t last);
+
+    // Fills in up to "max_ranges" runs of sequence numbers that are missing
+    // from the window, oldest first.  Returns the number filled in
+    int         missing_ranges(seq_range_t* ranges, int max_ranges) const;
+
+    // Records a one-way latency, given the transmit and receive times
+    void        on_latency(uint64_t tx_ns, uint64_t rx_ns);
+
+    // Parses an RDMX frame and records its sequence number and latency.
+    // "rx_ns" is the CLOCK_REALTIME time it arrived.  Returns false if it
+    // isn't an RDMX frame
+    bool        handle_frame(const void* frame, uint32_t length, uint64_t rx_ns);
+
+    // Handles frames returned by CRawNIC::receive_block(), using the
+    // kernel's receive timestamps.  Returns the number of RDMX frames
+    int         check(const CRawNIC::rx_frame_t* frames, int count);
+
+    // The counters described above
+    uint64_t    received()   const {return m_received;}
+    uint64_t    lost()       const {return m_lost;}
+    uint64_t    missing()    const {return m_missing;}
+    uint64_t    reordered()  const {return m_reordered;}
+    uint64_t    duplicates() const {return m_duplicates;}
+    uint64_t    too_old()    const {return m_too_old;}
+
+    // The furthest a reordered frame arrived behind the newest one
+    uint32_t    max_reorder() const {return m_max_reorder;}
+
+    // The first and the newest sequence numbers seen
+    uint32_t    first()   const {return m_first;}
+    uint32_t    highest() const {return m_highest;}
+
+    // Latency: the number of samples, the smallest, largest and mean, and
+    // an estimate of a percentile (0 to 100) from the histogram
+    uint64_t    latency_samples() const {return m_lat_count;}
+    uint64_t    latency_min()     const {return m_lat_min;}
+    uint64_t    latency_max()     const {return m_lat_max;}
+    uint64_t    latency_mean()    const {return m_lat_count ? m_lat_sum / m_lat_count : 0;}
+    uint64_t    latency_percentile(double pct) const;
+    uint64_t    clock_skew()      const {return m_clock_skew;}
+
+    // Prints the counters and the latency summary
+    void        report(FILE* ofile = stdout) const;
+
+    // Forgets everything, and waits for the first sequence number again
+    void        reset();
+
+protected:
+
+    // Returns, sets and clears the bit that belongs to a sequence number
+    bool        test(uint32_t seq) const {return (m_bits[(seq & m_mask) >> 6] >> (seq & 63)) & 1;}
+    void        set(uint32_t seq)   {m_bits[(seq & m_mask) >> 6] |=  (1ULL << (seq & 63));}
+    void        clear(uint32_t seq) {m_bits[(seq & m_mask) >> 6] &= ~(1ULL << (seq & 63));}
+
+    // Slides the window forward so that "seq" is the newest.  "arrived" is
+    // true if "seq" itself has arrived
+    void        advance(uint32_t seq, bool arrived = true);
+
+    // The window: one bit per sequence number, its size, and a mask
+    std::vector<uint64_t> m_bits;
+    uint32_t    m_window;
+    uint32_t    m_mask;
+
+    // True once the first sequence number has arrived, that sequence number,
+    // and the newest
+    bool        m_started;
+    uint32_t    m_first;
+    uint32_t    m_highest;
+
+    // The UDP port RDMX frames are addressed to
+    uint16_t    m_port;
+
+    // Counters
+    uint64_t    m_received;
+    uint64_t    m_lost;
+    uint64_t    m_missing;
+    uint64_t    m_reordered;
+    uint64_t    m_duplicates;
+    uint64_t    m_too_old;
+    uint32_t    m_max_reorder;
+
+    // Latency statistics
+    uint64_t    m_lat_count;
+    uint64_t    m_lat_min;
+    uint64_t    m_lat_max;
+    uint64_t    m_lat_sum;
+    uint64_t    m_clock_skew;
+    uint64_t    m_lat_hist[HIST_BUCKETS];
+};
@@ -0,0 +1,119 @@
+//=============================================================================
+// thread_slot.h - Assigns each thread a small, unique integer
+//
+// Author: D. Wolf
+//
+// Classes that keep per-thread state (counters, free lists, etc) use this to
+// index an array of per-thread slots without taking a lock
+//
+// A thread's slot is given back when the thread exits, and the next thread
+// to ask for a slot gets the lowest one that's free.  Programs that start
+// and stop threads over and over therefore keep using the same few slots,
+// and never run off the end of anybody's table.  A thread that takes over a
+// slot also takes over whatever per-thread state was left in it.
+//
+// If a thread calls thread_slot() from a thread_local destructor after its
+// slot has been given back, it gets THREAD_SLOT_NONE.  That's larger than
+// any table, so callers treat it the same as a thread that didn't get a
+// slot of its own.
+//=============================================================================
+#pragma once
+#include <climits>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// The slot of a thread that has already given its slot back
+static const int THREAD_SLOT_NONE = INT_MAX;
+
+//=============================================================================
+// CThreadSlots - Hands out slot numbers, and takes them back
+//=============================================================================
+class CThreadSlots
+{
+public:
+
+    // Returns the lowest free slot
+    static int  acquire()
+    {
+        registry_t& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+
+        if (r.free.empty()) return r.next++;
+
+        std::pop_heap(r.free.begin(), r.free.end(), std::greater<int>());
+        int slot = r.free.back();
+        r.free.pop_back();
+        return slot;
+    }
+
+    // Makes a slot available to the next thread that asks
+    static void release(int slot)
+    {
+        registry_t& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+
+        r.free.push_back(slot);
+        std::push_heap(r.free.begin(), r.free.end(), std::greater<int>());
+    }
+
+protected:
+
+    // The slots that have been given back (a min-heap), and the next slot
+    // that has never been handed out
+    struct registry_t
+    {
+        std::mutex          lock;
+        std::vector<int>    free;
+        int                 next = 0;
+    };
+
+    // This is never destroyed, so that threads that outlive main() can
+    // still give their slots back
+    static registry_t& registry()
+    {
+        static registry_t* r = new registry_t;
+        return *r;
+    }
+};
+//=============================================================================
+
+
+//=============================================================================
+// CThreadSlotOwner - Gives a thread's slot back when the thread exits
+//=============================================================================
+class CThreadSlotOwner
+{
+public:
+    CThreadSlotOwner(int& slot) : slot_(slot) {}
+    ~CThreadSlotOwner()
+    {
+        CThreadSlots::release(slot_);
+        slot_ = THREAD_SLOT_NONE;
+    }
+
+protected:
+    int&    slot_;
+};
+//=============================================================================
+
+
+//=============================================================================
+// thread_slot() - Returns the calling thread's slot number.  The first thread
+//                 to call this gets 0, the next gets 1, and so on, with the
+//                 slots of threads that have exited being handed out again
+//=============================================================================
+inline int thread_slot()
+{
+    static thread_local int slot = -1;
+
+    if (slot < 0)
+    {
+        slot = CThreadSlots::acquire();
+        static thread_local CThreadSlotOwner owner(slot);
+    }
+
+    return slot;
+}
+//=============================================================================
@@ -0,0 +1,117 @@
+//=============================================================================
+// tx_stats.cpp - Lock-free transmit statistics
+//
+// Author: D. Wolf
+//
+// The counters are only ever updated with relaxed atomic adds to a cache-line
+// that belongs to the calling thread, which costs next to nothing compared to
+// the system call being counted
+//=============================================================================
+#include <cerrno>
+#include "tx_stats.h"
+
+// A handy shortcut for relaxed atomic operations
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+
+//=============================================================================
+// CTxStats() - Default constructor
+//=============================================================================
+CTxStats::CTxStats()
+{
+    reset();
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset() - Sets every counter for every thread back to zero
+//=============================================================================
+void CTxStats::reset()
+{
+    for (slot_t& slot : m_slot)
+    {
+        slot.send_calls.store(0, relaxed);
+        slot.frames.store(0, relaxed);
+        slot.bytes.store(0, relaxed);
+        slot.eagain.store(0, relaxed);
+        slot.enobufs.store(0, relaxed);
+        slot.short_writes.store(0, relaxed);
+        slot.errors.store(0, relaxed);
+        for (auto& bucket : slot.latency_hist) bucket.store(0, relaxed);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// record_sent() - Counts a send call that succeeded
+//=============================================================================
+void CTxStats::record_sent(uint64_t frames, uint64_t bytes, bool short_write)
+{
+    slot_t& slot = my_slot();
+    slot.send_calls.fetch_add(1, relaxed);
+    slot.frames.fetch_add(frames, relaxed);
+    slot.bytes.fetch_add(bytes, relaxed);
+    if (short_write) slot.short_writes.fetch_add(1, relaxed);
+}
+//=============================================================================
+
+
+//=============================================================================
+// record_error() - Counts a send call that failed
+//=============================================================================
+void CTxStats::record_error(int error)
+{
+    slot_t& slot = my_slot();
+    slot.send_calls.fetch_add(1, relaxed);
+
+    if (error == EAGAIN || error == EWOULDBLOCK)
+        slot.eagain.fetch_add(1, relaxed);
+    else if (error == ENOBUFS)
+        slot.enobufs.fetch_add(1, relaxed);
+    else
+        slot.errors.fetch_add(1, relaxed);
+}
+//=============================================================================
+
+
+//=============================================================================
+// record_latency() - Adds a send-call duration to the histogram
+//=============================================================================
+void CTxStats::record_latency(uint64_t ns)
+{
+    // The bucket number is the number of significant bits in "ns"
+    int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= tx_stats_t::HIST_BUCKETS) bucket = tx_stats_t::HIST_BUCKETS - 1;
+
+    my_slot().latency_hist[bucket].fetch_add(1, relaxed);
+}
+//=============================================================================
+
+
+//=============================================================================
+// snapshot() - Adds up the counters of every thread
+//=============================================================================
+tx_stats_t CTxStats::snapshot() const
+{
+    tx_stats_t result = {};
+
+    for (const slot_t& slot : m_slot)
+    {
+        result.send_calls   += slot.send_calls.load(relaxed);
+        result.frames       += slot.frames.load(relaxed);
+        result.bytes        += slot.bytes.load(relaxed);
+        result.eagain       += slot.eagain.load(relaxed);
+        result.enobufs      += slot.enobufs.load(relaxed);
+        result.short_writes += slot.short_writes.load(relaxed);
+        result.errors       += slot.errors.load(relaxed);
+        for (int i=0; i<tx_stats_t::HIST_BUCKETS; ++i)
+        {
+            result.latency_hist[i] += slot.latency_hist[i].load(relaxed);
+        }
+    }
+
+    return result;
+}
+//=============================================================================
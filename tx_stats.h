@@ -0,0 +1,84 @@
+//=============================================================================
+// tx_stats.h - Lock-free transmit statistics
+//
+// Author: D. Wolf
+//
+// Every sending thread updates its own cache-line-aligned set of counters, so
+// threads never contend with one another.  "snapshot()" adds up every
+// thread's counters without taking a lock, so a monitoring thread can call
+// it as often as it likes.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include "thread_slot.h"
+
+// A point-in-time copy of the transmit statistics
+struct tx_stats_t
+{
+    // The number of log2 buckets in the send-latency histogram.  Bucket N
+    // counts send calls that took between 2^(N-1) and 2^N - 1 nanoseconds
+    static const int HIST_BUCKETS = 40;
+
+    uint64_t    send_calls;     // Number of send system calls made
+    uint64_t    frames;         // Frames accepted by the kernel
+    uint64_t    bytes;          // Bytes accepted by the kernel
+    uint64_t    eagain;         // Calls that failed with EAGAIN/EWOULDBLOCK
+    uint64_t    enobufs;        // Calls that failed with ENOBUFS
+    uint64_t    short_writes;   // Calls that sent fewer frames/bytes than asked
+    uint64_t    errors;         // Calls that failed for any other reason
+    uint64_t    latency_hist[HIST_BUCKETS];
+};
+
+
+class CTxStats
+{
+public:
+
+    // The maximum number of threads that get counters of their own.  Any
+    // threads beyond this share the last set of counters
+    static const int MAX_THREADS = 64;
+
+    // Constructor
+    CTxStats();
+
+    // Call this after a send that succeeded.  "short_write" should be true
+    // if the kernel accepted fewer frames or bytes than we asked it to send
+    void    record_sent(uint64_t frames, uint64_t bytes, bool short_write);
+
+    // Call this after a send that failed, with the errno it failed with
+    void    record_error(int error);
+
+    // Call this with the number of nanoseconds a send call took
+    void    record_latency(uint64_t ns);
+
+    // Adds up the counters of every thread
+    tx_stats_t snapshot() const;
+
+    // Sets every counter back to zero
+    void    reset();
+
+protected:
+
+    // One thread's counters, on cache-lines of their own
+    struct alignas(64) slot_t
+    {
+        std::atomic<uint64_t> send_calls;
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> eagain;
+        std::atomic<uint64_t> enobufs;
+        std::atomic<uint64_t> short_writes;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> latency_hist[tx_stats_t::HIST_BUCKETS];
+    };
+
+    // Returns the counters for the calling thread
+    slot_t& my_slot()
+    {
+        int slot = thread_slot();
+        return m_slot[slot < MAX_THREADS ? slot : MAX_THREADS - 1];
+    }
+
+    slot_t  m_slot[MAX_THREADS];
+};
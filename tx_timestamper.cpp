@@ -0,0 +1,297 @@
+//=============================================================================
+// tx_timestamper.cpp - Per-frame transmit timestamps, and a latency profiler
+//                      built on them
+//
+// Author: D. Wolf
+//=============================================================================
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/if_packet.h>
+#include "tx_timestamper.h"
+
+
+//=============================================================================
+// realtime_ns() - Returns CLOCK_REALTIME in nanoseconds.  That's the clock
+//                 the kernel's software timestamps are on
+//=============================================================================
+static inline uint64_t realtime_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=============================================================================
+
+
+//=============================================================================
+// CTxTimestamper() - Constructor
+//=============================================================================
+CTxTimestamper::CTxTimestamper(CRawNIC& nic, uint32_t max_in_flight) : m_nic(nic)
+{
+    // The table of pending frames is a power of two in size
+    uint32_t size = 1;
+    while (size < max_in_flight) size <<= 1;
+    m_pending.resize(size);
+    m_mask = size - 1;
+
+    m_next_id   = 0;
+    m_profiling = false;
+    m_hardware  = false;
+    memset(&m_last, 0, sizeof(m_last));
+}
+//=============================================================================
+
+
+//=============================================================================
+// enable() - Turns on transmit timestamps for the NIC's socket
+//=============================================================================
+void CTxTimestamper::enable(bool hardware)
+{
+    int sd = m_nic.socket_fd();
+
+    // If we've been asked to, ask the NIC to timestamp outgoing frames.  Not
+    // every NIC can, and that's fine; we'll still have software timestamps
+    if (hardware)
+    {
+        hwtstamp_config config;
+        memset(&config, 0, sizeof(config));
+        config.tx_type   = HWTSTAMP_TX_ON;
+        config.rx_filter = HWTSTAMP_FILTER_NONE;
+
+        ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        if_indextoname(m_nic.if_index(), ifr.ifr_name);
+        ifr.ifr_data = (char*)&config;
+
+        m_hardware = (ioctl(sd, SIOCSHWTSTAMP, &ifr) == 0);
+        if (!m_hardware) perror("SIOCSHWTSTAMP (using software timestamps)");
+    }
+
+    // We want SCHED and SND timestamps, tagged with the frame's ID, without
+    // a copy of the frame itself
+    int flags = SOF_TIMESTAMPING_TX_SCHED
+              | SOF_TIMESTAMPING_TX_SOFTWARE
+              | SOF_TIMESTAMPING_SOFTWARE
+              | SOF_TIMESTAMPING_OPT_ID
+              | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (m_hardware) flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        perror("SO_TIMESTAMPING");
+        exit(1);
+    }
+
+    // Turning on OPT_ID restarts the IDs at zero
+    m_next_id = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// note_send() - Records the time that the next "count" frames were sent
+//=============================================================================
+void CTxTimestamper::note_send(int count)
+{
+    uint64_t now = realtime_ns();
+
+    while (count--)
+    {
+        stamp_t& stamp = m_pending[m_next_id & m_mask];
+        stamp.id       = m_next_id++;
+        stamp.user_ns  = now;
+        stamp.sched_ns = 0;
+        stamp.snd_ns   = 0;
+        stamp.hw_ns    = 0;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// send() - Sends a frame, noting the time
+//=============================================================================
+void CTxTimestamper::send(const void* frame, uint16_t frame_length)
+{
+    note_send(1);
+    m_nic.send(frame, frame_length);
+}
+//=============================================================================
+
+
+//=============================================================================
+// poll() - Reads the timestamp reports from the socket's error queue
+//=============================================================================
+int CTxTimestamper::poll(int timeout_ms)
+{
+    int sd = m_nic.socket_fd();
+    int completed = 0;
+
+    // If we've been asked to, wait for the first report
+    if (timeout_ms)
+    {
+        pollfd pfd;
+        pfd.fd      = sd;
+        pfd.events  = POLLERR;
+        pfd.revents = 0;
+        ::poll(&pfd, 1, timeout_ms);
+    }
+
+    while (true)
+    {
+        char control[512];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        // Fetch the next report.  EAGAIN means there are no more
+        if (recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+        const scm_timestamping* ts  = nullptr;
+        const sock_extended_err* ee = nullptr;
+
+        // A report is a pair of control messages: the timestamps, and an
+        // "error" that says what kind of timestamp it is and for which frame
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+                ts = (const scm_timestamping*)CMSG_DATA(cmsg);
+
+            else if (cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_TX_TIMESTAMP)
+                ee = (const sock_extended_err*)CMSG_DATA(cmsg);
+        }
+
+        // Ignore anything that isn't a timestamp (SO_TXTIME errors, say)
+        if (ts == nullptr || ee == nullptr) continue;
+        if (ee->ee_errno != ENOMSG || ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) continue;
+
+        uint64_t sw_ns = ts->ts[0].tv_sec * 1000000000ULL + ts->ts[0].tv_nsec;
+        uint64_t hw_ns = ts->ts[2].tv_sec * 1000000000ULL + ts->ts[2].tv_nsec;
+
+        if (handle_report(ee->ee_data, ee->ee_info, sw_ns, hw_ns)) ++completed;
+    }
+
+    return completed;
+}
+//=============================================================================
+
+
+//=============================================================================
+// handle_report() - Files a timestamp with the frame it belongs to.  Returns
+//                   true if that completes the frame's timestamps
+//=============================================================================
+bool CTxTimestamper::handle_report(uint32_t id, uint32_t type, uint64_t sw_ns, uint64_t hw_ns)
+{
+    stamp_t& stamp = m_pending[id & m_mask];
+
+    // If we've lost track of this frame, there's nothing to do
+    if (stamp.id != id || stamp.user_ns == 0) return false;
+
+    if (hw_ns)
+        stamp.hw_ns = hw_ns;
+    else if (type == SCM_TSTAMP_SCHED)
+        stamp.sched_ns = sw_ns;
+    else if (type == SCM_TSTAMP_SND)
+        stamp.snd_ns = sw_ns;
+
+    // The frame is complete once the driver has it (and the NIC has
+    // timestamped it, if we asked for that)
+    if (stamp.snd_ns == 0 || (m_hardware && stamp.hw_ns == 0)) return false;
+
+    complete(stamp);
+    return true;
+}
+//=============================================================================
+
+
+//=============================================================================
+// complete() - Records the latencies of a frame whose timestamps are all in
+//=============================================================================
+void CTxTimestamper::complete(stamp_t& stamp)
+{
+    m_last = stamp;
+
+    if (m_profiling && stamp.sched_ns)
+    {
+        m_user_to_sched.push_back(stamp.sched_ns - stamp.user_ns);
+        m_sched_to_snd.push_back(stamp.snd_ns - stamp.sched_ns);
+    }
+
+    // This slot is free for reuse
+    stamp.user_ns = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// percentiles() - Computes the percentiles of a set of samples
+//=============================================================================
+CTxTimestamper::percentiles_t CTxTimestamper::percentiles(std::vector<uint64_t> samples)
+{
+    percentiles_t result;
+    memset(&result, 0, sizeof(result));
+    if (samples.empty()) return result;
+
+    std::sort(samples.begin(), samples.end());
+
+    auto at = [&](double fraction)
+    {
+        size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+        return samples[index];
+    };
+
+    result.count = samples.size();
+    result.p50   = at(0.50);
+    result.p90   = at(0.90);
+    result.p99   = at(0.99);
+    result.p999  = at(0.999);
+    result.max   = samples.back();
+    return result;
+}
+//=============================================================================
+
+
+//=============================================================================
+// report() - Prints the latency percentiles
+//=============================================================================
+void CTxTimestamper::report(FILE* ofile) const
+{
+    struct {const char* name; percentiles_t p;} row[] =
+    {
+        {"user  -> SCHED", user_to_sched()},
+        {"SCHED -> SND  ", sched_to_snd() }
+    };
+
+    fprintf(ofile, "%s  %8s %8s %8s %8s %8s %8s\n", "latency (ns)  ",
+            "frames", "p50", "p90", "p99", "p99.9", "max");
+
+    for (auto& r : row)
+    {
+        fprintf(ofile, "%s  %8lu %8lu %8lu %8lu %8lu %8lu\n", r.name,
+                r.p.count, r.p.p50, r.p.p90, r.p.p99, r.p.p999, r.p.max);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// reset() - Discards the latency samples collected so far
+//=============================================================================
+void CTxTimestamper::reset()
+{
+    m_user_to_sched.clear();
+    m_sched_to_snd.clear();
+}
+//=============================================================================
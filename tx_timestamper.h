@@ -0,0 +1,128 @@
+//=============================================================================
+// tx_timestamper.h - Per-frame transmit timestamps, and a latency profiler
+//                    built on them
+//
+// Author: D. Wolf
+//
+// With SO_TIMESTAMPING turned on, the kernel reports (via the socket's error
+// queue) the moment each frame entered the packet scheduler ("SCHED") and
+// the moment the driver handed it to the NIC ("SND").  If the NIC supports
+// it, the moment the frame actually left can be reported too ("HW").  Each
+// report carries the frame's ID, which counts up from zero with every frame
+// we send, so the reports can be matched up with the frames.
+//
+// Send frames through this class (or call "note_send()" just before sending
+// them some other way) so that it knows when each frame was sent, then call
+// "poll()" now and then to collect the timestamps.  With profiling on,
+// "report()" prints percentiles of:
+//
+//     user  -> SCHED : time spent in the send() system call before the frame
+//                      reached the packet scheduler
+//     SCHED -> SND   : time spent in the qdisc and the driver's queue
+//
+// Software timestamps work on any interface (veth included).  Note that
+// PACKET_QDISC_BYPASS skips the scheduler, so there are no SCHED timestamps
+// with that turned on.
+//=============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "raw_nic.h"
+
+class CTxTimestamper
+{
+public:
+
+    // The timestamps of a single frame, in CLOCK_REALTIME nanoseconds (the
+    // hardware timestamp is on the NIC's clock).  0 = not reported
+    struct stamp_t
+    {
+        uint32_t    id;
+        uint64_t    user_ns;
+        uint64_t    sched_ns;
+        uint64_t    snd_ns;
+        uint64_t    hw_ns;
+    };
+
+    // Percentiles of a set of latencies, in nanoseconds
+    struct percentiles_t
+    {
+        uint64_t    count;
+        uint64_t    p50;
+        uint64_t    p90;
+        uint64_t    p99;
+        uint64_t    p999;
+        uint64_t    max;
+    };
+
+    // Timestamps frames sent through "nic".  Up to "max_in_flight" frames
+    // can be waiting for their timestamps at once
+    CTxTimestamper(CRawNIC& nic, uint32_t max_in_flight = 4096);
+
+    // Turns on SO_TIMESTAMPING.  If "hardware" is true, hardware timestamps
+    // are turned on as well, if the NIC supports them
+    void    enable(bool hardware = false);
+
+    // Returns true if hardware timestamping was turned on
+    bool    has_hardware() const {return m_hardware;}
+
+    // Sends a frame through the NIC, noting the time
+    void    send(const void* frame, uint16_t frame_length);
+
+    // Call this just before sending "count" frames some other way
+    void    note_send(int count = 1);
+
+    // Reads every timestamp that's waiting in the error queue, waiting up to
+    // "timeout_ms" for the first one.  Returns the number of frames whose
+    // timestamps are now complete
+    int     poll(int timeout_ms = 0);
+
+    // Returns the most recently completed frame's timestamps
+    const stamp_t& last() const {return m_last;}
+
+    // Turns collection of latency samples on or off
+    void    set_profiling(bool enable) {m_profiling = enable;}
+
+    // Percentiles of the latencies collected so far
+    percentiles_t user_to_sched() const {return percentiles(m_user_to_sched);}
+    percentiles_t sched_to_snd()  const {return percentiles(m_sched_to_snd);}
+
+    // Prints the percentiles
+    void    report(FILE* ofile = stdout) const;
+
+    // Discards the latencies collected so far
+    void    reset();
+
+protected:
+
+    // Handles one timestamp report from the error queue
+    bool    handle_report(uint32_t id, uint32_t type, uint64_t sw_ns, uint64_t hw_ns);
+
+    // Called once a frame's timestamps are all in
+    void    complete(stamp_t& stamp);
+
+    // Computes the percentiles of a set of samples
+    static percentiles_t percentiles(std::vector<uint64_t> samples);
+
+    // The NIC whose frames we timestamp
+    CRawNIC&    m_nic;
+
+    // Frames waiting for their timestamps, indexed by ID
+    std::vector<stamp_t> m_pending;
+    uint32_t    m_mask;
+
+    // The ID the next frame we send will have
+    uint32_t    m_next_id;
+
+    // The most recently completed frame
+    stamp_t     m_last;
+
+    // True if we're collecting latency samples, and the samples
+    bool        m_profiling;
+    std::vector<uint64_t> m_user_to_sched;
+    std::vector<uint64_t> m_sched_to_snd;
+
+    // True if hardware timestamps are turned on
+    bool        m_hardware;
+};